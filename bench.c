@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "c8.h"
+
+/*
+ * Interpreter benchmark.
+ *
+ * Opcode classes are timed in isolation: a loop of 60 instructions of one
+ * class and a jump back, executed with `c8_step()`. Bundled workload ROMs
+ * are then run frame by frame under several quirk sets with both engines.
+ * Every result has the median and the 99th percentile of the time per
+ * instruction over the samples, and the instructions per second over the
+ * whole run. `--json FILE` also writes the results as JSON so runs can be
+ * compared.
+ *
+ * Built twice: `c8-bench` uses handlers specialized for the machine's quirks,
+ * `c8-bench-generic` is built with C8_GENERIC_INTERPRETER and checks quirks
+ * at run time. Compare their output to see the gain.
+ *
+ * Workloads run without state hashing, see `c8_set_state_hashing()`. After
+ * every workload run they run a few more frames with it, and the
+ * incremental state hash is checked against one computed from scratch. A
+ * mismatch fails the benchmark.
+ */
+
+enum c8_bench_params {
+    BENCH_OP_SAMPLES = 101,
+    BENCH_OP_STEPS = 61 * 1000, ///< Steps per opcode class sample.
+    BENCH_OP_LOOP = 60, ///< Instructions in an opcode class loop.
+    BENCH_FRAMES = 1000, ///< Frames per workload run, one sample each.
+    BENCH_CYCLES_PER_FRAME = 1000,
+    BENCH_HASH_FRAMES = 100, ///< Frames run with state hashing after that.
+};
+
+/// Body placeholder: jump to the next instruction.
+#define BENCH_OP_JUMP_NEXT 0x1000
+/// Body placeholder: call a subroutine that returns right away.
+#define BENCH_OP_CALL_STUB 0x2000
+
+static const struct {
+    const char* name;
+    uint16_t setup[2]; ///< Executed once, 0 terminated.
+    uint16_t body[3]; ///< Repeated to fill the loop, 0 terminated.
+} BENCH_OP_CLASSES[] = {
+    { "cls", { 0 }, { 0x00E0 } },
+    { "jp", { 0 }, { BENCH_OP_JUMP_NEXT } },
+    { "call_ret", { 0 }, { BENCH_OP_CALL_STUB } },
+    { "skip", { 0 }, { 0x3001, 0x4000, 0x9010 } }, // never taken
+    { "ld", { 0 }, { 0x6042, 0x8010 } },
+    { "add", { 0 }, { 0x7001 } },
+    { "logic", { 0 }, { 0x8011, 0x8012, 0x8013 } },
+    { "arith", { 0 }, { 0x8014, 0x8015, 0x8017 } },
+    { "shift", { 0 }, { 0x8016, 0x801E } },
+    { "ld_i", { 0 }, { 0xA300 } },
+    { "add_i", { 0 }, { 0xF01E } },
+    { "rnd", { 0 }, { 0xC0FF } },
+    { "drw", { 0xA050 }, { 0xD015 } },
+    { "skp", { 0 }, { 0xE09E } }, // no key pressed
+    { "timers", { 0 }, { 0xF015, 0xF007 } },
+    { "font", { 0 }, { 0xF029 } },
+    { "bcd", { 0 }, { 0xA300, 0xF033 } },
+    { "store", { 0 }, { 0xA300, 0xF755 } },
+    { "load", { 0 }, { 0xA300, 0xF765 } },
+};
+
+// Workloads have a side effect in every loop, so the idle loop detection
+// never skips them.
+
+static const uint8_t BENCH_ALU_ROM[] = {
+    0xA3, 0x00, // ld i, 0x300
+    0x60, 0x05, // ld v0, 5
+    0x61, 0x03, // ld v1, 3
+    0x80, 0x11, // or v0, v1
+    0x80, 0x12, // and v0, v1
+    0x80, 0x13, // xor v0, v1
+    0x80, 0x16, // shr v0, v1
+    0x80, 0x1E, // shl v0, v1
+    0xF2, 0x55, // ld [i], v2
+    0xF2, 0x65, // ld v2, [i]
+    0xA3, 0x00, // ld i, 0x300
+    0x12, 0x06, // jp 0x206
+};
+
+static const uint8_t BENCH_DRAW_ROM[] = {
+    0xA2, 0x0A, // ld i, 0x20A
+    0x70, 0x03, // add v0, 3
+    0x71, 0x01, // add v1, 1
+    0xD0, 0x15, // drw v0, v1, 5
+    0x12, 0x02, // jp 0x202
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // sprite
+};
+
+static const uint8_t BENCH_CALL_ROM[] = {
+    0xA3, 0x00, // ld i, 0x300
+    0x22, 0x0C, // call 0x20C
+    0xC2, 0xFF, // rnd v2, 0xFF
+    0x70, 0x01, // add v0, 1
+    0x12, 0x02, // jp 0x202
+    0x00, 0x00,
+    0x22, 0x14, // call 0x214
+    0x81, 0x04, // add v1, v0
+    0x22, 0x14, // call 0x214
+    0x00, 0xEE, // ret
+    0x83, 0x24, // add v3, v2
+    0x00, 0xEE, // ret
+};
+
+static const uint8_t BENCH_MEMORY_ROM[] = {
+    0xA3, 0x00, // ld i, 0x300
+    0xF3, 0x55, // ld [i], v3
+    0xF3, 0x65, // ld v3, [i]
+    0xF0, 0x33, // bcd v0
+    0x70, 0x07, // add v0, 7
+    0xF0, 0x1E, // add i, v0
+    0xF1, 0x55, // ld [i], v1
+    0x12, 0x00, // jp 0x200
+};
+
+static const struct {
+    const char* name;
+    const uint8_t* rom;
+    uint16_t rom_size;
+} BENCH_WORKLOADS[] = {
+    { "alu", BENCH_ALU_ROM, sizeof(BENCH_ALU_ROM) },
+    { "draw", BENCH_DRAW_ROM, sizeof(BENCH_DRAW_ROM) },
+    { "call", BENCH_CALL_ROM, sizeof(BENCH_CALL_ROM) },
+    { "memory", BENCH_MEMORY_ROM, sizeof(BENCH_MEMORY_ROM) },
+};
+
+static const struct {
+    const char* name;
+    uint32_t quirks;
+} BENCH_QUIRK_SETS[] = {
+    { "none", C8_QUIRK_NONE },
+    { "vf_reset+shift", C8_QUIRK_VF_RESET | C8_QUIRK_SHIFT },
+    { "load_store", C8_QUIRK_LOAD_STORE_INC_I_BY_X },
+    { "wrap", C8_QUIRK_WRAP_SPRITES },
+    {
+        "all (no vblank)",
+        C8_QUIRK_SHIFT | C8_QUIRK_LOAD_STORE_NO_INC_I | C8_QUIRK_WRAP_SPRITES
+            | C8_QUIRK_BXNN_JUMP | C8_QUIRK_VF_RESET
+    },
+};
+
+static const struct {
+    const char* name;
+    c8_engine engine;
+} BENCH_ENGINES[] = {
+    { "interpreter", C8_ENGINE_INTERPRETER },
+    { "jit", C8_ENGINE_JIT },
+};
+
+#define BENCH_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+/// Workload runs whose incremental state hash was wrong.
+static uint32_t bench_hash_mismatches;
+
+/**
+ * Summary of the samples of one benchmark.
+ */
+typedef struct bench_result {
+    double median_ns; ///< Median time per instruction.
+    double p99_ns; ///< 99th percentile time per instruction.
+    double ips; ///< Instructions per second over all samples.
+} bench_result;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Summarizes samples of nanoseconds per instruction. Sorts `samples`.
+ */
+static bench_result summarize(double* samples,
+                              uint32_t count,
+                              double instructions,
+                              double elapsed) {
+    qsort(samples, count, sizeof(double), compare_doubles);
+    // Nearest rank
+    const uint32_t p99 = (count * 99 + 99) / 100 - 1;
+    return (bench_result){
+        .median_ns = samples[count / 2],
+        .p99_ns = samples[p99],
+        .ips = instructions / elapsed,
+    };
+}
+
+static void emit_op(uint8_t* rom, uint16_t* addr, uint16_t op) {
+    rom[*addr - 0x200] = op >> 8;
+    rom[*addr - 0x200 + 1] = op & 0xFF;
+    *addr += 2;
+}
+
+/**
+ * Builds the loop of an opcode class.
+ *
+ * @return ROM size.
+ */
+static uint16_t build_op_rom(uint32_t index, uint8_t* rom) {
+    const uint16_t* setup = BENCH_OP_CLASSES[index].setup;
+    const uint16_t* body = BENCH_OP_CLASSES[index].body;
+
+    uint16_t setup_size = 0;
+    while (setup_size < 2 && setup[setup_size] != 0) {
+        ++setup_size;
+    }
+
+    const uint16_t loop = 0x200 + setup_size * 2;
+    const uint16_t stub = loop + (BENCH_OP_LOOP + 1) * 2;
+
+    uint16_t addr = 0x200;
+    for (uint16_t i = 0; i < setup_size; ++i) {
+        emit_op(rom, &addr, setup[i]);
+    }
+    for (uint32_t i = 0; i < BENCH_OP_LOOP;) {
+        for (uint32_t k = 0; k < 3 && body[k] != 0; ++k, ++i) {
+            uint16_t op = body[k];
+            if (op == BENCH_OP_JUMP_NEXT) {
+                op = 0x1000 | (addr + 2);
+            } else if (op == BENCH_OP_CALL_STUB) {
+                op = 0x2000 | stub;
+            }
+            emit_op(rom, &addr, op);
+        }
+    }
+    emit_op(rom, &addr, 0x1000 | loop);
+    emit_op(rom, &addr, 0x00EE);
+    return addr - 0x200;
+}
+
+static bench_result bench_op_class(uint32_t index) {
+    uint8_t rom[(BENCH_OP_LOOP + 4) * 2];
+    const uint16_t rom_size = build_op_rom(index, rom);
+
+    c8_state* vm = c8_create(c8_get_default_machine_config());
+    c8_set_rng_seed(vm, 1);
+    c8_load_rom(vm, rom, rom_size);
+
+    static double samples[BENCH_OP_SAMPLES];
+    double total = 0.;
+    // The first pass warms up caches and is not counted
+    for (int32_t sample = -1; sample < BENCH_OP_SAMPLES; ++sample) {
+        const double start = now_seconds();
+        for (uint32_t i = 0; i < BENCH_OP_STEPS; ++i) {
+            c8_step(vm);
+        }
+        const double elapsed = now_seconds() - start;
+
+        if (sample >= 0) {
+            samples[sample] = elapsed * 1e9 / BENCH_OP_STEPS;
+            total += elapsed;
+        }
+    }
+
+    c8_destroy(vm);
+    return summarize(samples,
+                     BENCH_OP_SAMPLES,
+                     (double)BENCH_OP_SAMPLES * BENCH_OP_STEPS,
+                     total);
+}
+
+static bench_result bench_workload(uint32_t workload,
+                                   uint32_t quirks,
+                                   c8_engine engine) {
+    c8_machine_config config = c8_get_default_machine_config();
+    config.quirks = quirks;
+    config.cycles_per_frame = BENCH_CYCLES_PER_FRAME;
+    config.engine = engine;
+
+    c8_state* vm = c8_create(config);
+    c8_set_rng_seed(vm, 1);
+    c8_load_rom(vm, BENCH_WORKLOADS[workload].rom,
+                BENCH_WORKLOADS[workload].rom_size);
+
+    static double samples[BENCH_FRAMES];
+    double total = 0.;
+    double instructions = 0.;
+    for (int32_t frame = -1; frame < BENCH_FRAMES; ++frame) {
+        const double start = now_seconds();
+        const uint32_t cycles =
+            c8_run(vm, BENCH_CYCLES_PER_FRAME, C8_STOP_BUDGET).cycles;
+        const double elapsed = now_seconds() - start;
+
+        if (frame >= 0) {
+            samples[frame] = elapsed * 1e9 / (cycles > 0 ? cycles : 1);
+            total += elapsed;
+            instructions += cycles;
+        }
+    }
+
+    c8_set_state_hashing(vm, true);
+    for (uint32_t frame = 0; frame < BENCH_HASH_FRAMES; ++frame) {
+        c8_run(vm, BENCH_CYCLES_PER_FRAME, C8_STOP_BUDGET);
+    }
+    if (c8_get_state_hash(vm) != c8_compute_state_hash(vm)) {
+        fprintf(stderr,
+                "%s: state hash mismatch\n",
+                BENCH_WORKLOADS[workload].name);
+        ++bench_hash_mismatches;
+    }
+
+    c8_destroy(vm);
+    return summarize(samples, BENCH_FRAMES, instructions, total);
+}
+
+static void print_result(const char* name,
+                         const char* engine,
+                         const char* quirks,
+                         bench_result result) {
+    printf("%-10s %-12s %-16s %10.2f %10.2f %10.1f\n",
+           name,
+           engine,
+           quirks,
+           result.median_ns,
+           result.p99_ns,
+           result.ips / 1e6);
+}
+
+static void write_json_result(FILE* json,
+                              const char* name,
+                              const char* engine,
+                              const char* quirks,
+                              bench_result result,
+                              bool last) {
+    fprintf(json,
+            "    {\"name\": \"%s\", \"engine\": \"%s\", \"quirks\": \"%s\", "
+            "\"median_ns\": %.3f, \"p99_ns\": %.3f, \"ips\": %.0f}%s\n",
+            name,
+            engine,
+            quirks,
+            result.median_ns,
+            result.p99_ns,
+            result.ips,
+            last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+#ifdef C8_GENERIC_INTERPRETER
+    const char* flavor = "generic";
+#else
+    const char* flavor = "specialized";
+#endif
+
+    const char* json_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--json FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FILE* json = nullptr;
+    if (json_path != nullptr) {
+        json = fopen(json_path, "w");
+        if (json == nullptr) {
+            fprintf(stderr, "can't open %s\n", json_path);
+            return 1;
+        }
+        fprintf(json, "{\n  \"flavor\": \"%s\",\n", flavor);
+    }
+
+    printf("c8 interpreter benchmark (%s handlers)\n", flavor);
+    printf("%-10s %-12s %-16s %10s %10s %10s\n",
+           "benchmark",
+           "engine",
+           "quirks",
+           "median ns",
+           "p99 ns",
+           "MIPS");
+
+    if (json != nullptr) {
+        fprintf(json, "  \"opcodes\": [\n");
+    }
+    for (uint32_t i = 0; i < BENCH_COUNT(BENCH_OP_CLASSES); ++i) {
+        const bench_result result = bench_op_class(i);
+        print_result(BENCH_OP_CLASSES[i].name, "interpreter", "none", result);
+        if (json != nullptr) {
+            write_json_result(json,
+                              BENCH_OP_CLASSES[i].name,
+                              "interpreter",
+                              "none",
+                              result,
+                              i + 1 == BENCH_COUNT(BENCH_OP_CLASSES));
+        }
+    }
+
+    if (json != nullptr) {
+        fprintf(json, "  ],\n  \"workloads\": [\n");
+    }
+    for (uint32_t w = 0; w < BENCH_COUNT(BENCH_WORKLOADS); ++w) {
+        for (uint32_t e = 0; e < BENCH_COUNT(BENCH_ENGINES); ++e) {
+            for (uint32_t q = 0; q < BENCH_COUNT(BENCH_QUIRK_SETS); ++q) {
+                const bench_result result =
+                    bench_workload(w,
+                                   BENCH_QUIRK_SETS[q].quirks,
+                                   BENCH_ENGINES[e].engine);
+                print_result(BENCH_WORKLOADS[w].name,
+                             BENCH_ENGINES[e].name,
+                             BENCH_QUIRK_SETS[q].name,
+                             result);
+                if (json != nullptr) {
+                    const bool last = w + 1 == BENCH_COUNT(BENCH_WORKLOADS)
+                        && e + 1 == BENCH_COUNT(BENCH_ENGINES)
+                        && q + 1 == BENCH_COUNT(BENCH_QUIRK_SETS);
+                    write_json_result(json,
+                                      BENCH_WORKLOADS[w].name,
+                                      BENCH_ENGINES[e].name,
+                                      BENCH_QUIRK_SETS[q].name,
+                                      result,
+                                      last);
+                }
+            }
+        }
+    }
+
+    if (json != nullptr) {
+        fprintf(json, "  ]\n}\n");
+        fclose(json);
+    }
+
+    return bench_hash_mismatches > 0 ? 1 : 0;
+}
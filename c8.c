@@ -1,8 +1,14 @@
-#include "c8.h"
+#include "c8_internal.h"
 #include <stdlib.h>
 #include <memory.h>
 #include <assert.h>
 
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
 /*
  * Sources:
  * http://devernay.free.fr/hacks/chip8/C8TECH10.HTM
@@ -10,14 +16,6 @@
  * https://github.com/edrosten/8bit_rng/blob/master/rng-4294967294.cc
  */
 
-enum c8_machine_params
-#ifndef C23_COMPAT_NO_ENUM_TYPES
-    : uint16_t
-#endif
-{
-    C8_MEM_FONT_OFFSET = 0x50, C8_PC_ON_FAULT = 0x0,
-};
-
 const uint8_t C8_FAULT_HANDLER[] =
     { 0x10 | ((C8_PC_ON_FAULT & 0x0F00) >> 8), C8_PC_ON_FAULT & 0xFF };
 
@@ -40,19 +38,314 @@ static const uint8_t C8_FONT[80] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-struct c8_state {
-    c8_machine_config config;
-    c8_registers registers;
-    bool pressed_keys[C8_KEY_MAX];
-    uint8_t* memory;
-    uint8_t* display;
-    union {
-        uint32_t seed;
-        uint8_t b[4];
-    } rng;
-    float delta_time;
-    uint16_t vblank;
-};
+#pragma region Memory pages
+
+#ifdef _WIN32
+static uint32_t c8_page_refs_load(c8_page_refs* refs) {
+    return (uint32_t)InterlockedCompareExchange(refs, 0, 0);
+}
+
+static void c8_page_refs_add(c8_page_refs* refs) {
+    InterlockedIncrement(refs);
+}
+
+static uint32_t c8_page_refs_sub(c8_page_refs* refs) {
+    return (uint32_t)InterlockedDecrement(refs);
+}
+#else
+static uint32_t c8_page_refs_load(c8_page_refs* refs) {
+    return atomic_load_explicit(refs, memory_order_acquire);
+}
+
+static void c8_page_refs_add(c8_page_refs* refs) {
+    atomic_fetch_add_explicit(refs, 1, memory_order_relaxed);
+}
+
+static uint32_t c8_page_refs_sub(c8_page_refs* refs) {
+    return atomic_fetch_sub_explicit(refs, 1, memory_order_acq_rel) - 1;
+}
+#endif
+
+#ifdef _WIN32
+static void c8_arena_lock(c8_page_arena* arena) {
+    while (InterlockedExchange(&arena->lock, 1) != 0) {
+        YieldProcessor();
+    }
+}
+
+static void c8_arena_unlock(c8_page_arena* arena) {
+    InterlockedExchange(&arena->lock, 0);
+}
+#else
+static void c8_arena_lock(c8_page_arena* arena) {
+    while (atomic_exchange_explicit(&arena->lock, 1, memory_order_acquire)
+           != 0) {
+    }
+}
+
+static void c8_arena_unlock(c8_page_arena* arena) {
+    atomic_store_explicit(&arena->lock, 0, memory_order_release);
+}
+#endif
+
+/**
+ * Puts pages on the free list of an arena. The caller holds the lock.
+ */
+static void c8_arena_add_pages(c8_page_arena* arena,
+                               c8_page* pages,
+                               uint32_t count) {
+    for (uint32_t i = count; i > 0; --i) {
+        pages[i - 1].next = arena->free_pages;
+        arena->free_pages = &pages[i - 1];
+    }
+}
+
+/**
+ * Takes a free page of the arena, allocating a chunk of them when there are
+ * none left.
+ *
+ * @return Page with a single reference, or NULL if out of memory.
+ */
+static c8_page* c8_page_alloc(c8_state* state) {
+    c8_page_arena* arena = state->arena;
+    c8_arena_lock(arena);
+    if (arena->free_pages == nullptr) {
+        c8_page_chunk* chunk = malloc(sizeof(c8_page_chunk)
+            + arena->chunk_pages * sizeof(c8_page));
+        if (chunk == nullptr) {
+            c8_arena_unlock(arena);
+            return nullptr;
+        }
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        c8_arena_add_pages(arena, chunk->pages, arena->chunk_pages);
+    }
+    c8_page* page = arena->free_pages;
+    arena->free_pages = page->next;
+    c8_arena_unlock(arena);
+
+    page->refs = 1;
+    page->forked = false;
+    return page;
+}
+
+static c8_page* c8_page_retain(c8_page* page) {
+    c8_page_refs_add(&page->refs);
+    return page;
+}
+
+static void c8_page_release(c8_state* state, c8_page* page) {
+    if (page == nullptr || c8_page_refs_sub(&page->refs) > 0) {
+        return;
+    }
+
+    c8_page_arena* arena = state->arena;
+    c8_arena_lock(arena);
+    page->next = arena->free_pages;
+    arena->free_pages = page;
+    c8_arena_unlock(arena);
+}
+
+/**
+ * Makes a page table entry point to a private copy of its page.
+ *
+ * @param keep Whether to copy the contents, false when the caller overwrites
+ * the whole page anyway.
+ * @return The copy, the page itself if nobody else points to it, or NULL if
+ * out of memory.
+ */
+static c8_page* c8_page_own(c8_state* state,
+                            c8_page** table,
+                            uint16_t index,
+                            bool keep) {
+    c8_page* page = table[index];
+    if (c8_page_refs_load(&page->refs) == 1) {
+        return page;
+    }
+
+    c8_page* copy = c8_page_alloc(state);
+    if (copy == nullptr) {
+        return nullptr;
+    }
+    copy->hash = page->hash;
+    copy->hashed = page->hashed;
+    if (keep) {
+        memcpy(copy->insns, page->insns, sizeof(page->insns));
+        memcpy(copy->bytes, page->bytes, sizeof(page->bytes));
+    }
+    table[index] = copy;
+    c8_page_release(state, page);
+    return copy;
+}
+
+/**
+ * Gets a page whose decoded instructions may be written. Pages that have
+ * never been forked only hold the same memory for this machine, so they can
+ * be filled in place even when both page tables point to them. Pages shared
+ * with other machines are copied.
+ *
+ * @return The page, or NULL if out of memory.
+ */
+static c8_page* c8_page_own_insns(c8_state* state,
+                                  c8_page** table,
+                                  uint16_t index) {
+    c8_page* page = table[index];
+    return !page->forked ? page : c8_page_own(state, table, index, true);
+}
+
+/**
+ * Gets the state hash terms of a page, summing its bytes if its hash is
+ * outdated. The sum is kept unless other threads may be reading the page.
+ *
+ * @param page Page, or NULL for none.
+ * @param index Page table entry the page is mapped to.
+ */
+static uint64_t c8_page_hash(c8_page* page, uint16_t index) {
+    if (page == nullptr) {
+        return 0;
+    }
+    if (page->hashed) {
+        return page->hash;
+    }
+
+    // Terms of the bytes are minus the change of zeroing them
+    const uint64_t hash = -c8_hash_memory_delta(index * C8_PAGE_SIZE,
+                                                page->bytes,
+                                                nullptr,
+                                                C8_PAGE_SIZE);
+    if (!page->forked) {
+        page->hash = hash;
+        page->hashed = true;
+    }
+    return hash;
+}
+
+/**
+ * Writes to the pages of a page table and drops instructions decoded from
+ * the written bytes. With `hashing`, hashes are updated, pages written
+ * without it have their hashes outdated. Writes to shared pages that can't
+ * be copied are dropped with an out of memory fault.
+ *
+ * @param data Bytes to write, or NULL to write zeroes.
+ */
+static void c8_write_pages(c8_state* state,
+                           c8_page** table,
+                           uint16_t addr,
+                           const uint8_t* data,
+                           uint32_t size) {
+    const uint32_t end = C8_MIN((uint32_t)addr + size,
+                                state->config.memory_size);
+    for (uint32_t a = addr; a < end;) {
+        const uint16_t offset = a % C8_PAGE_SIZE;
+        const uint16_t count = C8_MIN(end - a, C8_PAGE_SIZE - offset);
+        const uint64_t delta = !state->hashing ? 0 :
+            c8_hash_memory_delta(a,
+                                 table[a / C8_PAGE_SIZE]->bytes + offset,
+                                 data != nullptr ? data + (a - addr) : nullptr,
+                                 count);
+        c8_page* page = c8_page_own(state,
+                                    table,
+                                    a / C8_PAGE_SIZE,
+                                    count < C8_PAGE_SIZE);
+        if (page == nullptr) {
+            // No copy of the shared page, the write is lost
+            c8_record_fault(state,
+                            C8_FAULT_OUT_OF_MEMORY,
+                            state->registers.pc);
+            a += count;
+            continue;
+        }
+        if (!state->hashing) {
+            page->hashed = false;
+        }
+        else {
+            page->hash += delta;
+            if (table == state->pages) {
+                state->memory_hash += delta;
+            }
+        }
+        if (data != nullptr) {
+            memcpy(page->bytes + offset, data + (a - addr), count);
+        }
+        else {
+            memset(page->bytes + offset, 0, count);
+        }
+
+        // The entry before decodes the first byte as well
+        const uint16_t begin = offset > 0 ? offset - 1 : 0;
+        memset(page->insns + begin,
+               0,
+               (offset + count - begin) * sizeof(c8_insn));
+        a += count;
+    }
+}
+
+/**
+ * Points a memory page table entry to another page, dropping translated
+ * code of the old one.
+ */
+static void c8_map_page(c8_state* state, uint16_t index, c8_page* page) {
+    c8_page* old = state->pages[index];
+    if (state->hashing) {
+        state->memory_hash +=
+            c8_page_hash(page, index) - c8_page_hash(old, index);
+    }
+    c8_page_release(state, old);
+    state->pages[index] = c8_page_retain(page);
+    state->memory_stale[index >> 6] |= UINT64_C(1) << (index & 63);
+    if (state->jit != nullptr) {
+        c8_jit_invalidate(state->jit, index * C8_PAGE_SIZE, C8_PAGE_SIZE);
+    }
+}
+
+void c8_read_memory(const c8_state* state,
+                    uint16_t addr,
+                    uint8_t* out,
+                    uint32_t size) {
+    const uint32_t end = C8_MIN((uint32_t)addr + size,
+                                state->config.memory_size);
+    uint32_t a = addr;
+    while (a < end) {
+        const uint16_t offset = a % C8_PAGE_SIZE;
+        const uint16_t count = C8_MIN(end - a, C8_PAGE_SIZE - offset);
+        memcpy(out + (a - addr),
+               state->pages[a / C8_PAGE_SIZE]->bytes + offset,
+               count);
+        a += count;
+    }
+
+    if (a < (uint32_t)addr + size) {
+        memset(out + (a - addr), 0, addr + size - a);
+    }
+}
+
+void c8_write_memory(c8_state* state,
+                     uint16_t addr,
+                     const uint8_t* data,
+                     uint32_t size) {
+    const uint32_t end = C8_MIN((uint32_t)addr + size,
+                                state->config.memory_size);
+    if (addr >= end) {
+        return;
+    }
+
+    c8_write_pages(state, state->pages, addr, data, size);
+    for (uint32_t page = addr / C8_PAGE_SIZE;
+         page <= (end - 1) / C8_PAGE_SIZE;
+         ++page) {
+        state->memory_stale[page >> 6] |= UINT64_C(1) << (page & 63);
+    }
+
+    if (state->jit != nullptr) {
+        c8_jit_invalidate(state->jit, addr, end - addr);
+    }
+
+    state->waiting_for_key = false;
+    ++state->side_effects;
+    ++state->code_writes;
+}
+
+#pragma endregion
 
 #pragma region CHIP-8 instructions
 
@@ -71,9 +364,21 @@ static void c8_op_sys(c8_state* state, uint16_t nnn) {
  * Clears the display. Sets all pixels to off.
  */
 static void c8_op_cls(c8_state* state) {
-    memset(state->display,
-           0,
-           state->config.screen_width * state->config.screen_height);
+    const uint8_t words = state->display_words;
+    for (uint8_t y = 0; y < state->config.screen_height; ++y) {
+        uint64_t* row = &state->display_rows[y * words];
+        uint64_t pixels = 0;
+        for (uint8_t w = 0; w < words; ++w) {
+            pixels |= row[w];
+            row[w] = 0;
+        }
+        if (pixels != 0) {
+            c8_display_mark_dirty(state, y, 0, state->config.screen_width - 1);
+        }
+    }
+    state->display_hash = 0;
+    state->display_view_stale = true;
+    ++state->side_effects;
     state->registers.pc += 2;
 }
 
@@ -85,7 +390,8 @@ static void c8_op_cls(c8_state* state) {
  */
 static void c8_op_ret(c8_state* state) {
     if (state->registers.sp == 0) {
-        state->registers.pc = C8_PC_ON_FAULT;
+        c8_raise_fault(state, C8_FAULT_STACK_UNDERFLOW, state->registers.pc);
+        return;
     }
     state->registers.pc = state->registers.stack[--state->registers.sp] + 2;
 }
@@ -108,11 +414,11 @@ static void c8_op_jp_nnn(c8_state* state, uint16_t nnn) {
  */
 static void c8_op_call(c8_state* state, uint16_t nnn) {
     if (state->registers.sp >= 16) {
-        state->registers.pc = C8_PC_ON_FAULT;
+        c8_raise_fault(state, C8_FAULT_STACK_OVERFLOW, state->registers.pc);
+        return;
     }
     state->registers.stack[state->registers.sp++] = state->registers.pc;
     state->registers.pc = nnn;
-
 }
 
 /**
@@ -178,10 +484,13 @@ static void c8_op_ld_vx_vy(c8_state* state, uint8_t x, uint8_t y) {
  *
  * Set VX equal to the bitwise or of the values in VX and VY.
  */
-static void c8_op_or(c8_state* state, uint8_t x, uint8_t y) {
+static inline void c8_op_or(c8_state* state,
+                            uint8_t x,
+                            uint8_t y,
+                            uint32_t quirks) {
     state->registers.v[x] |= state->registers.v[y];
 
-    if ((state->config.quirks & C8_QUIRK_VF_RESET) != 0) {
+    if ((quirks & C8_QUIRK_VF_RESET) != 0) {
         state->registers.v[0xF] = 0;
     }
 
@@ -193,10 +502,13 @@ static void c8_op_or(c8_state* state, uint8_t x, uint8_t y) {
  *
  * Set VX equal to the bitwise and of the values in VX and VY.
  */
-static void c8_op_and(c8_state* state, uint8_t x, uint8_t y) {
+static inline void c8_op_and(c8_state* state,
+                             uint8_t x,
+                             uint8_t y,
+                             uint32_t quirks) {
     state->registers.v[x] &= state->registers.v[y];
 
-    if ((state->config.quirks & C8_QUIRK_VF_RESET) != 0) {
+    if ((quirks & C8_QUIRK_VF_RESET) != 0) {
         state->registers.v[0xF] = 0;
     }
 
@@ -208,10 +520,13 @@ static void c8_op_and(c8_state* state, uint8_t x, uint8_t y) {
  *
  * Set VX equal to the bitwise xor of the values in VX and VY.
  */
-static void c8_op_xor(c8_state* state, uint8_t x, uint8_t y) {
+static inline void c8_op_xor(c8_state* state,
+                             uint8_t x,
+                             uint8_t y,
+                             uint32_t quirks) {
     state->registers.v[x] ^= state->registers.v[y];
 
-    if ((state->config.quirks & C8_QUIRK_VF_RESET) != 0) {
+    if ((quirks & C8_QUIRK_VF_RESET) != 0) {
         state->registers.v[0xF] = 0;
     }
 
@@ -251,8 +566,11 @@ static void c8_op_sub(c8_state* state, uint8_t x, uint8_t y) {
  * Set VX equal to VY or VX bitshifted right 1. VF is set to the least
  * significant bit of VX prior to the shift. 
  */
-static void c8_op_shr(c8_state* state, uint8_t x, uint8_t y) {
-    const bool hasShiftQuirk = (state->config.quirks & C8_QUIRK_SHIFT) != 0;
+static inline void c8_op_shr(c8_state* state,
+                             uint8_t x,
+                             uint8_t y,
+                             uint32_t quirks) {
+    const bool hasShiftQuirk = (quirks & C8_QUIRK_SHIFT) != 0;
     const uint8_t value = state->registers.v[hasShiftQuirk ? x : y];
     state->registers.v[x] = value >> 1;
     state->registers.v[0xF] = value & 0x1;
@@ -277,8 +595,11 @@ static void c8_op_subn(c8_state* state, uint8_t x, uint8_t y) {
  * Set VX equal to VY or VX bitshifted left 1. VF is set to the most
  * significant bit of VX prior to the shift. 
  */
-static void c8_op_shl(c8_state* state, uint8_t x, uint8_t y) {
-    const bool hasShiftQuirk = (state->config.quirks & C8_QUIRK_SHIFT) != 0;
+static inline void c8_op_shl(c8_state* state,
+                             uint8_t x,
+                             uint8_t y,
+                             uint32_t quirks) {
+    const bool hasShiftQuirk = (quirks & C8_QUIRK_SHIFT) != 0;
     const uint8_t value = state->registers.v[hasShiftQuirk ? x : y];
     state->registers.v[x] = value << 1;
     state->registers.v[0xF] = (value & 0x80) >> 7;
@@ -310,8 +631,10 @@ static void c8_op_ld_i_nnn(c8_state* state, uint16_t nnn) {
  *
  * Set the PC to NNN plus the value in V0.
  */
-static void c8_op_jp_v0_nnn(c8_state* state, uint16_t nnn) {
-    const bool jpXNN = (state->config.quirks & C8_QUIRK_BXNN_JUMP) != 0;
+static inline void c8_op_jp_v0_nnn(c8_state* state,
+                                   uint16_t nnn,
+                                   uint32_t quirks) {
+    const bool jpXNN = (quirks & C8_QUIRK_BXNN_JUMP) != 0;
     state->registers.pc =
         nnn + state->registers.v[jpXNN ? (nnn & 0xF00) >> 8 : 0];
 }
@@ -360,15 +683,63 @@ static void c8_op_rnd(c8_state* state, uint8_t x, uint8_t nn) {
     state->registers.pc += 2;
 }
 
+/**
+ * XORs a span of up to 8 pixels into a packed display row.
+ *
+ * @param row Packed display row.
+ * @param keys State hash keys of the row words, or NULL to leave `hash` as
+ * it is.
+ * @param col Column of the span's first pixel.
+ * @param bits Span pixels, MSB-aligned.
+ * @param hash State hash terms to update.
+ * @return true if any pixel was turned off.
+ */
+static inline bool c8_display_xor_span(uint64_t* row,
+                                       const uint64_t* keys,
+                                       uint8_t col,
+                                       uint64_t bits,
+                                       uint64_t* hash) {
+    const uint8_t word = col >> 6;
+    const uint8_t offset = col & 63;
+
+    const uint64_t lo = bits >> offset;
+    const uint64_t old_lo = row[word];
+    row[word] = old_lo ^ lo;
+    if (keys != nullptr) {
+        *hash += keys[word] * (row[word] - old_lo);
+    }
+    bool collision = (old_lo & lo) != 0;
+
+    // Clipped spans end at the last word, don't touch the next row
+    const uint64_t hi = offset > 56 ? bits << (64 - offset) : 0;
+    if (hi != 0) {
+        const uint64_t old_hi = row[word + 1];
+        row[word + 1] = old_hi ^ hi;
+        if (keys != nullptr) {
+            *hash += keys[word + 1] * (row[word + 1] - old_hi);
+        }
+        collision |= (old_hi & hi) != 0;
+    }
+
+    return collision;
+}
+
 /**
  * Dxyn - DRW Vx, Vy, n
  *
  * Display N-byte sprite starting at memory location I at (VX, VY). Each set
  * bit of xored with what's already drawn. VF is set to 1 if a collision
  * occurs. 0 otherwise.
+ *
+ * Every sprite row is split at the right screen edge: the visible part is
+ * XORed in at VX, the rest either wraps to column 0 or is clipped.
  */
-static void c8_op_drw(c8_state* state, uint8_t x, uint8_t y, uint8_t n) {
-    const bool hasVblankQuirk = (state->config.quirks & C8_QUIRK_VBLANK) != 0;
+static inline void c8_op_drw(c8_state* state,
+                             uint8_t x,
+                             uint8_t y,
+                             uint8_t n,
+                             uint32_t quirks) {
+    const bool hasVblankQuirk = (quirks & C8_QUIRK_VBLANK) != 0;
     if (hasVblankQuirk) {
         if (state->vblank == 0) {
             return;
@@ -378,37 +749,67 @@ static void c8_op_drw(c8_state* state, uint8_t x, uint8_t y, uint8_t n) {
 
     const uint8_t screen_width = state->config.screen_width;
     const uint8_t screen_height = state->config.screen_height;
+    const uint8_t words = state->display_words;
 
     uint8_t px0 = state->registers.v[x] % screen_width;
     uint8_t py0 = state->registers.v[y] % screen_height;
 
-    uint8_t* sprite = &state->memory[state->registers.i];
-
-    state->registers.v[0xF] = 0;
+    // Sprites crossing a page or the end of memory are gathered, the bytes
+    // past the end read as zero
+    const uint16_t addr = state->registers.i;
+    uint8_t gathered[16];
+    const uint8_t* sprite = gathered;
+    if (addr % C8_PAGE_SIZE + n <= C8_PAGE_SIZE
+        && addr + n <= state->config.memory_size) {
+        sprite = state->pages[addr / C8_PAGE_SIZE]->bytes + addr % C8_PAGE_SIZE;
+    }
+    else {
+        c8_read_memory(state, addr, gathered, n);
+        if (addr + n > state->config.memory_size) {
+            c8_record_fault(state,
+                            C8_FAULT_MEMORY_OUT_OF_BOUNDS,
+                            state->registers.pc);
+        }
+    }
 
     const bool
-        wrap_sprites = (state->config.quirks & C8_QUIRK_WRAP_SPRITES) != 0;
+        wrap_sprites = (quirks & C8_QUIRK_WRAP_SPRITES) != 0;
     const uint8_t
-        sprite_width = wrap_sprites ? 8 : C8_MIN(8, screen_width - px0);
+        visible_width = C8_MIN(8, screen_width - px0);
     const uint8_t
         sprite_height = wrap_sprites ? n : C8_MIN(n, screen_height - py0);
+    const uint64_t
+        visible_mask = ~(UINT64_MAX >> visible_width);
 
+    bool collision = false;
+    uint64_t hash = state->display_hash;
     for (uint8_t i = 0; i < sprite_height; ++i) {
-        for (uint8_t j = 0; j < sprite_width; ++j) {
-            uint8_t dx = (px0 + j) % screen_width;
-            uint8_t dy = (py0 + i) % screen_height;
-
-            uint8_t* disp_pixel = &state->display[dy * screen_width + dx];
-            uint8_t sprite_pixel = (*sprite >> (7 - j)) & 0x1;
-
-            if (*disp_pixel && sprite_pixel) {
-                state->registers.v[0xF] = 1;
-            }
-            *disp_pixel ^= sprite_pixel;
+        const uint8_t dy = (py0 + i) % screen_height;
+        uint64_t* row = &state->display_rows[dy * words];
+        const uint64_t* keys =
+            state->hashing ? &c8_hash_display_keys[dy * words] : nullptr;
+        const uint64_t bits = (uint64_t)*sprite << 56;
+        const uint64_t visible_bits = bits & visible_mask;
+        const uint64_t wrapped_bits =
+            wrap_sprites && visible_width < 8 ? bits << visible_width : 0;
+
+        if (visible_bits != 0) {
+            collision |=
+                c8_display_xor_span(row, keys, px0, visible_bits, &hash);
+            c8_display_mark_dirty(state, dy, px0, px0 + visible_width - 1);
+        }
+        if (wrapped_bits != 0) {
+            collision |=
+                c8_display_xor_span(row, keys, 0, wrapped_bits, &hash);
+            c8_display_mark_dirty(state, dy, 0, 7 - visible_width);
         }
         ++sprite;
     }
 
+    state->registers.v[0xF] = collision;
+    state->display_hash = hash;
+    state->display_view_stale = true;
+    ++state->side_effects;
     state->registers.pc += 2;
 }
 
@@ -448,15 +849,40 @@ static void c8_op_ld_vx_dt(c8_state* state, uint8_t x) {
  * Fx0A - LD Vx, KEY
  *
  * Wait for a key press and store the value of the key into VX.
+ *
+ * While there is nothing to do, the machine is put to sleep until
+ * `c8_press_key()` or `c8_release_key()` changes a key state, then the
+ * instruction runs again.
  */
-static void c8_op_ld_vx_key(c8_state* state, uint8_t x) {
+static inline void c8_op_ld_vx_key(c8_state* state,
+                                   uint8_t x,
+                                   uint32_t quirks) {
+    const bool hasKeyReleaseQuirk = (quirks & C8_QUIRK_KEY_RELEASE) != 0;
+    if (hasKeyReleaseQuirk && state->key_wait_key < C8_KEY_MAX) {
+        if (!state->pressed_keys[state->key_wait_key]) {
+            state->registers.v[x] = state->key_wait_key;
+            state->registers.pc += 2;
+            state->key_wait_key = C8_KEY_MAX;
+            return;
+        }
+        state->waiting_for_key = true;
+        return;
+    }
+
     for (c8_key i = C8_KEY_0; i < C8_KEY_MAX; ++i) {
         if (state->pressed_keys[i]) {
+            if (hasKeyReleaseQuirk) {
+                state->key_wait_key = i;
+                state->waiting_for_key = true;
+                return;
+            }
             state->registers.v[x] = i;
             state->registers.pc += 2;
-            break;
+            return;
         }
     }
+
+    state->waiting_for_key = true;
 }
 
 /**
@@ -475,6 +901,9 @@ static void c8_op_ld_dt_vx(c8_state* state, uint8_t x) {
  * Set the sound timer ST to VX.
  */
 static void c8_op_ld_st_vx(c8_state* state, uint8_t x) {
+    if (state->registers.st == 0 && state->registers.v[x] != 0) {
+        state->events |= C8_STOP_SOUND;
+    }
     state->registers.st = state->registers.v[x];
     state->registers.pc += 2;
 }
@@ -512,10 +941,15 @@ static void c8_op_ld_i_font_vx(c8_state* state, uint8_t x) {
 static void c8_op_bcd(c8_state* state, uint8_t x) {
     const uint16_t i = state->registers.i;
     const uint16_t vx = state->registers.v[x];
+    if (i + 3 > state->config.memory_size) {
+        // Digits past the end are dropped
+        c8_record_fault(state,
+                        C8_FAULT_MEMORY_OUT_OF_BOUNDS,
+                        state->registers.pc);
+    }
 
-    state->memory[i] = (vx / 100) % 10;
-    state->memory[i + 1] = (vx / 10) % 10;
-    state->memory[i + 2] = vx % 10;
+    const uint8_t digits[3] = { (vx / 100) % 10, (vx / 10) % 10, vx % 10 };
+    c8_write_memory(state, i, digits, 3);
 
     state->registers.pc += 2;
 }
@@ -525,20 +959,25 @@ static void c8_op_bcd(c8_state* state, uint8_t x) {
  *
  * Store registers V0 through VX in memory starting at location I.
  */
-static void c8_op_ld_i_vx(c8_state* state, uint8_t x) {
+static inline void c8_op_ld_i_vx(c8_state* state,
+                                 uint8_t x,
+                                 uint32_t quirks) {
     const uint16_t i = state->registers.i;
     const uint16_t mem_size = state->config.memory_size;
 
     if (i + x >= mem_size) {
-        x = mem_size - i - 1;
+        c8_record_fault(state,
+                        C8_FAULT_MEMORY_OUT_OF_BOUNDS,
+                        state->registers.pc);
+        x = i < mem_size ? mem_size - i - 1 : 0;
     }
 
-    memcpy(state->memory + i, state->registers.v, x + 1);
+    c8_write_memory(state, i, state->registers.v, x + 1);
 
     const bool
-        shouldIncI = (state->config.quirks & C8_QUIRK_LOAD_STORE_NO_INC_I) == 0;
+        shouldIncI = (quirks & C8_QUIRK_LOAD_STORE_NO_INC_I) == 0;
     const bool
-        incByX = (state->config.quirks & C8_QUIRK_LOAD_STORE_INC_I_BY_X) != 0;
+        incByX = (quirks & C8_QUIRK_LOAD_STORE_INC_I_BY_X) != 0;
 
     if (shouldIncI) {
         state->registers.i += x + (incByX ? 0 : 1);
@@ -553,20 +992,25 @@ static void c8_op_ld_i_vx(c8_state* state, uint8_t x) {
  * Copy values from memory location I through I + X into registers V0
  * through VX.
  */
-static void c8_op_ld_vx_i(c8_state* state, uint8_t x) {
+static inline void c8_op_ld_vx_i(c8_state* state,
+                                 uint8_t x,
+                                 uint32_t quirks) {
     const uint16_t i = state->registers.i;
     const uint16_t mem_size = state->config.memory_size;
 
     if (i + x >= mem_size) {
-        x = mem_size - i - 1;
+        c8_record_fault(state,
+                        C8_FAULT_MEMORY_OUT_OF_BOUNDS,
+                        state->registers.pc);
+        x = i < mem_size ? mem_size - i - 1 : 0;
     }
 
-    memcpy(state->registers.v, state->memory + i, x + 1);
+    c8_read_memory(state, i, state->registers.v, x + 1);
 
     const bool
-        shouldIncI = (state->config.quirks & C8_QUIRK_LOAD_STORE_NO_INC_I) == 0;
+        shouldIncI = (quirks & C8_QUIRK_LOAD_STORE_NO_INC_I) == 0;
     const bool
-        incByX = (state->config.quirks & C8_QUIRK_LOAD_STORE_INC_I_BY_X) != 0;
+        incByX = (quirks & C8_QUIRK_LOAD_STORE_INC_I_BY_X) != 0;
 
     if (shouldIncI) {
         state->registers.i += x + (incByX ? 0 : 1);
@@ -577,264 +1021,1077 @@ static void c8_op_ld_vx_i(c8_state* state, uint8_t x) {
 
 #pragma endregion
 
-static bool c8_chip8_op_handler(c8_state* state, uint16_t op) {
-    bool h = false; // is op handled
+#pragma region Dispatch
 
-    switch (op & 0xF000) {
-        case 0x0000:
-            switch (op) {
-                case 0x00E0:
-                    c8_op_cls(state);
-                    h = true;
-                    break;
-                case 0x00EE:
-                    c8_op_ret(state);
-                    h = true;
-                    break;
-                default:
-                    c8_op_sys(state, op);
-                    h = true;
-                    break;
-            }
-            break;
-        case 0x1000:
-            c8_op_jp_nnn(state, op & 0x0FFF);
-            h = true;
-            break;
-        case 0x2000:
-            c8_op_call(state, op & 0x0FFF);
-            h = true;
-            break;
-        case 0x3000:
-            c8_op_se_vx_nn(state, (op & 0x0F00) >> 8, op & 0x00FF);
-            h = true;
-            break;
-        case 0x4000:
-            c8_op_sne_vx_nn(state, (op & 0x0F00) >> 8, op & 0x00FF);
-            h = true;
-            break;
-        case 0x5000:
-            switch (op & 0x000F) {
-                case 0:
-                    c8_op_se_vx_vy(
-                        state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4
-                    );
-                    h = true;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case 0x6000:
-            c8_op_ld_vx_nn(state, (op & 0x0F00) >> 8, op & 0x00FF);
-            h = true;
-            break;
-        case 0x7000:
-            c8_op_add_vx_nn(state, (op & 0x0F00) >> 8, op & 0x00FF);
-            h = true;
-            break;
-        case 0x8000:
-            switch (op & 0x000F) {
-                case 0x0:
-                    c8_op_ld_vx_vy(
-                        state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4
-                    );
-                    h = true;
-                    break;
-                case 0x1:
-                    c8_op_or(state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4);
-                    h = true;
-                    break;
-                case 0x2:
-                    c8_op_and(state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4);
-                    h = true;
-                    break;
-                case 0x3:
-                    c8_op_xor(state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4);
-                    h = true;
-                    break;
-                case 0x4:
-                    c8_op_add_vx_vy(
-                        state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4
-                    );
-                    h = true;
-                    break;
-                case 0x5:
-                    c8_op_sub(state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4);
-                    h = true;
-                    break;
-                case 0x6:
-                    c8_op_shr(state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4);
-                    h = true;
-                    break;
-                case 0x7:
-                    c8_op_subn(state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4);
-                    h = true;
-                    break;
-                case 0xE:
-                    c8_op_shl(state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4);
-                    h = true;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case 0x9000:
-            switch (op & 0x000F) {
-                case 0:
-                    c8_op_sne_vx_vy(
-                        state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4
-                    );
-                    h = true;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case 0xA000:
-            c8_op_ld_i_nnn(state, op & 0x0FFF);
-            h = true;
-            break;
-        case 0xB000:
-            c8_op_jp_v0_nnn(state, op & 0x0FFF);
-            h = true;
-            break;
-        case 0xC000:
-            c8_op_rnd(state, (op & 0x0F00) >> 8, op & 0x00FF);
-            h = true;
-            break;
-        case 0xD000:
-            c8_op_drw(
-                state, (op & 0x0F00) >> 8, (op & 0x00F0) >> 4, op & 0x000F
-            );
-            h = true;
-            break;
-        case 0xE000:
-            switch (op & 0x00FF) {
-                case 0x9E:
-                    c8_op_skp(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                case 0xA1:
-                    c8_op_sknp(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case 0xF000:
-            switch (op & 0x00FF) {
-                case 0x07:
-                    c8_op_ld_vx_dt(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                case 0x0A:
-                    c8_op_ld_vx_key(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                case 0x15:
-                    c8_op_ld_dt_vx(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                case 0x18:
-                    c8_op_ld_st_vx(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                case 0x1E:
-                    c8_op_add_i_vx(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                case 0x29:
-                    c8_op_ld_i_font_vx(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                case 0x33:
-                    c8_op_bcd(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                case 0x55:
-                    c8_op_ld_i_vx(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                case 0x65:
-                    c8_op_ld_vx_i(state, (op & 0x0F00) >> 8);
-                    h = true;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        default:
-            // this should never happen, but just in case
-            break;
+/*
+ * Every opcode is decoded exactly once into a `c8_insn`: an instruction kind
+ * plus its operands, already extracted. The decode table below covers all
+ * 65536 opcodes and is shared between machines; per-machine behaviour
+ * (extension handlers) is layered on top of it in `c8_decode()`.
+ */
+
+#define C8_EXEC_NONE(name)                                                     \
+    static void c8_exec_##name(c8_state* state, const c8_insn* insn) {        \
+        c8_op_##name(state);                                                   \
+    }
+#define C8_EXEC_NNN(name)                                                      \
+    static void c8_exec_##name(c8_state* state, const c8_insn* insn) {        \
+        c8_op_##name(state, insn->nnn);                                        \
+    }
+#define C8_EXEC_X(name)                                                        \
+    static void c8_exec_##name(c8_state* state, const c8_insn* insn) {        \
+        c8_op_##name(state, insn->x);                                          \
+    }
+#define C8_EXEC_XNN(name)                                                      \
+    static void c8_exec_##name(c8_state* state, const c8_insn* insn) {        \
+        c8_op_##name(state, insn->x, insn->nn);                                \
+    }
+#define C8_EXEC_XY(name)                                                       \
+    static void c8_exec_##name(c8_state* state, const c8_insn* insn) {        \
+        c8_op_##name(state, insn->x, insn->y);                                 \
     }
 
-    return h;
-}
+/*
+ * Quirk-dependent instructions have a generic handler, which reads quirks
+ * from the machine config, and a handler specialized for every combination
+ * of quirks they depend on. `c8_create()` installs the specialized ones, so
+ * quirk checks are folded away at compile time. Build with
+ * C8_GENERIC_INTERPRETER defined to always use the generic handlers.
+ */
+#define C8_EXEC_NNN_Q(name, suffix, quirks)                                    \
+    static void c8_exec_##name##suffix(c8_state* state,                       \
+                                       const c8_insn* insn) {                 \
+        c8_op_##name(state, insn->nnn, (quirks));                              \
+    }
+#define C8_EXEC_X_Q(name, suffix, quirks)                                      \
+    static void c8_exec_##name##suffix(c8_state* state,                       \
+                                       const c8_insn* insn) {                 \
+        c8_op_##name(state, insn->x, (quirks));                                \
+    }
+#define C8_EXEC_XY_Q(name, suffix, quirks)                                     \
+    static void c8_exec_##name##suffix(c8_state* state,                       \
+                                       const c8_insn* insn) {                 \
+        c8_op_##name(state, insn->x, insn->y, (quirks));                       \
+    }
+#define C8_EXEC_XYN_Q(name, suffix, quirks)                                    \
+    static void c8_exec_##name##suffix(c8_state* state,                       \
+                                       const c8_insn* insn) {                 \
+        c8_op_##name(state, insn->x, insn->y, insn->n, (quirks));              \
+    }
+#define C8_GENERIC_QUIRKS state->config.quirks
+
+C8_EXEC_NNN(sys)
+C8_EXEC_NONE(cls)
+C8_EXEC_NONE(ret)
+C8_EXEC_NNN(jp_nnn)
+C8_EXEC_NNN(call)
+C8_EXEC_XNN(se_vx_nn)
+C8_EXEC_XNN(sne_vx_nn)
+C8_EXEC_XY(se_vx_vy)
+C8_EXEC_XNN(ld_vx_nn)
+C8_EXEC_XNN(add_vx_nn)
+C8_EXEC_XY(ld_vx_vy)
+C8_EXEC_XY_Q(or, , C8_GENERIC_QUIRKS)
+C8_EXEC_XY_Q(and, , C8_GENERIC_QUIRKS)
+C8_EXEC_XY_Q(xor, , C8_GENERIC_QUIRKS)
+C8_EXEC_XY(add_vx_vy)
+C8_EXEC_XY(sub)
+C8_EXEC_XY_Q(shr, , C8_GENERIC_QUIRKS)
+C8_EXEC_XY(subn)
+C8_EXEC_XY_Q(shl, , C8_GENERIC_QUIRKS)
+C8_EXEC_XY(sne_vx_vy)
+C8_EXEC_NNN(ld_i_nnn)
+C8_EXEC_NNN_Q(jp_v0_nnn, , C8_GENERIC_QUIRKS)
+C8_EXEC_XNN(rnd)
+C8_EXEC_XYN_Q(drw, , C8_GENERIC_QUIRKS)
+C8_EXEC_X(skp)
+C8_EXEC_X(sknp)
+C8_EXEC_X(ld_vx_dt)
+C8_EXEC_X_Q(ld_vx_key, , C8_GENERIC_QUIRKS)
+C8_EXEC_X(ld_dt_vx)
+C8_EXEC_X(ld_st_vx)
+C8_EXEC_X(add_i_vx)
+C8_EXEC_X(ld_i_font_vx)
+C8_EXEC_X(bcd)
+C8_EXEC_X_Q(ld_i_vx, , C8_GENERIC_QUIRKS)
+C8_EXEC_X_Q(ld_vx_i, , C8_GENERIC_QUIRKS)
+
+#ifndef C8_GENERIC_INTERPRETER
+
+C8_EXEC_XY_Q(or, _q0, C8_QUIRK_NONE)
+C8_EXEC_XY_Q(or, _q1, C8_QUIRK_VF_RESET)
+C8_EXEC_XY_Q(and, _q0, C8_QUIRK_NONE)
+C8_EXEC_XY_Q(and, _q1, C8_QUIRK_VF_RESET)
+C8_EXEC_XY_Q(xor, _q0, C8_QUIRK_NONE)
+C8_EXEC_XY_Q(xor, _q1, C8_QUIRK_VF_RESET)
+C8_EXEC_XY_Q(shr, _q0, C8_QUIRK_NONE)
+C8_EXEC_XY_Q(shr, _q1, C8_QUIRK_SHIFT)
+C8_EXEC_XY_Q(shl, _q0, C8_QUIRK_NONE)
+C8_EXEC_XY_Q(shl, _q1, C8_QUIRK_SHIFT)
+C8_EXEC_NNN_Q(jp_v0_nnn, _q0, C8_QUIRK_NONE)
+C8_EXEC_NNN_Q(jp_v0_nnn, _q1, C8_QUIRK_BXNN_JUMP)
+C8_EXEC_XYN_Q(drw, _q0, C8_QUIRK_NONE)
+C8_EXEC_XYN_Q(drw, _q1, C8_QUIRK_WRAP_SPRITES)
+C8_EXEC_XYN_Q(drw, _q2, C8_QUIRK_VBLANK)
+C8_EXEC_XYN_Q(drw, _q3, C8_QUIRK_WRAP_SPRITES | C8_QUIRK_VBLANK)
+C8_EXEC_X_Q(ld_vx_key, _q0, C8_QUIRK_NONE)
+C8_EXEC_X_Q(ld_vx_key, _q1, C8_QUIRK_KEY_RELEASE)
+C8_EXEC_X_Q(ld_i_vx, _q0, C8_QUIRK_NONE)
+C8_EXEC_X_Q(ld_i_vx, _q1, C8_QUIRK_LOAD_STORE_INC_I_BY_X)
+C8_EXEC_X_Q(ld_i_vx, _q2, C8_QUIRK_LOAD_STORE_NO_INC_I)
+C8_EXEC_X_Q(ld_i_vx,
+            _q3,
+            C8_QUIRK_LOAD_STORE_INC_I_BY_X | C8_QUIRK_LOAD_STORE_NO_INC_I)
+C8_EXEC_X_Q(ld_vx_i, _q0, C8_QUIRK_NONE)
+C8_EXEC_X_Q(ld_vx_i, _q1, C8_QUIRK_LOAD_STORE_INC_I_BY_X)
+C8_EXEC_X_Q(ld_vx_i, _q2, C8_QUIRK_LOAD_STORE_NO_INC_I)
+C8_EXEC_X_Q(ld_vx_i,
+            _q3,
+            C8_QUIRK_LOAD_STORE_INC_I_BY_X | C8_QUIRK_LOAD_STORE_NO_INC_I)
 
-c8_machine_config c8_get_default_machine_config() {
-    c8_machine_config config = {
-        .op_handlers = {c8_chip8_op_handler, },
-        .op_handlers_size = 1,
-        .quirks = C8_QUIRK_NONE,
-        .memory_size = 4096,
-        .cycles_per_frame = 15,
-        .screen_width = 64,
-        .screen_height = 32
-    };
-    return config;
-}
+#endif
 
-c8_state* c8_create(c8_machine_config config) {
-    c8_state* result = malloc(sizeof(c8_state));
-    result->config = config;
-    result->memory = nullptr;
-    result->display = nullptr;
-    result->vblank = 1;
+static uint32_t c8_builtin_handler_index(const c8_machine_config* config);
 
-    c8_reset(result);
+/**
+ * Runs an opcode through the `op_handlers` chain of the machine config.
+ * Handlers before the built-in one only get opcodes in their claims, so
+ * opcodes nobody claimed only go to the handlers after it.
+ */
+static void c8_exec_ext(c8_state* state, const c8_insn* insn) {
+    // Handlers can do anything, so never treat them as idle
+    ++state->side_effects;
+
+    const c8_machine_config* config = &state->config;
+    const uint16_t op = insn->op;
+    const uint32_t builtin = c8_builtin_handler_index(config);
+    const uint32_t first = insn->kind == C8_OP_ILLEGAL ? builtin + 1 : 0;
+    for (uint32_t i = first; i < config->op_handlers_size; ++i) {
+        const c8_op_claim claim = config->op_handler_claims[i];
+        if (i < builtin && (op & claim.mask) != claim.value) {
+            continue;
+        }
+        if (config->op_handlers[i](state, op)) {
+            return;
+        }
+    }
 
-    return result;
+    // Nobody took the opcode, PC stays on it
+    c8_record_fault(state, C8_FAULT_ILLEGAL_OPCODE, state->registers.pc);
 }
 
-void c8_destroy(c8_state* state) {
-    if (state == nullptr) {
+/**
+ * Runs an instruction at a breakpoint address. When breakpoints are armed,
+ * stops instead, without executing anything.
+ */
+static void c8_exec_break(c8_state* state, const c8_insn* insn) {
+    // Pages shared with the parent of a fork keep the parent's breakpoints
+    const uint16_t pc = state->registers.pc;
+    if (state->break_armed
+        && state->breakpoints != nullptr
+        && (state->breakpoints[pc >> 3] >> (pc & 7)) & 1) {
+        state->events |= C8_STOP_BREAKPOINT;
         return;
     }
 
-    free(state->display);
-    free(state);
+    const c8_insn decoded = c8_decode(state, insn->op);
+    state->exec[decoded.kind](state, &decoded);
 }
 
-void c8_set_rng_seed(c8_state* state, uint32_t seed) {
-    if (state == nullptr) {
+/**
+ * Raises a watchpoint event if any of `size` bytes starting at `addr` is
+ * set in the watchpoint bitmap.
+ */
+static void c8_watch_check(c8_state* state,
+                           const uint8_t* bitmap,
+                           uint16_t addr,
+                           uint32_t size,
+                           uint32_t event) {
+    if (bitmap == nullptr) {
         return;
     }
 
-    state->rng.seed = seed;
+    const uint32_t end = C8_MIN(addr + size, state->config.memory_size);
+    for (uint32_t a = addr; a < end; ++a) {
+        if ((bitmap[a >> 3] >> (a & 7)) & 1) {
+            state->events |= event;
+            state->watch_hit = a;
+            return;
+        }
+    }
 }
 
-uint32_t c8_get_rng_seed(c8_state* state) {
-    if (state == nullptr) {
-        return 0;
-    }
+/**
+ * Handler for memory accessing instructions installed while watchpoints
+ * are set. Checks the accessed range once the instruction has executed.
+ */
+static void c8_exec_watched(c8_state* state, const c8_insn* insn) {
+    const uint16_t pc = state->registers.pc;
+    const uint16_t i = state->registers.i;
 
-    return state->rng.seed;
-}
+    state->exec_unwatched[insn->kind](state, insn);
 
-void c8_load_rom(c8_state* state, const uint8_t* rom, uint16_t size) {
-    if (state == nullptr || rom == nullptr) {
+    if (state->registers.pc == pc) {
+        // Stalled, nothing was accessed
         return;
     }
 
-    int sz = C8_MIN(size, state->config.memory_size - 0x200);
-    memmove(state->memory + 0x200, rom, sz);
+    switch (insn->kind) {
+        case C8_OP_DRW:
+            c8_watch_check(state,
+                           state->watch_read,
+                           i,
+                           insn->n,
+                           C8_STOP_WATCH_READ);
+            break;
+        case C8_OP_LD_VX_I:
+            c8_watch_check(state,
+                           state->watch_read,
+                           i,
+                           insn->x + 1,
+                           C8_STOP_WATCH_READ);
+            break;
+        case C8_OP_BCD:
+            c8_watch_check(state,
+                           state->watch_write,
+                           i,
+                           3,
+                           C8_STOP_WATCH_WRITE);
+            break;
+        case C8_OP_LD_I_VX:
+            c8_watch_check(state,
+                           state->watch_write,
+                           i,
+                           insn->x + 1,
+                           C8_STOP_WATCH_WRITE);
+            break;
+        default:
+            break;
+    }
 }
 
-const c8_machine_config* c8_get_machine_config(c8_state* state) {
-    if (state == nullptr) {
-        return nullptr;
+/**
+ * Instructions accessing memory through I, see `c8_exec_watched()`.
+ */
+static const uint8_t C8_WATCHED_KINDS[] = {
+    C8_OP_DRW, C8_OP_LD_VX_I, C8_OP_BCD, C8_OP_LD_I_VX,
+};
+
+static void c8_exec_undecoded(c8_state* state, const c8_insn* insn);
+
+static const c8_op_exec C8_EXEC[C8_OP_KIND_MAX] = {
+    [C8_OP_UNDECODED] = c8_exec_undecoded,
+    [C8_OP_ILLEGAL] = c8_exec_ext,
+    [C8_OP_EXT] = c8_exec_ext,
+    [C8_OP_BREAK] = c8_exec_break,
+    [C8_OP_SYS] = c8_exec_sys,
+    [C8_OP_CLS] = c8_exec_cls,
+    [C8_OP_RET] = c8_exec_ret,
+    [C8_OP_JP_NNN] = c8_exec_jp_nnn,
+    [C8_OP_CALL] = c8_exec_call,
+    [C8_OP_SE_VX_NN] = c8_exec_se_vx_nn,
+    [C8_OP_SNE_VX_NN] = c8_exec_sne_vx_nn,
+    [C8_OP_SE_VX_VY] = c8_exec_se_vx_vy,
+    [C8_OP_LD_VX_NN] = c8_exec_ld_vx_nn,
+    [C8_OP_ADD_VX_NN] = c8_exec_add_vx_nn,
+    [C8_OP_LD_VX_VY] = c8_exec_ld_vx_vy,
+    [C8_OP_OR] = c8_exec_or,
+    [C8_OP_AND] = c8_exec_and,
+    [C8_OP_XOR] = c8_exec_xor,
+    [C8_OP_ADD_VX_VY] = c8_exec_add_vx_vy,
+    [C8_OP_SUB] = c8_exec_sub,
+    [C8_OP_SHR] = c8_exec_shr,
+    [C8_OP_SUBN] = c8_exec_subn,
+    [C8_OP_SHL] = c8_exec_shl,
+    [C8_OP_SNE_VX_VY] = c8_exec_sne_vx_vy,
+    [C8_OP_LD_I_NNN] = c8_exec_ld_i_nnn,
+    [C8_OP_JP_V0_NNN] = c8_exec_jp_v0_nnn,
+    [C8_OP_RND] = c8_exec_rnd,
+    [C8_OP_DRW] = c8_exec_drw,
+    [C8_OP_SKP] = c8_exec_skp,
+    [C8_OP_SKNP] = c8_exec_sknp,
+    [C8_OP_LD_VX_DT] = c8_exec_ld_vx_dt,
+    [C8_OP_LD_VX_KEY] = c8_exec_ld_vx_key,
+    [C8_OP_LD_DT_VX] = c8_exec_ld_dt_vx,
+    [C8_OP_LD_ST_VX] = c8_exec_ld_st_vx,
+    [C8_OP_ADD_I_VX] = c8_exec_add_i_vx,
+    [C8_OP_LD_I_FONT_VX] = c8_exec_ld_i_font_vx,
+    [C8_OP_BCD] = c8_exec_bcd,
+    [C8_OP_LD_I_VX] = c8_exec_ld_i_vx,
+    [C8_OP_LD_VX_I] = c8_exec_ld_vx_i,
+};
+
+/**
+ * Installs handlers specialized for the given set of quirks.
+ */
+static void c8_specialize_exec(c8_op_exec* exec, uint32_t quirks) {
+#ifndef C8_GENERIC_INTERPRETER
+    const bool vf_reset = (quirks & C8_QUIRK_VF_RESET) != 0;
+    exec[C8_OP_OR] = vf_reset ? c8_exec_or_q1 : c8_exec_or_q0;
+    exec[C8_OP_AND] = vf_reset ? c8_exec_and_q1 : c8_exec_and_q0;
+    exec[C8_OP_XOR] = vf_reset ? c8_exec_xor_q1 : c8_exec_xor_q0;
+
+    const bool shift = (quirks & C8_QUIRK_SHIFT) != 0;
+    exec[C8_OP_SHR] = shift ? c8_exec_shr_q1 : c8_exec_shr_q0;
+    exec[C8_OP_SHL] = shift ? c8_exec_shl_q1 : c8_exec_shl_q0;
+
+    const bool jump = (quirks & C8_QUIRK_BXNN_JUMP) != 0;
+    exec[C8_OP_JP_V0_NNN] = jump ? c8_exec_jp_v0_nnn_q1 : c8_exec_jp_v0_nnn_q0;
+
+    static const c8_op_exec drw[] = {
+        c8_exec_drw_q0, c8_exec_drw_q1, c8_exec_drw_q2, c8_exec_drw_q3,
+    };
+    exec[C8_OP_DRW] = drw[((quirks & C8_QUIRK_WRAP_SPRITES) != 0 ? 1 : 0)
+        | ((quirks & C8_QUIRK_VBLANK) != 0 ? 2 : 0)];
+
+    const bool key_release = (quirks & C8_QUIRK_KEY_RELEASE) != 0;
+    exec[C8_OP_LD_VX_KEY] =
+        key_release ? c8_exec_ld_vx_key_q1 : c8_exec_ld_vx_key_q0;
+
+    static const c8_op_exec ld_i_vx[] = {
+        c8_exec_ld_i_vx_q0, c8_exec_ld_i_vx_q1,
+        c8_exec_ld_i_vx_q2, c8_exec_ld_i_vx_q3,
+    };
+    static const c8_op_exec ld_vx_i[] = {
+        c8_exec_ld_vx_i_q0, c8_exec_ld_vx_i_q1,
+        c8_exec_ld_vx_i_q2, c8_exec_ld_vx_i_q3,
+    };
+    const uint32_t ld_st =
+        ((quirks & C8_QUIRK_LOAD_STORE_INC_I_BY_X) != 0 ? 1 : 0)
+        | ((quirks & C8_QUIRK_LOAD_STORE_NO_INC_I) != 0 ? 2 : 0);
+    exec[C8_OP_LD_I_VX] = ld_i_vx[ld_st];
+    exec[C8_OP_LD_VX_I] = ld_vx_i[ld_st];
+#endif
+}
+
+/**
+ * Maps an opcode to the built-in instruction kind.
+ */
+static uint8_t c8_op_kind_of(uint16_t op) {
+    switch (op & 0xF000) {
+        case 0x0000:
+            switch (op) {
+                case 0x00E0: return C8_OP_CLS;
+                case 0x00EE: return C8_OP_RET;
+                default: return C8_OP_SYS;
+            }
+        case 0x1000: return C8_OP_JP_NNN;
+        case 0x2000: return C8_OP_CALL;
+        case 0x3000: return C8_OP_SE_VX_NN;
+        case 0x4000: return C8_OP_SNE_VX_NN;
+        case 0x5000:
+            return (op & 0x000F) == 0 ? C8_OP_SE_VX_VY : C8_OP_ILLEGAL;
+        case 0x6000: return C8_OP_LD_VX_NN;
+        case 0x7000: return C8_OP_ADD_VX_NN;
+        case 0x8000:
+            switch (op & 0x000F) {
+                case 0x0: return C8_OP_LD_VX_VY;
+                case 0x1: return C8_OP_OR;
+                case 0x2: return C8_OP_AND;
+                case 0x3: return C8_OP_XOR;
+                case 0x4: return C8_OP_ADD_VX_VY;
+                case 0x5: return C8_OP_SUB;
+                case 0x6: return C8_OP_SHR;
+                case 0x7: return C8_OP_SUBN;
+                case 0xE: return C8_OP_SHL;
+                default: return C8_OP_ILLEGAL;
+            }
+        case 0x9000:
+            return (op & 0x000F) == 0 ? C8_OP_SNE_VX_VY : C8_OP_ILLEGAL;
+        case 0xA000: return C8_OP_LD_I_NNN;
+        case 0xB000: return C8_OP_JP_V0_NNN;
+        case 0xC000: return C8_OP_RND;
+        case 0xD000: return C8_OP_DRW;
+        case 0xE000:
+            switch (op & 0x00FF) {
+                case 0x9E: return C8_OP_SKP;
+                case 0xA1: return C8_OP_SKNP;
+                default: return C8_OP_ILLEGAL;
+            }
+        case 0xF000:
+            switch (op & 0x00FF) {
+                case 0x07: return C8_OP_LD_VX_DT;
+                case 0x0A: return C8_OP_LD_VX_KEY;
+                case 0x15: return C8_OP_LD_DT_VX;
+                case 0x18: return C8_OP_LD_ST_VX;
+                case 0x1E: return C8_OP_ADD_I_VX;
+                case 0x29: return C8_OP_LD_I_FONT_VX;
+                case 0x33: return C8_OP_BCD;
+                case 0x55: return C8_OP_LD_I_VX;
+                case 0x65: return C8_OP_LD_VX_I;
+                default: return C8_OP_ILLEGAL;
+            }
+        default:
+            // this should never happen, but just in case
+            return C8_OP_ILLEGAL;
+    }
+}
+
+static c8_insn c8_decode_table[0x10000];
+
+static void c8_build_decode_table(void) {
+    for (uint32_t op = 0; op <= 0xFFFF; ++op) {
+        c8_decode_table[op] = (c8_insn){
+            .kind = c8_op_kind_of(op),
+            .x = (op & 0x0F00) >> 8,
+            .y = (op & 0x00F0) >> 4,
+            .n = op & 0x000F,
+            .nn = op & 0x00FF,
+            .nnn = op & 0x0FFF,
+            .op = op,
+        };
+    }
+}
+
+#ifdef _WIN32
+static INIT_ONCE c8_decode_table_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK c8_build_decode_table_once(PINIT_ONCE once,
+                                               PVOID param,
+                                               PVOID* context) {
+    c8_build_decode_table();
+    return TRUE;
+}
+
+static void c8_init_decode_table(void) {
+    InitOnceExecuteOnce(&c8_decode_table_once,
+                        c8_build_decode_table_once,
+                        nullptr,
+                        nullptr);
+}
+#else
+static pthread_once_t c8_decode_table_once = PTHREAD_ONCE_INIT;
+
+static void c8_init_decode_table(void) {
+    pthread_once(&c8_decode_table_once, c8_build_decode_table);
+}
+#endif
+
+static bool c8_chip8_op_handler(c8_state* state, uint16_t op) {
+    const c8_insn* insn = &c8_decode_table[op];
+    if (insn->kind == C8_OP_ILLEGAL) {
+        return false;
+    }
+
+    state->exec[insn->kind](state, insn);
+    return true;
+}
+
+/**
+ * Finds `c8_chip8_op_handler()` in the handler chain of a config.
+ *
+ * @return Its index, `op_handlers_size` if it's not in the chain.
+ */
+static uint32_t c8_builtin_handler_index(const c8_machine_config* config) {
+    for (uint32_t i = 0; i < config->op_handlers_size; ++i) {
+        if (config->op_handlers[i] == c8_chip8_op_handler) {
+            return i;
+        }
+    }
+    return config->op_handlers_size;
+}
+
+/**
+ * Checks whether a config needs the extension routing bitmap, the chain
+ * can't be bypassed when a handler comes before `c8_chip8_op_handler()`.
+ */
+static bool c8_needs_ext_claims(const c8_machine_config* config) {
+    return config->op_handlers_size > 0
+        && config->op_handlers[0] != c8_chip8_op_handler;
+}
+
+/**
+ * Builds the extension routing bitmap: every opcode claimed by a handler
+ * placed before `c8_chip8_op_handler()` in `op_handlers` is routed through
+ * the handler chain instead of the dispatch table.
+ *
+ * @param config Machine config.
+ * @param claims Output bitmap of routed opcodes, C8_EXT_CLAIMS_SIZE bytes.
+ */
+static void c8_build_ext_claims(const c8_machine_config* config,
+                                uint8_t* claims) {
+    const uint32_t builtin = c8_builtin_handler_index(config);
+
+    memset(claims, 0, C8_EXT_CLAIMS_SIZE);
+    if (builtin == config->op_handlers_size) {
+        // No built-in handler at all, everything goes through the chain
+        memset(claims, 0xFF, C8_EXT_CLAIMS_SIZE);
+        return;
+    }
+
+    for (uint32_t i = 0; i < builtin; ++i) {
+        const c8_op_claim claim = config->op_handler_claims[i];
+        for (uint32_t op = 0; op <= 0xFFFF; ++op) {
+            if ((op & claim.mask) == claim.value) {
+                claims[op >> 3] |= 1 << (op & 7);
+            }
+        }
+    }
+}
+
+c8_insn c8_decode(const c8_state* state, uint16_t op) {
+    c8_insn insn = c8_decode_table[op];
+
+    const uint8_t* claims = state->ext_claims;
+    if (claims != nullptr && (claims[op >> 3] >> (op & 7)) & 1) {
+        insn.kind = C8_OP_EXT;
+    }
+
+    return insn;
+}
+
+/**
+ * Fills the instruction cache entry at PC and executes it. Cached entries
+ * are never decoded again until memory under them is written.
+ */
+static void c8_exec_undecoded(c8_state* state, const c8_insn* insn) {
+    const uint16_t pc = state->registers.pc;
+    c8_insn decoded = c8_decode(state, c8_fetch(state, pc));
+    if (state->breakpoints != nullptr
+        && (state->breakpoints[pc >> 3] >> (pc & 7)) & 1) {
+        decoded.kind = C8_OP_BREAK;
+    }
+
+    // The last entry decodes a byte of the next page, see `c8_page::insns`.
+    // Shared pages that can't be copied aren't cached either.
+    c8_page* page = pc % C8_PAGE_SIZE != C8_PAGE_SIZE - 1
+        ? c8_page_own_insns(state, state->pages, pc / C8_PAGE_SIZE)
+        : nullptr;
+    if (page == nullptr) {
+        state->exec[decoded.kind](state, &decoded);
+        return;
+    }
+
+    c8_insn* entry = &page->insns[pc % C8_PAGE_SIZE];
+    *entry = decoded;
+    state->exec[entry->kind](state, entry);
+}
+
+#pragma endregion
+
+#pragma region Idle loop detection
+
+/**
+ * Machine state snapshot for idle loop detection.
+ *
+ * Keys and timers never change within a frame, so once the machine gets back
+ * to an earlier state, it will loop through the same states until the frame
+ * ends. Such loops can be skipped over whole without changing the result.
+ *
+ * States are only compared after backward jumps, with Brent's cycle detection
+ * deciding when to take a new snapshot. Memory and display are not copied:
+ * they are equal as long as `side_effects` is.
+ */
+typedef struct c8_idle_probe {
+    c8_registers registers;
+    uint32_t rng;
+    uint16_t vblank;
+    uint32_t side_effects;
+    uint32_t cycles; ///< Cycles left in the frame at the snapshot.
+    uint32_t limit; ///< Backward jumps between snapshots.
+    uint32_t jumps; ///< Backward jumps since the snapshot.
+    bool valid;
+} c8_idle_probe;
+
+static bool c8_registers_equal(const c8_registers* a, const c8_registers* b) {
+    return a->pc == b->pc
+        && a->i == b->i
+        && a->sp == b->sp
+        && a->dt == b->dt
+        && a->st == b->st
+        && memcmp(a->v, b->v, sizeof(a->v)) == 0
+        && memcmp(a->stack, b->stack, sizeof(a->stack)) == 0;
+}
+
+static void c8_idle_probe_snapshot(c8_idle_probe* probe,
+                                   const c8_state* state,
+                                   uint32_t cycles) {
+    probe->registers = state->registers;
+    probe->rng = state->rng.seed;
+    probe->vblank = state->vblank;
+    probe->side_effects = state->side_effects;
+    probe->cycles = cycles;
+    probe->jumps = 0;
+}
+
+/**
+ * Checks whether the machine is in an idle loop. Called after every
+ * backward jump.
+ *
+ * @param probe Loop detector state.
+ * @param state CHIP-8 machine state.
+ * @param cycles Cycles left in the frame.
+ * @return Loop length in cycles, or 0 if no loop was found yet.
+ */
+static uint32_t c8_idle_probe_check(c8_idle_probe* probe,
+                                    const c8_state* state,
+                                    uint32_t cycles) {
+    if (!probe->valid) {
+        c8_idle_probe_snapshot(probe, state, cycles);
+        probe->limit = 1;
+        probe->valid = true;
+        return 0;
+    }
+
+    if (probe->side_effects == state->side_effects
+        && probe->rng == state->rng.seed
+        && probe->vblank == state->vblank
+        && c8_registers_equal(&probe->registers, &state->registers)) {
+        return probe->cycles - cycles;
+    }
+
+    if (++probe->jumps >= probe->limit) {
+        c8_idle_probe_snapshot(probe, state, cycles);
+        probe->limit *= 2;
+    }
+
+    return 0;
+}
+
+#pragma endregion
+
+c8_machine_config c8_get_default_machine_config() {
+    c8_machine_config config = {
+        .op_handlers = {c8_chip8_op_handler, },
+        .op_handlers_size = 1,
+        .quirks = C8_QUIRK_NONE,
+        .memory_size = 4096,
+        .cycles_per_frame = 15,
+        .screen_width = 64,
+        .screen_height = 32,
+        .engine = C8_ENGINE_INTERPRETER
+    };
+    return config;
+}
+
+/**
+ * Sizes of the parts of a state block.
+ */
+typedef struct c8_state_layout {
+    size_t display_rows; ///< Offset of `display_rows`.
+    size_t memory; ///< Offset of `memory`, 0 if allocated on first use.
+    size_t display; ///< Offset of `display`, 0 if allocated on first use.
+    size_t arena; ///< Offset of the page arena, 0 if another one is used.
+    size_t size; ///< Block size, without alignment slack.
+} c8_state_layout;
+
+static size_t c8_align(size_t size) {
+    return (size + C8_STATE_ALIGNMENT - 1) & ~(size_t)(C8_STATE_ALIGNMENT - 1);
+}
+
+static uint16_t c8_page_count(const c8_machine_config* config) {
+    return (config->memory_size + C8_PAGE_SIZE - 1) / C8_PAGE_SIZE;
+}
+
+/**
+ * Gets the size of a page arena with its ext_claims and `pages` pages.
+ */
+static size_t c8_arena_size(const c8_machine_config* config, uint32_t pages) {
+    return c8_align(sizeof(c8_page_arena))
+        + (c8_needs_ext_claims(config) ? c8_align(C8_EXT_CLAIMS_SIZE) : 0)
+        + pages * sizeof(c8_page);
+}
+
+/**
+ * Lays a page arena out in a block of `c8_arena_size()` bytes.
+ *
+ * @return Arena with a single reference and `pages` free pages.
+ */
+static c8_page_arena* c8_init_arena(const c8_machine_config* config,
+                                    uint8_t* block,
+                                    uint32_t pages) {
+    c8_page_arena* arena = (c8_page_arena*)block;
+    block += c8_align(sizeof(c8_page_arena));
+    arena->refs = 1;
+    arena->lock = 0;
+    arena->free_pages = nullptr;
+    arena->chunks = nullptr;
+    arena->chunk_pages = c8_page_count(config);
+    arena->ext_claims = nullptr;
+    if (c8_needs_ext_claims(config)) {
+        arena->ext_claims = block;
+        c8_build_ext_claims(config, arena->ext_claims);
+        block += c8_align(C8_EXT_CLAIMS_SIZE);
+    }
+    c8_arena_add_pages(arena, (c8_page*)block, pages);
+    arena->allocation = nullptr;
+    return arena;
+}
+
+c8_page_arena* c8_page_arena_create(const c8_machine_config* config,
+                                    uint32_t machines) {
+    const uint32_t pages = 2 * c8_page_count(config) * machines;
+    uint8_t* block = malloc(c8_arena_size(config, pages));
+    if (block == nullptr) {
+        return nullptr;
+    }
+
+    c8_init_decode_table();
+    c8_page_arena* arena = c8_init_arena(config, block, pages);
+    arena->allocation = block;
+    return arena;
+}
+
+void c8_page_arena_release(c8_page_arena* arena) {
+    if (arena == nullptr || c8_page_refs_sub(&arena->refs) > 0) {
+        return;
+    }
+
+    for (c8_page_chunk* chunk = arena->chunks; chunk != nullptr;) {
+        c8_page_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena->allocation);
+}
+
+/**
+ * Gets the layout of a state block.
+ *
+ * @param views Whether `memory` and `display` are in the block.
+ * @param arena Whether the block has a page arena, with pages for two page
+ * tables.
+ */
+static c8_state_layout c8_get_state_layout(const c8_machine_config* config,
+                                           bool views,
+                                           bool arena) {
+    const size_t display_words = (config->screen_width + 63) / 64;
+    c8_state_layout layout;
+    layout.display_rows = c8_align(sizeof(c8_state));
+    layout.size = layout.display_rows
+        + c8_align(display_words * config->screen_height * sizeof(uint64_t));
+    layout.memory = 0;
+    layout.display = 0;
+    if (views) {
+        layout.memory = layout.size;
+        layout.display = layout.memory + c8_align(config->memory_size);
+        layout.size = layout.display
+            + c8_align((size_t)config->screen_width * config->screen_height);
+    }
+    layout.arena = 0;
+    if (arena) {
+        layout.arena = layout.size;
+        layout.size += c8_arena_size(config, 2 * c8_page_count(config));
+    }
+    return layout;
+}
+
+/**
+ * Lays a state out in a block. Sets up everything except page tables and
+ * the machine itself: registers, keys and timers.
+ *
+ * @param views Whether to put the memory and display views in the block,
+ * rather than allocate them on first use.
+ * @param arena Arena to take pages from, or NULL to make one in the block.
+ */
+static c8_state* c8_init_block(const c8_machine_config* config,
+                               void* buffer,
+                               bool views,
+                               c8_page_arena* arena) {
+    const c8_state_layout layout =
+        c8_get_state_layout(config, views, arena == nullptr);
+    uint8_t* block = (uint8_t*)c8_align((uintptr_t)buffer);
+
+    c8_state* result = (c8_state*)block;
+    result->config = *config;
+    memcpy(result->exec, C8_EXEC, sizeof(C8_EXEC));
+    c8_specialize_exec(result->exec, config->quirks);
+
+    if (arena == nullptr) {
+        arena = c8_init_arena(config,
+                              block + layout.arena,
+                              2 * c8_page_count(config));
+    }
+    else {
+        c8_page_refs_add(&arena->refs);
+    }
+    result->arena = arena;
+    result->ext_claims = arena->ext_claims;
+
+    result->page_count = c8_page_count(config);
+    result->memory_hash = 0;
+    result->memory = views ? block + layout.memory : nullptr;
+    result->views = nullptr;
+    memset(result->memory_stale, 0xFF, sizeof(result->memory_stale));
+
+    result->display_words = (config->screen_width + 63) / 64;
+    result->display_rows = (uint64_t*)(block + layout.display_rows);
+    result->display = views ? block + layout.display : nullptr;
+    result->display_view_stale = true;
+    result->display_hash = 0;
+    result->side_effects = 0;
+    result->code_writes = 0;
+    result->events = 0;
+    result->halt_on_fault = false;
+    result->hashing = false;
+    result->breakpoints = nullptr;
+    result->breakpoint_count = 0;
+    result->break_armed = false;
+    result->watch_read = nullptr;
+    result->watch_write = nullptr;
+    result->watch_count = 0;
+    result->watch_hit = 0;
+    memcpy(result->exec_unwatched, result->exec, sizeof(result->exec));
+    c8_clear_display_dirty(result);
+    result->jit = nullptr;
+#ifdef C8_ENABLE_PROFILER
+    result->profiler = nullptr;
+#endif
+    result->allocation = nullptr;
+    return result;
+}
+
+/**
+ * Gives a new machine its pristine image and resets it.
+ *
+ * @return The machine, or NULL if out of memory, the machine is destroyed
+ * then.
+ */
+static c8_state* c8_init_machine(c8_state* result) {
+    for (uint16_t p = 0; p < result->page_count; ++p) {
+        result->pristine[p] = nullptr;
+        result->pages[p] = nullptr;
+    }
+
+    // Blank pristine image, the reset below maps memory to it
+    for (uint16_t p = 0; p < result->page_count; ++p) {
+        c8_page* page = c8_page_alloc(result);
+        if (page == nullptr) {
+            c8_destroy(result);
+            return nullptr;
+        }
+        memset(page->insns, 0, sizeof(page->insns));
+        memset(page->bytes, 0, sizeof(page->bytes));
+        page->hash = 0;
+        page->hashed = true;
+        result->pristine[p] = page;
+    }
+    c8_write_pages(result,
+                   result->pristine,
+                   C8_PC_ON_FAULT,
+                   C8_FAULT_HANDLER,
+                   sizeof(C8_FAULT_HANDLER));
+    c8_write_pages(result,
+                   result->pristine,
+                   C8_MEM_FONT_OFFSET,
+                   C8_FONT,
+                   sizeof(C8_FONT));
+    result->pristine_end = 0x200;
+
+    c8_reset(result);
+
+    if (result->config.engine == C8_ENGINE_JIT) {
+        result->jit = c8_jit_create(result);
+    }
+
+    return result;
+}
+
+size_t c8_state_size(c8_machine_config config) {
+    // Slack to align an arbitrary buffer
+    return c8_get_state_layout(&config, true, true).size
+        + C8_STATE_ALIGNMENT - 1;
+}
+
+size_t c8_fork_size(c8_machine_config config) {
+    return c8_get_state_layout(&config, false, false).size
+        + C8_STATE_ALIGNMENT - 1;
+}
+
+size_t c8_pooled_state_size(const c8_machine_config* config) {
+    return c8_get_state_layout(config, true, false).size
+        + C8_STATE_ALIGNMENT - 1;
+}
+
+c8_state* c8_create_in(c8_machine_config config, void* buffer, size_t size) {
+    if (buffer == nullptr || size < c8_state_size(config)) {
+        return nullptr;
+    }
+
+    c8_init_decode_table();
+    c8_hash_init();
+
+    // The pages of the block last for every page table entry
+    return c8_init_machine(c8_init_block(&config, buffer, true, nullptr));
+}
+
+c8_state* c8_create_pooled(const c8_machine_config* config,
+                           c8_page_arena* arena,
+                           void* buffer) {
+    c8_init_decode_table();
+    c8_hash_init();
+
+    return c8_init_machine(c8_init_block(config, buffer, true, arena));
+}
+
+c8_state* c8_create(c8_machine_config config) {
+    const size_t size = c8_state_size(config);
+    void* block = malloc(size);
+    c8_state* result = c8_create_in(config, block, size);
+    if (result == nullptr) {
+        free(block);
+        return nullptr;
+    }
+
+    // Forks may use the pages of the block after the machine is gone, the
+    // arena frees it with the last of them
+    result->arena->allocation = block;
+    return result;
+}
+
+/**
+ * Forks a machine into a block laid out by `c8_init_block()`. The pages
+ * of both page tables get shared, copied on the first write by either
+ * machine.
+ */
+static c8_state* c8_fork_into(c8_state* state, void* buffer, bool views) {
+    c8_state* result =
+        c8_init_block(&state->config, buffer, views, state->arena);
+
+    // Pages forked already may be in use on other threads, and are only read
+    for (uint16_t p = 0; p < state->page_count; ++p) {
+        c8_page* const pages[] = { state->pages[p], state->pristine[p] };
+        for (uint32_t t = 0; t < 2; ++t) {
+            if (!pages[t]->forked) {
+                pages[t]->forked = true;
+            }
+        }
+        result->pages[p] = c8_page_retain(state->pages[p]);
+        result->pristine[p] = c8_page_retain(state->pristine[p]);
+    }
+    result->pristine_end = state->pristine_end;
+    result->memory_hash = state->memory_hash;
+
+    // A page or a few, copying is cheaper than sharing
+    const size_t display_rows_size =
+        state->display_words * state->config.screen_height;
+    memcpy(result->display_rows,
+           state->display_rows,
+           display_rows_size * sizeof(uint64_t));
+    result->display_hash = state->display_hash;
+    memcpy(result->dirty_rows, state->dirty_rows, sizeof(state->dirty_rows));
+    result->dirty_x_min = state->dirty_x_min;
+    result->dirty_x_max = state->dirty_x_max;
+
+    result->registers = state->registers;
+    memcpy(result->pressed_keys, state->pressed_keys, C8_KEY_MAX);
+    result->rng = state->rng;
+    result->waiting_for_key = state->waiting_for_key;
+    result->key_wait_key = state->key_wait_key;
+    result->fault = state->fault;
+    result->fault_addr = state->fault_addr;
+    result->halt_on_fault = state->halt_on_fault;
+    result->hashing = state->hashing;
+    result->halted = state->halted;
+    result->delta_time = state->delta_time;
+    result->vblank = state->vblank;
+    return result;
+}
+
+c8_state* c8_fork_in(c8_state* state, void* buffer, size_t size) {
+    if (state == nullptr
+        || buffer == nullptr
+        || size < c8_fork_size(state->config)) {
+        return nullptr;
+    }
+
+    return c8_fork_into(state, buffer, false);
+}
+
+c8_state* c8_fork_pooled(c8_state* state, void* buffer) {
+    return c8_fork_into(state, buffer, true);
+}
+
+c8_state* c8_fork(c8_state* state) {
+    if (state == nullptr) {
+        return nullptr;
+    }
+
+    const size_t size = c8_fork_size(state->config);
+    void* block = malloc(size);
+    c8_state* result = c8_fork_in(state, block, size);
+    if (result == nullptr) {
+        free(block);
+        return nullptr;
+    }
+
+    result->allocation = block;
+    return result;
+}
+
+void c8_destroy(c8_state* state) {
+    if (state == nullptr) {
+        return;
+    }
+
+#ifdef C8_ENABLE_PROFILER
+    c8_profile_enable(state, false);
+#endif
+    c8_jit_destroy(state->jit);
+    free(state->breakpoints);
+    free(state->watch_read);
+    free(state->watch_write);
+    free(state->views);
+    for (uint16_t p = 0; p < state->page_count; ++p) {
+        c8_page_release(state, state->pages[p]);
+        c8_page_release(state, state->pristine[p]);
+    }
+
+    // The arena may be in the block of this very machine
+    void* allocation = state->allocation;
+    c8_page_arena_release(state->arena);
+    free(allocation);
+}
+
+void c8_set_rng_seed(c8_state* state, uint32_t seed) {
+    if (state == nullptr) {
+        return;
+    }
+
+    state->rng.seed = seed;
+}
+
+uint32_t c8_get_rng_seed(c8_state* state) {
+    if (state == nullptr) {
+        return 0;
+    }
+
+    return state->rng.seed;
+}
+
+void c8_load_rom(c8_state* state, const uint8_t* rom, uint16_t size) {
+    if (state == nullptr || rom == nullptr) {
+        return;
+    }
+
+    const uint32_t end =
+        0x200 + C8_MIN(size, state->config.memory_size - 0x200);
+    for (uint32_t addr = 0x200; addr < end;) {
+        const uint16_t index = addr / C8_PAGE_SIZE;
+        const uint32_t count =
+            C8_MIN(end - addr, C8_PAGE_SIZE - addr % C8_PAGE_SIZE);
+        const uint8_t* data = rom + (addr - 0x200);
+
+        // Memory that matched the pristine image keeps sharing its pages
+        const bool shared = state->pages[index] == state->pristine[index];
+        c8_write_pages(state, state->pristine, addr, data, count);
+        if (shared) {
+            c8_map_page(state, index, state->pristine[index]);
+        }
+        else {
+            c8_write_memory(state, addr, data, count);
+        }
+        addr += count;
+    }
+    state->pristine_end = C8_MAX(state->pristine_end, end);
+    state->waiting_for_key = false;
+    ++state->side_effects;
+    ++state->code_writes;
+}
+
+const c8_machine_config* c8_get_machine_config(c8_state* state) {
+    if (state == nullptr) {
+        return nullptr;
     }
 
     return &state->config;
@@ -854,22 +2111,124 @@ void c8_set_registers(c8_state* state, const c8_registers* regs) {
     }
 
     state->registers = *regs;
+    state->waiting_for_key = false;
+    state->key_wait_key = C8_KEY_MAX;
 }
 
-const uint8_t* c8_get_display(const c8_state* state, uint32_t* display_size) {
-    if (state == nullptr || display_size == nullptr) {
+/**
+ * Allocates the memory and display views of a fork on first use.
+ *
+ * @return false if out of memory.
+ */
+static bool c8_alloc_views(c8_state* state) {
+    if (state->memory != nullptr) {
+        return true;
+    }
+
+    const size_t memory_size = state->config.memory_size;
+    state->views = malloc(memory_size
+        + (size_t)state->config.screen_width * state->config.screen_height);
+    if (state->views == nullptr) {
+        return false;
+    }
+    state->memory = state->views;
+    state->display = state->memory + memory_size;
+    return true;
+}
+
+const uint8_t* c8_get_display(c8_state* state, uint32_t* display_size) {
+    if (state == nullptr || display_size == nullptr
+        || !c8_alloc_views(state)) {
         return nullptr;
     }
 
-    *display_size = state->config.screen_width * state->config.screen_height;
+    const uint8_t screen_width = state->config.screen_width;
+    const uint8_t screen_height = state->config.screen_height;
+
+    if (state->display_view_stale) {
+        for (uint8_t y = 0; y < screen_height; ++y) {
+            const uint64_t* row = &state->display_rows[y * state->display_words];
+            uint8_t* out = &state->display[y * screen_width];
+            for (uint8_t x = 0; x < screen_width; ++x) {
+                out[x] = (row[x >> 6] >> (63 - (x & 63))) & 1;
+            }
+        }
+        state->display_view_stale = false;
+    }
+
+    *display_size = screen_width * screen_height;
     return state->display;
 }
 
-const uint8_t* c8_get_memory(c8_state* state) {
+const uint64_t* c8_get_display_rows(const c8_state* state,
+                                    uint32_t* words_per_row) {
+    if (state == nullptr || words_per_row == nullptr) {
+        return nullptr;
+    }
+
+    *words_per_row = state->display_words;
+    return state->display_rows;
+}
+
+bool c8_get_display_dirty(const c8_state* state, c8_display_dirty* dirty) {
+    if (state == nullptr || dirty == nullptr) {
+        return false;
+    }
+
+    memcpy(dirty->rows, state->dirty_rows, sizeof(dirty->rows));
+    dirty->x = 0;
+    dirty->y = 0;
+    dirty->width = 0;
+    dirty->height = 0;
+
+    int16_t y_min = -1;
+    int16_t y_max = -1;
+    for (uint16_t y = 0; y < state->config.screen_height; ++y) {
+        if ((state->dirty_rows[y >> 6] >> (y & 63)) & 1) {
+            if (y_min < 0) {
+                y_min = (int16_t)y;
+            }
+            y_max = (int16_t)y;
+        }
+    }
+
+    if (y_min < 0) {
+        return false;
+    }
+
+    dirty->x = state->dirty_x_min;
+    dirty->y = y_min;
+    dirty->width = state->dirty_x_max - state->dirty_x_min + 1;
+    dirty->height = y_max - y_min + 1;
+    return true;
+}
+
+void c8_clear_display_dirty(c8_state* state) {
     if (state == nullptr) {
+        return;
+    }
+
+    memset(state->dirty_rows, 0, sizeof(state->dirty_rows));
+    state->dirty_x_min = UINT8_MAX;
+    state->dirty_x_max = 0;
+}
+
+const uint8_t* c8_get_memory(c8_state* state) {
+    if (state == nullptr || !c8_alloc_views(state)) {
         return nullptr;
     }
 
+    const uint16_t memory_size = state->config.memory_size;
+    for (uint16_t p = 0; p < state->page_count; ++p) {
+        if ((state->memory_stale[p >> 6] >> (p & 63)) & 1) {
+            const uint32_t addr = p * C8_PAGE_SIZE;
+            memcpy(state->memory + addr,
+                   state->pages[p]->bytes,
+                   C8_MIN(C8_PAGE_SIZE, memory_size - addr));
+        }
+    }
+    memset(state->memory_stale, 0, sizeof(state->memory_stale));
+
     return state->memory;
 }
 
@@ -878,32 +2237,49 @@ void c8_reset(c8_state* state) {
         return;
     }
 
-    if (state->memory == nullptr) {
-        state->memory = calloc(state->config.memory_size, 1);
-    }
-    else {
-        memset(state->memory, 0, state->config.memory_size);
+    // Forget the loaded ROMs, memory gets the blank pages below. Past the
+    // end of the ROMs the pages are zero already, clearing whole pages
+    // saves copying them.
+    if (state->pristine_end > 0x200) {
+        const uint32_t end =
+            (state->pristine_end + C8_PAGE_SIZE - 1) & ~(C8_PAGE_SIZE - 1);
+        c8_write_pages(state, state->pristine, 0x200, nullptr, end - 0x200);
+        state->pristine_end = 0x200;
     }
 
-    memcpy(state->memory + C8_PC_ON_FAULT,
-           C8_FAULT_HANDLER,
-           sizeof(C8_FAULT_HANDLER));
-    memcpy(state->memory + C8_MEM_FONT_OFFSET, C8_FONT, 80);
+    c8_reset_to_pristine(state);
+}
 
-    if (state->display == nullptr) {
-        state->display = calloc(
-            state->config.screen_width * state->config.screen_height,
-            1
-        );
+void c8_reset_to_pristine(c8_state* state) {
+    if (state == nullptr) {
+        return;
     }
-    else {
-        memset(state->display,
-               0,
-               state->config.screen_width * state->config.screen_height);
+
+    // Pages written since the last reset are the ones not shared anymore
+    for (uint16_t p = 0; p < state->page_count; ++p) {
+        if (state->pages[p] != state->pristine[p]) {
+            c8_map_page(state, p, state->pristine[p]);
+        }
+    }
+
+    const size_t display_rows_size =
+        state->display_words * state->config.screen_height;
+    memset(state->display_rows, 0, display_rows_size * sizeof(uint64_t));
+    state->display_hash = 0;
+    state->display_view_stale = true;
+    for (uint8_t y = 0; y < state->config.screen_height; ++y) {
+        c8_display_mark_dirty(state, y, 0, state->config.screen_width - 1);
     }
+    ++state->side_effects;
 
     state->delta_time = 0.f;
+    state->vblank = 1;
     memset(state->pressed_keys, 0, C8_KEY_MAX);
+    state->waiting_for_key = false;
+    state->key_wait_key = C8_KEY_MAX;
+    state->fault = C8_FAULT_NONE;
+    state->fault_addr = 0;
+    state->halted = false;
     state->registers = (c8_registers){
         .stack = { 0, },
         .v = { 0, },
@@ -934,26 +2310,41 @@ void c8_update_timers(c8_state* state, float delta_time) {
     state->vblank = ticks_elapsed;
 }
 
+/**
+ * Executes the instruction at PC, the machine must be able to run.
+ */
+static inline void c8_exec_next(c8_state* state) {
+    const uint16_t pc = state->registers.pc;
+    const c8_insn* insn = c8_cached_insn(state, pc);
+    const uint8_t kind = insn->kind;
+    state->exec[kind](state, insn);
+
+#ifdef C8_ENABLE_PROFILER
+    if (state->profiler != nullptr) {
+        c8_profile_count(state, pc, kind);
+    }
+#endif
+
+    if (state->registers.pc >= state->config.memory_size) {
+        c8_raise_fault(state, C8_FAULT_PC_OUT_OF_BOUNDS, pc);
+    }
+}
+
 void c8_step(c8_state* state) {
     if (state == nullptr) {
         return;
     }
 
-    uint16_t op = state->memory[state->registers.pc] << 8
-        | state->memory[state->registers.pc + 1];
-
-    bool opHandled = false;
-    for (int i = 0; i < state->config.op_handlers_size; ++i) {
-        c8_op_handler h = state->config.op_handlers[i];
-        opHandled = h(state, op);
-        if (opHandled) {
-            break;
+    if (state->waiting_for_key | state->halted) {
+#ifdef C8_ENABLE_PROFILER
+        if (state->profiler != nullptr && state->waiting_for_key) {
+            c8_profile_count_key_wait(state, 1);
         }
+#endif
+        return;
     }
 
-    if (state->registers.pc >= state->config.memory_size) {
-        state->registers.pc = C8_PC_ON_FAULT;
-    }
+    c8_exec_next(state);
 }
 
 void c8_step_frame(c8_state* state) {
@@ -961,9 +2352,251 @@ void c8_step_frame(c8_state* state) {
         return;
     }
 
-    for (uint16_t i = 0; i < state->config.cycles_per_frame; ++i) {
-        c8_step(state);
+    c8_run(state, state->config.cycles_per_frame, C8_STOP_BUDGET);
+}
+
+/**
+ * Picks the reported stop reason out of raised events.
+ */
+static uint32_t c8_stop_reason_of(uint32_t events) {
+    static const uint32_t PRIORITY[] = {
+        C8_STOP_FAULT,
+        C8_STOP_WATCH_WRITE,
+        C8_STOP_WATCH_READ,
+        C8_STOP_DISPLAY,
+        C8_STOP_SOUND,
+    };
+    for (uint32_t i = 0; i < sizeof(PRIORITY) / sizeof(PRIORITY[0]); ++i) {
+        if ((events & PRIORITY[i]) != 0) {
+            return PRIORITY[i];
+        }
     }
+    return C8_STOP_BUDGET;
+}
+
+c8_run_result c8_run(c8_state* state, uint32_t max_cycles, uint32_t stop_mask) {
+    c8_run_result result = {
+        .cycles = 0,
+        .reason = C8_STOP_BUDGET,
+        .addr = 0,
+    };
+    if (state == nullptr) {
+        return result;
+    }
+
+    const bool check_breakpoints = (stop_mask & C8_STOP_BREAKPOINT) != 0
+        && state->breakpoint_count > 0;
+    const bool check_watches =
+        (stop_mask & (C8_STOP_WATCH_READ | C8_STOP_WATCH_WRITE)) != 0
+            && state->watch_count > 0;
+#ifdef C8_ENABLE_PROFILER
+    // Every instruction has to be seen, even in skippable idle loops
+    const bool profiling = state->profiler != nullptr;
+#else
+    const bool profiling = false;
+#endif
+    // Translated blocks can't stop in the middle
+    const bool use_jit = state->jit != nullptr && !check_breakpoints
+        && !check_watches && !profiling;
+
+    c8_idle_probe probe = { .valid = false };
+    state->events = 0;
+    if (state->halt_on_fault) {
+        stop_mask |= C8_STOP_FAULT;
+    }
+    if (state->halted) {
+        result.reason = C8_STOP_FAULT;
+        return result;
+    }
+
+    uint32_t cycles = max_cycles;
+    while (cycles > 0) {
+        if (state->waiting_for_key) {
+#ifdef C8_ENABLE_PROFILER
+            if (profiling) {
+                c8_profile_count_key_wait(state, cycles);
+            }
+#endif
+            result.reason = C8_STOP_KEY_WAIT;
+            break;
+        }
+
+        const uint16_t pc = state->registers.pc;
+
+        uint32_t executed = 0;
+        if (use_jit) {
+            executed = c8_jit_run(state, cycles);
+        }
+        if (executed == 0) {
+            // Key waits and halts end the loop, see above and below
+            c8_exec_next(state);
+            executed = 1;
+        }
+
+        if ((state->events & C8_STOP_BREAKPOINT) != 0) {
+            // Nothing was executed
+            result.reason = C8_STOP_BREAKPOINT;
+            result.addr = pc;
+            break;
+        }
+
+        cycles -= executed;
+        // The first instruction is never stopped at, so resuming works
+        state->break_armed = check_breakpoints;
+
+        if ((state->events & stop_mask) != 0) {
+            result.reason = c8_stop_reason_of(state->events & stop_mask);
+            if (result.reason == C8_STOP_WATCH_READ
+                || result.reason == C8_STOP_WATCH_WRITE) {
+                result.addr = state->watch_hit;
+            }
+            break;
+        }
+
+        if (state->registers.pc <= pc && cycles > 0 && !profiling) {
+            const uint32_t period = c8_idle_probe_check(&probe, state, cycles);
+            if (period > 0) {
+                cycles %= period;
+            }
+        }
+    }
+
+    state->break_armed = false;
+    result.cycles = max_cycles - cycles;
+    return result;
+}
+
+bool c8_set_breakpoint(c8_state* state, uint16_t addr, bool enabled) {
+    if (state == nullptr || addr >= state->config.memory_size) {
+        return false;
+    }
+
+    if (state->breakpoints == nullptr) {
+        if (!enabled) {
+            return true;
+        }
+        state->breakpoints = calloc(state->config.memory_size / 8 + 1, 1);
+    }
+
+    uint8_t* cell = &state->breakpoints[addr >> 3];
+    const uint8_t bit = 1 << (addr & 7);
+    if (((*cell & bit) != 0) == enabled) {
+        return true;
+    }
+
+    // Decoded again as C8_OP_BREAK or as the instruction itself, in the
+    // pristine image too, so it's still there after a reset
+    if (addr % C8_PAGE_SIZE != C8_PAGE_SIZE - 1) {
+        const uint16_t index = addr / C8_PAGE_SIZE;
+        c8_page* const pages[] = {
+            c8_page_own_insns(state, state->pages, index),
+            c8_page_own_insns(state, state->pristine, index),
+        };
+        if (pages[0] == nullptr || pages[1] == nullptr) {
+            return false;
+        }
+        for (uint32_t k = 0; k < 2; ++k) {
+            memset(&pages[k]->insns[addr % C8_PAGE_SIZE], 0, sizeof(c8_insn));
+        }
+    }
+
+    if (enabled) {
+        *cell |= bit;
+        ++state->breakpoint_count;
+    }
+    else {
+        *cell &= ~bit;
+        --state->breakpoint_count;
+    }
+    if (state->jit != nullptr) {
+        c8_jit_invalidate(state->jit, addr, 1);
+    }
+
+    return true;
+}
+
+bool c8_set_watchpoint(c8_state* state,
+                       uint16_t addr,
+                       uint32_t access,
+                       bool enabled) {
+    if (state == nullptr || addr >= state->config.memory_size) {
+        return false;
+    }
+
+    uint8_t** bitmaps[] = { &state->watch_read, &state->watch_write };
+    const uint32_t kinds[] = { C8_WATCH_READ, C8_WATCH_WRITE };
+    const uint32_t old_count = state->watch_count;
+
+    for (uint32_t k = 0; k < 2; ++k) {
+        if ((access & kinds[k]) == 0) {
+            continue;
+        }
+
+        uint8_t** bitmap = bitmaps[k];
+        if (*bitmap == nullptr) {
+            if (!enabled) {
+                continue;
+            }
+            *bitmap = calloc(state->config.memory_size / 8 + 1, 1);
+        }
+
+        uint8_t* cell = &(*bitmap)[addr >> 3];
+        const uint8_t bit = 1 << (addr & 7);
+        if (enabled && (*cell & bit) == 0) {
+            *cell |= bit;
+            ++state->watch_count;
+        }
+        else if (!enabled && (*cell & bit) != 0) {
+            *cell &= ~bit;
+            --state->watch_count;
+        }
+    }
+
+    // Swap memory accessing handlers only while there is something to watch
+    if ((old_count == 0) != (state->watch_count == 0)) {
+        const uint32_t kinds_size =
+            sizeof(C8_WATCHED_KINDS) / sizeof(C8_WATCHED_KINDS[0]);
+        for (uint32_t k = 0; k < kinds_size; ++k) {
+            const uint8_t kind = C8_WATCHED_KINDS[k];
+            state->exec[kind] = state->watch_count > 0
+                ? c8_exec_watched
+                : state->exec_unwatched[kind];
+        }
+
+        // Translated code calls handlers directly
+        if (state->jit != nullptr) {
+            c8_jit_flush(state->jit);
+        }
+    }
+
+    return true;
+}
+
+uint32_t c8_get_watchpoint(const c8_state* state, uint16_t addr) {
+    if (state == nullptr || addr >= state->config.memory_size) {
+        return 0;
+    }
+
+    uint32_t access = 0;
+    if (state->watch_read != nullptr
+        && (state->watch_read[addr >> 3] >> (addr & 7)) & 1) {
+        access |= C8_WATCH_READ;
+    }
+    if (state->watch_write != nullptr
+        && (state->watch_write[addr >> 3] >> (addr & 7)) & 1) {
+        access |= C8_WATCH_WRITE;
+    }
+    return access;
+}
+
+bool c8_has_breakpoint(const c8_state* state, uint16_t addr) {
+    if (state == nullptr
+        || state->breakpoints == nullptr
+        || addr >= state->config.memory_size) {
+        return false;
+    }
+
+    return (state->breakpoints[addr >> 3] >> (addr & 7)) & 1;
 }
 
 void c8_press_key(c8_state* state, c8_key key) {
@@ -971,7 +2604,10 @@ void c8_press_key(c8_state* state, c8_key key) {
         return;
     }
 
-    state->pressed_keys[key] = true;
+    if (!state->pressed_keys[key]) {
+        state->pressed_keys[key] = true;
+        state->waiting_for_key = false;
+    }
 }
 
 void c8_release_key(c8_state* state, c8_key key) {
@@ -979,5 +2615,76 @@ void c8_release_key(c8_state* state, c8_key key) {
         return;
     }
 
-    state->pressed_keys[key] = false;
+    if (state->pressed_keys[key]) {
+        state->pressed_keys[key] = false;
+        state->waiting_for_key = false;
+    }
+}
+
+bool c8_is_waiting_for_key(const c8_state* state) {
+    if (state == nullptr) {
+        return false;
+    }
+
+    return state->waiting_for_key;
+}
+
+uint32_t c8_get_fault(const c8_state* state, uint16_t* addr) {
+    if (state == nullptr) {
+        return C8_FAULT_NONE;
+    }
+
+    if (addr != nullptr) {
+        *addr = state->fault_addr;
+    }
+    return state->fault;
+}
+
+void c8_clear_fault(c8_state* state) {
+    if (state == nullptr) {
+        return;
+    }
+
+    state->fault = C8_FAULT_NONE;
+    state->fault_addr = 0;
+    state->halted = false;
+}
+
+void c8_set_halt_on_fault(c8_state* state, bool enabled) {
+    if (state == nullptr) {
+        return;
+    }
+
+    state->halt_on_fault = enabled;
+}
+
+void c8_set_state_hashing(c8_state* state, bool enabled) {
+    if (state == nullptr || state->hashing == enabled) {
+        return;
+    }
+
+    state->hashing = enabled;
+    if (!enabled) {
+        return;
+    }
+
+    // Writes left the sums outdated, start over
+    state->memory_hash = 0;
+    for (uint16_t p = 0; p < state->page_count; ++p) {
+        state->memory_hash += c8_page_hash(state->pages[p], p);
+    }
+    state->display_hash = 0;
+    const uint32_t words = state->display_words * state->config.screen_height;
+    for (uint32_t i = 0; i < words; ++i) {
+        state->display_hash +=
+            c8_hash_display_keys[i] * state->display_rows[i];
+    }
+}
+
+bool c8_is_halted(const c8_state* state) {
+    if (state == nullptr) {
+        return false;
+    }
+
+    return state->halted;
 }
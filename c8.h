@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include "c23_compat.h"
 
@@ -153,30 +154,196 @@ typedef enum c8_quirk
      * `vF` unchanged (unless `vF` is the parameter `X`.)
      */
     C8_QUIRK_VF_RESET = 1 << 6,
+
+    /**
+     * Key release quirk
+     *
+     * The original Cosmac VIP interpreter would only finish `FX0A` once the
+     * pressed key was released again.
+     *
+     * Set: Opcode `FX0A` waits for a key to be pressed and released, then
+     * stores it in `vX`.
+     *
+     * Unset: Opcode `FX0A` stores the first pressed key in `vX` immediately.
+     */
+    C8_QUIRK_KEY_RELEASE = 1 << 7,
 } c8_quirk;
 
+/**
+ * CHIP-8 execution engines.
+ */
+typedef enum c8_engine
+#ifndef C23_COMPAT_NO_ENUM_TYPES
+    : uint8_t
+#endif
+{
+    /**
+     * Portable interpreter.
+     */
+    C8_ENGINE_INTERPRETER = 0,
+
+    /**
+     * Basic-block JIT compiler.
+     *
+     * `c8_step_frame()` translates straight-line runs of instructions into
+     * native code and runs them as a whole. Only x86-64 hosts with the
+     * System V ABI are supported, other hosts use the interpreter.
+     */
+    C8_ENGINE_JIT,
+} c8_engine;
+
+/**
+ * Reasons for `c8_run()` to stop. Also used as a stop condition mask.
+ */
+typedef enum c8_stop_reason
+#ifndef C23_COMPAT_NO_ENUM_TYPES
+    : uint32_t
+#endif
+{
+    /**
+     * Cycle budget is exhausted. Always enabled.
+     */
+    C8_STOP_BUDGET = 0,
+
+    /**
+     * PC has reached a breakpoint.
+     * @see c8_set_breakpoint()
+     */
+    C8_STOP_BREAKPOINT = 1 << 0,
+
+    /**
+     * `DXYN` or `00E0` has changed the display.
+     */
+    C8_STOP_DISPLAY = 1 << 1,
+
+    /**
+     * `FX18` has started the sound timer.
+     */
+    C8_STOP_SOUND = 1 << 2,
+
+    /**
+     * `FX0A` is waiting for a key. Always enabled, since the machine can't
+     * run until a key state changes.
+     */
+    C8_STOP_KEY_WAIT = 1 << 3,
+
+    /**
+     * An instruction has faulted, see `c8_fault`. Always enabled while
+     * halting on faults, since a halted machine can't run.
+     * @see c8_set_halt_on_fault()
+     */
+    C8_STOP_FAULT = 1 << 4,
+
+    /**
+     * An instruction has read watched memory.
+     * @see c8_set_watchpoint()
+     */
+    C8_STOP_WATCH_READ = 1 << 5,
+
+    /**
+     * An instruction has written watched memory.
+     * @see c8_set_watchpoint()
+     */
+    C8_STOP_WATCH_WRITE = 1 << 6,
+} c8_stop_reason;
+
+/**
+ * Fault codes. Stack faults and PC out of bounds leave the instruction
+ * without effect, and execution continues at the fault handler, an endless
+ * loop at address 0. An illegal opcode leaves PC on itself, and accesses
+ * past the end of memory are clipped, as if they didn't fault. So are
+ * writes to shared pages of forks the host has no memory to copy. A machine
+ * that halts on faults stops right after any of them.
+ */
+typedef enum c8_fault
+#ifndef C23_COMPAT_NO_ENUM_TYPES
+    : uint32_t
+#endif
+{
+    C8_FAULT_NONE = 0, ///< Nothing has faulted.
+    C8_FAULT_STACK_OVERFLOW, ///< `2NNN` with 16 addresses on the stack.
+    C8_FAULT_STACK_UNDERFLOW, ///< `00EE` with an empty stack.
+    C8_FAULT_ILLEGAL_OPCODE, ///< No instruction or op handler took the opcode.
+    C8_FAULT_PC_OUT_OF_BOUNDS, ///< PC has moved past the end of memory.
+    C8_FAULT_MEMORY_OUT_OF_BOUNDS, ///< Memory at I runs past its end.
+    C8_FAULT_OUT_OF_MEMORY, ///< No host memory to copy a shared page.
+} c8_fault;
+
+/**
+ * Memory access kinds for watchpoints.
+ */
+typedef enum c8_watch
+#ifndef C23_COMPAT_NO_ENUM_TYPES
+    : uint32_t
+#endif
+{
+    C8_WATCH_READ = 1 << 0, ///< `DXYN` and `FX65` reads.
+    C8_WATCH_WRITE = 1 << 1, ///< `FX33` and `FX55` writes.
+} c8_watch;
+
+/**
+ * Result of a `c8_run()` call.
+ */
+typedef struct c8_run_result {
+    uint32_t cycles; ///< Cycles executed.
+    uint32_t reason; ///< Why the run has stopped, see `c8_stop_reason`.
+    uint16_t addr; ///< Breakpoint or watched address that was hit.
+} c8_run_result;
+
 /**
  * CHIP-8 machine state.
  */
 typedef struct c8_state c8_state;
 
+/**
+ * Display area changed since the dirty state was last cleared.
+ *
+ * The bounding box covers every changed pixel, but may also cover
+ * unchanged ones.
+ */
+typedef struct c8_display_dirty {
+    uint64_t rows[4]; ///< Bit `Y % 64` of word `Y / 64` is set if row Y changed.
+    uint16_t x; ///< Bounding box left column.
+    uint16_t y; ///< Bounding box top row.
+    uint16_t width; ///< Bounding box width, 0 if nothing changed.
+    uint16_t height; ///< Bounding box height, 0 if nothing changed.
+} c8_display_dirty;
+
 /**
  * A function pointer type for CHIP-8 operation handler.
  * Returns true if matched.
  */
 typedef bool (* c8_op_handler)(c8_state* state, uint16_t op);
 
+/**
+ * An opcode range claimed by an operation handler.
+ *
+ * An opcode `op` is claimed when `(op & mask) == value`. A zeroed claim
+ * claims every opcode.
+ */
+typedef struct c8_op_claim {
+    uint16_t mask; ///< Opcode bits to compare.
+    uint16_t value; ///< Expected value of masked opcode bits.
+} c8_op_claim;
+
 /**
  * CHIP-8 machine configuration struct.
+ *
+ * Opcodes are dispatched through a decode table built on machine creation.
+ * Handlers placed in `op_handlers` before the default CHIP-8 handler are
+ * called for opcodes in their `op_handler_claims` ranges; handlers placed
+ * after it are called for opcodes the default handler does not match.
  */
 typedef struct c8_machine_config {
     c8_op_handler op_handlers[8]; ///< Opcode handlers.
+    c8_op_claim op_handler_claims[8]; ///< Opcode ranges of `op_handlers`.
     uint32_t op_handlers_size; ///< A size of `op_handlers` array.
     uint32_t quirks; ///< A bitset of CHIP-8 quirks.
     uint16_t memory_size; ///< CHIP-8 machine's memory size, in bytes.
     uint16_t cycles_per_frame; ///< A number of cycles per frame.
     uint8_t screen_width; ///< Screen width, in logical pixels.
     uint8_t screen_height; ///< Screen height, in logical pixels.
+    uint8_t engine; ///< Execution engine, see `c8_engine`.
 } c8_machine_config;
 
 /**
@@ -208,7 +375,71 @@ typedef struct c8_registers {
 c8_state* c8_create(c8_machine_config config);
 
 /**
- * Destroys a CHIP-8 machine instance.
+ * Gets the storage size `c8_create_in()` needs for a machine: the state,
+ * memory pages, memory and display in one cache aligned block.
+ *
+ * @param config CHIP-8 machine configuration.
+ * @return Size in bytes, alignment slack included.
+ */
+size_t c8_state_size(c8_machine_config config);
+
+/**
+ * Creates a new CHIP-8 machine instance in caller-provided storage, without
+ * allocating. Only the JIT engine allocates, for its block cache, and so do
+ * breakpoints, watchpoints and the profiler once used, and forks writing to
+ * shared pages once the pages of the storage run out. The storage must
+ * outlive the machine and its forks, which take their pages from it.
+ * `c8_destroy()` still has to be called to free the rest.
+ *
+ * @param config CHIP-8 machine configuration.
+ * @param buffer Storage, any alignment.
+ * @param size Storage size, at least `c8_state_size()`.
+ * @return CHIP-8 machine state, or NULL if the storage is too small.
+ */
+c8_state* c8_create_in(c8_machine_config config, void* buffer, size_t size);
+
+/**
+ * Creates a copy of a machine, for branching in tree search.
+ *
+ * Memory is shared in 256 byte pages, copied on the first write by either
+ * machine, so a fork costs about its registers, a page table and the packed
+ * display, see `c8_fork_size()`. Copies come from a free list shared by
+ * the machine and all its forks, which grows in chunks and goes back to the
+ * heap once the last of them is destroyed. The memory and display views of
+ * a fork are allocated on first use.
+ * Breakpoints, watchpoints, the JIT and the profiler aren't copied, forks
+ * run in the interpreter. The machine and its forks may be run, forked and
+ * destroyed on different threads, and in any order.
+ *
+ * @param state CHIP-8 machine state.
+ * @return The fork, or NULL if out of memory.
+ */
+c8_state* c8_fork(c8_state* state);
+
+/**
+ * Gets the storage size `c8_fork_in()` needs for a fork: the state and the
+ * packed display in one cache aligned block.
+ *
+ * @param config CHIP-8 machine configuration.
+ * @return Size in bytes, alignment slack included.
+ */
+size_t c8_fork_size(c8_machine_config config);
+
+/**
+ * Creates a copy of a machine in caller-provided storage, see `c8_fork()`.
+ *
+ * @param state CHIP-8 machine state.
+ * @param buffer Storage, any alignment.
+ * @param size Storage size, at least `c8_fork_size()`.
+ * @return The fork, or NULL if the storage is too small.
+ */
+c8_state* c8_fork_in(c8_state* state, void* buffer, size_t size);
+
+/**
+ * Destroys a CHIP-8 machine instance. The storage of a machine created with
+ * `c8_create_in()` is left to the caller. The block of a machine created
+ * with `c8_create()` holds pages of its forks, it's freed with the last of
+ * them.
  *
  * @param state CHIP-8 machine state to be destroyed.
  */
@@ -272,29 +503,151 @@ void c8_set_registers(c8_state* state, const c8_registers* regs);
  * @warning You should do boundary check with `display_size` value since
  * display dimensions from `c8_get_machine_config()` are logical,
  * and `display_size` is basically `WIDTH/8 * HEIGHT/8`.
- * 
+ *
+ * The returned view is refreshed by this call, so call it again after
+ * running the machine. Forks allocate it, along with the memory view, on
+ * the first call.
+ *
  * @param state CHIP-8 machine state.
  * @param display_size A pointer to uint32_t where returned display size
  * will be written.
- * @return A machine's display state.
+ * @return A machine's display state, or NULL if out of memory.
+ */
+const uint8_t* c8_get_display(c8_state* state, uint32_t* display_size);
+
+/**
+ * Gets packed display state from a machine.
+ *
+ * The display is stored with 1 bit per pixel, `words_per_row` words per row.
+ * Pixel (X, Y) is bit `63 - X % 64` of word `Y * words_per_row + X / 64`.
+ * Unlike `c8_get_display()`, the returned pointer is always up to date and
+ * stays valid until the machine is destroyed.
+ *
+ * @param state CHIP-8 machine state.
+ * @param words_per_row A pointer to uint32_t where the number of words
+ * per display row will be written.
+ * @return A machine's packed display state.
+ */
+const uint64_t* c8_get_display_rows(const c8_state* state,
+                                    uint32_t* words_per_row);
+
+/**
+ * Gets the display area changed by `DXYN` and `00E0` since the last
+ * `c8_clear_display_dirty()` call.
+ *
+ * A freshly created or reset machine reports the whole display as changed.
+ *
+ * @param state CHIP-8 machine state.
+ * @param dirty A pointer to c8_display_dirty where the changed area
+ * will be written.
+ * @return true if anything has changed.
+ */
+bool c8_get_display_dirty(const c8_state* state, c8_display_dirty* dirty);
+
+/**
+ * Marks the whole display as unchanged.
+ *
+ * @param state CHIP-8 machine state.
  */
-const uint8_t* c8_get_display(const c8_state* state, uint32_t* display_size);
+void c8_clear_display_dirty(c8_state* state);
 
 /**
  * Gets machine's memory pointer.
  *
+ * The returned view is refreshed by this call, so call it again after
+ * running the machine. Forks allocate it on the first call, see
+ * `c8_get_display()`.
+ *
  * @param state CHIP-8 machine state
- * @return A pointer to machine's memory, starting from 0x000.
+ * @return A pointer to machine's memory, starting from 0x000, or NULL if
+ * out of memory.
  */
 const uint8_t* c8_get_memory(c8_state* state);
 
 /**
- * Resets a state.
+ * Gets the size of a machine snapshot. Depends only on machine config.
+ *
+ * @param state CHIP-8 machine state.
+ * @return Snapshot size in bytes.
+ */
+size_t c8_snapshot_size(const c8_state* state);
+
+/**
+ * Saves complete machine state into a buffer. Does not allocate.
+ *
+ * @param state CHIP-8 machine state.
+ * @param buffer Buffer to write the snapshot to.
+ * @param size Buffer size, at least `c8_snapshot_size()` bytes.
+ * @return Number of bytes written, or 0 if the buffer is too small.
+ */
+size_t c8_snapshot_save(const c8_state* state, void* buffer, size_t size);
+
+/**
+ * Restores machine state from a snapshot.
+ *
+ * The snapshot must come from a machine with the same quirks, memory size
+ * and screen size. Breakpoints and watchpoints are kept as they are.
+ *
+ * @param state CHIP-8 machine state.
+ * @param buffer Snapshot written by `c8_snapshot_save()`.
+ * @param size Snapshot size.
+ * @return false if the snapshot is damaged, has a different version or
+ * does not match the machine config. The machine is left unchanged then.
+ */
+bool c8_snapshot_load(c8_state* state, const void* buffer, size_t size);
+
+/**
+ * Gets a 64-bit hash of the machine state: registers, memory, display, RNG
+ * and key wait. Machines in equal states have equal hashes, so it tells when
+ * a machine comes back to an earlier state or two machines meet. Pressed
+ * keys and the time to the next vblank are input, they are not hashed.
+ *
+ * With `c8_set_state_hashing()`, memory and display writes keep the hash up
+ * to date as they go, getting it costs the same for any memory size.
+ * Otherwise it is computed from scratch like `c8_compute_state_hash()`.
+ *
+ * @param state CHIP-8 machine state.
+ * @return The hash, 0 if `state` is NULL.
+ */
+uint64_t c8_get_state_hash(const c8_state* state);
+
+/**
+ * Computes `c8_get_state_hash()` from scratch, reading all of memory and
+ * the display. For checking the incremental hash.
+ *
+ * @param state CHIP-8 machine state.
+ * @return The hash, 0 if `state` is NULL.
+ */
+uint64_t c8_compute_state_hash(const c8_state* state);
+
+/**
+ * Sets whether memory and display writes keep the state hash up to date.
+ * That makes `c8_get_state_hash()` cheap for machines that get it often,
+ * but slows down memory writes. Off by default, kept across resets and
+ * copied by forks. Turning it on computes the hash from scratch once.
+ *
+ * @param state CHIP-8 machine state.
+ * @param enabled true to keep the hash up to date.
+ */
+void c8_set_state_hashing(c8_state* state, bool enabled);
+
+/**
+ * Resets a state. Loaded ROMs are dropped from memory as well.
  *
  * @param state CHIP-8 machine state.
  */
 void c8_reset(c8_state* state);
 
+/**
+ * Resets a state to how it was right after the ROMs were loaded, as if
+ * `c8_reset()` and the same `c8_load_rom()` calls were made again. Only the
+ * memory pages written since the last reset are copied back, so this is
+ * much cheaper than reloading.
+ *
+ * @param state CHIP-8 machine state.
+ */
+void c8_reset_to_pristine(c8_state* state);
+
 /**
  * Updates sound and delay timers.
  *
@@ -306,6 +659,10 @@ void c8_update_timers(c8_state* state, float delta_time);
 /**
  * Makes a step in code execution.
  *
+ * Does nothing while the machine is waiting for a key or halted.
+ * @see c8_is_waiting_for_key()
+ * @see c8_is_halted()
+ *
  * @param state CHIP-8 machine state.
  */
 void c8_step(c8_state* state);
@@ -314,12 +671,123 @@ void c8_step(c8_state* state);
  * Makes `cycles_per_frame` steps in code execution.
  * `cycles_per_frame` is taken from machine's config.
  *
+ * Returns early if the machine starts waiting for a key or halts.
+ *
  * @see c8_step()
  *
  * @param state CHIP-8 machine state.
  */
 void c8_step_frame(c8_state* state);
 
+/**
+ * Runs the machine until a stop condition is met or `max_cycles` cycles
+ * have been executed.
+ *
+ * Display, sound, fault and watchpoint stops happen right after the
+ * instruction that raised them. A breakpoint stops before the instruction at
+ * its address, except for the first one, so a run stopped at a breakpoint can
+ * be resumed with another call.
+ *
+ * Breakpoints and watchpoints are checked by the instruction handlers, so
+ * they cost nothing until set. While checked, the JIT is not used.
+ *
+ * @param state CHIP-8 machine state.
+ * @param max_cycles Cycle budget.
+ * @param stop_mask Stop conditions, a combination of `c8_stop_reason` flags.
+ * @return Cycles executed and the stop reason.
+ */
+c8_run_result c8_run(c8_state* state, uint32_t max_cycles, uint32_t stop_mask);
+
+/**
+ * Sets or clears a breakpoint. Breakpoints are checked by `c8_run()` when
+ * `C8_STOP_BREAKPOINT` is set in its stop mask.
+ *
+ * @param state CHIP-8 machine state.
+ * @param addr Instruction address.
+ * @param enabled true to set the breakpoint, false to clear it.
+ * @return false if the address is out of memory bounds, or out of memory.
+ */
+bool c8_set_breakpoint(c8_state* state, uint16_t addr, bool enabled);
+
+/**
+ * Sets or clears a memory watchpoint. Watchpoints are checked by `c8_run()`
+ * when `C8_STOP_WATCH_READ` or `C8_STOP_WATCH_WRITE` is set in its stop mask.
+ *
+ * @param state CHIP-8 machine state.
+ * @param addr Memory address.
+ * @param access Watched access kinds, a combination of `c8_watch` flags.
+ * @param enabled true to set the watchpoint, false to clear it.
+ * @return false if the address is out of memory bounds.
+ */
+bool c8_set_watchpoint(c8_state* state,
+                       uint16_t addr,
+                       uint32_t access,
+                       bool enabled);
+
+/**
+ * Gets watched access kinds for an address.
+ *
+ * @param state CHIP-8 machine state.
+ * @param addr Memory address.
+ * @return A combination of `c8_watch` flags.
+ */
+uint32_t c8_get_watchpoint(const c8_state* state, uint16_t addr);
+
+/**
+ * Checks whether a breakpoint is set.
+ *
+ * @param state CHIP-8 machine state.
+ * @param addr Instruction address.
+ * @return true if there is a breakpoint at `addr`.
+ */
+bool c8_has_breakpoint(const c8_state* state, uint16_t addr);
+
+/**
+ * Checks whether the machine is blocked on `FX0A`.
+ *
+ * A waiting machine does not execute anything until `c8_press_key()` or
+ * `c8_release_key()` changes a key state.
+ *
+ * @param state CHIP-8 machine state.
+ * @return true if the machine is waiting for a key.
+ */
+bool c8_is_waiting_for_key(const c8_state* state);
+
+/**
+ * Gets the fault register. It keeps the first fault until the machine is
+ * reset or the fault is cleared.
+ *
+ * @param state CHIP-8 machine state.
+ * @param addr Output address of the faulting instruction, may be NULL.
+ * @return A `c8_fault` code, C8_FAULT_NONE if nothing has faulted.
+ */
+uint32_t c8_get_fault(const c8_state* state, uint16_t* addr);
+
+/**
+ * Clears the fault register. A halted machine resumes where it stopped.
+ *
+ * @param state CHIP-8 machine state.
+ */
+void c8_clear_fault(c8_state* state);
+
+/**
+ * Sets whether the machine halts on faults. A halted machine does not
+ * execute anything until the fault is cleared or the machine is reset. The
+ * setting is kept across resets.
+ *
+ * @param state CHIP-8 machine state.
+ * @param enabled true to halt on faults.
+ */
+void c8_set_halt_on_fault(c8_state* state, bool enabled);
+
+/**
+ * Checks whether the machine has halted on a fault.
+ *
+ * @param state CHIP-8 machine state.
+ * @return true if the machine is halted.
+ */
+bool c8_is_halted(const c8_state* state);
+
 /**
  * Passes a key press.
  *
@@ -0,0 +1,827 @@
+#include "c8_batch.h"
+#include "c8_internal.h"
+#include "c8_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) \
+    && !defined(C8_BATCH_NO_AVX2)
+    #define C8_BATCH_AVX2
+    #include <immintrin.h>
+#endif
+
+/// Lanes are padded to whole 256-bit vectors of bytes.
+#define C8_BATCH_LANE_ALIGN 32
+/// Smallest group worth a vector operation.
+#define C8_BATCH_MIN_GROUP 4
+/// Groups tried per step before the remaining instances run one by one.
+#define C8_BATCH_MAX_GROUPS 4
+
+struct c8_batch {
+    c8_machine_config config;
+    uint32_t count;
+    uint32_t lanes; ///< `count` rounded up to `C8_BATCH_LANE_ALIGN`.
+    c8_pool* pool; ///< Storage of `states`, one slab for all instances.
+    c8_state** states; ///< Memory, display, keys and RNG of each instance.
+    uint8_t* image; ///< Memory of every instance that never wrote to it.
+    uint8_t* own_code; ///< Nonzero if an instance memory differs from `image`.
+    uint8_t* waiting; ///< Copy of `waiting_for_key` of each instance.
+    uint8_t* v[16];
+    uint16_t* i;
+    uint16_t* pc;
+    uint8_t* sp;
+    uint8_t* dt;
+    uint8_t* st;
+    uint16_t* stack[16];
+    uint8_t* mask; ///< 0xFF for lanes of the current group.
+    uint8_t* cond; ///< Skip condition of each lane of the current group.
+    uint8_t* done; ///< Nonzero for lanes already stepped or waiting.
+    uint32_t own_code_count; ///< Nonzero entries of `own_code`.
+    bool avx2;
+    c8_batch_stats stats;
+};
+
+#pragma region Lanes
+
+static void c8_batch_lane_to_state(c8_batch* batch, uint32_t lane) {
+    c8_registers* regs = &batch->states[lane]->registers;
+    for (uint8_t k = 0; k < 16; ++k) {
+        regs->v[k] = batch->v[k][lane];
+        regs->stack[k] = batch->stack[k][lane];
+    }
+    regs->i = batch->i[lane];
+    regs->pc = batch->pc[lane];
+    regs->sp = batch->sp[lane];
+    regs->dt = batch->dt[lane];
+    regs->st = batch->st[lane];
+}
+
+static void c8_batch_lane_from_state(c8_batch* batch, uint32_t lane) {
+    const c8_registers* regs = &batch->states[lane]->registers;
+    for (uint8_t k = 0; k < 16; ++k) {
+        batch->v[k][lane] = regs->v[k];
+        batch->stack[k][lane] = regs->stack[k];
+    }
+    batch->i[lane] = regs->i;
+    batch->pc[lane] = regs->pc;
+    batch->sp[lane] = regs->sp;
+    batch->dt[lane] = regs->dt;
+    batch->st[lane] = regs->st;
+}
+
+static void c8_batch_sync_all(c8_batch* batch) {
+    for (uint32_t lane = 0; lane < batch->count; ++lane) {
+        c8_batch_lane_from_state(batch, lane);
+        batch->waiting[lane] = batch->states[lane]->waiting_for_key;
+    }
+}
+
+/**
+ * Fetches the opcode at `pc` the same way the interpreter does.
+ */
+static uint16_t c8_batch_fetch(const c8_batch* batch,
+                               const uint8_t* memory,
+                               uint16_t pc) {
+    const uint16_t memory_size = batch->config.memory_size;
+    return memory[pc] << 8 | (pc + 1 < memory_size ? memory[pc + 1] : 0);
+}
+
+/**
+ * Fetches the opcode at the PC of a lane. Lanes that never wrote to memory
+ * read the shared image instead of touching their machine.
+ */
+static uint16_t c8_batch_fetch_lane(const c8_batch* batch, uint32_t lane) {
+    if (batch->own_code[lane] != 0) {
+        return c8_fetch(batch->states[lane], batch->pc[lane]);
+    }
+    return c8_batch_fetch(batch, batch->image, batch->pc[lane]);
+}
+
+static void c8_batch_step_scalar(c8_batch* batch, uint32_t lane) {
+    c8_state* state = batch->states[lane];
+    const uint32_t code_writes = state->code_writes;
+
+    c8_batch_lane_to_state(batch, lane);
+    c8_step(state);
+    c8_batch_lane_from_state(batch, lane);
+
+    if (state->code_writes != code_writes && batch->own_code[lane] == 0) {
+        batch->own_code[lane] = 1;
+        ++batch->own_code_count;
+    }
+    batch->waiting[lane] = state->waiting_for_key;
+    ++batch->stats.scalar_steps;
+}
+
+#pragma endregion
+
+#pragma region Vector operations
+
+/**
+ * Checks whether an instruction only touches registers the batch stores as
+ * arrays, so a group can run it without its machines.
+ */
+static bool c8_batch_is_vector_kind(uint8_t kind) {
+    switch (kind) {
+    case C8_OP_JP_NNN:
+    case C8_OP_SE_VX_NN:
+    case C8_OP_SNE_VX_NN:
+    case C8_OP_SE_VX_VY:
+    case C8_OP_SNE_VX_VY:
+    case C8_OP_LD_VX_NN:
+    case C8_OP_ADD_VX_NN:
+    case C8_OP_LD_VX_VY:
+    case C8_OP_OR:
+    case C8_OP_AND:
+    case C8_OP_XOR:
+    case C8_OP_ADD_VX_VY:
+    case C8_OP_SUB:
+    case C8_OP_SHR:
+    case C8_OP_SUBN:
+    case C8_OP_SHL:
+    case C8_OP_LD_I_NNN:
+    case C8_OP_LD_VX_DT:
+    case C8_OP_LD_DT_VX:
+    case C8_OP_ADD_I_VX:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Masks the lanes not stepped yet that are at `pc` and run from the shared
+ * image.
+ *
+ * @param image_matches Whether the image holds the opcode of the group.
+ * @return Number of selected lanes.
+ */
+static uint32_t c8_batch_select(c8_batch* batch,
+                                uint16_t pc,
+                                bool image_matches) {
+    uint32_t result = 0;
+    for (uint32_t lane = 0; lane < batch->lanes; ++lane) {
+        const bool selected = image_matches && batch->pc[lane] == pc
+            && (batch->done[lane] | batch->own_code[lane]) == 0;
+        batch->mask[lane] = selected ? 0xFF : 0;
+        result += selected;
+    }
+    return result;
+}
+
+/**
+ * Runs the 8-bit part of an instruction on the lanes of the group: register
+ * writes and skip conditions.
+ */
+static void c8_batch_exec_bytes(c8_batch* batch, const c8_insn* insn) {
+    const uint32_t quirks = batch->config.quirks;
+    uint8_t* vx = batch->v[insn->x];
+    const uint8_t* vy = batch->v[insn->y];
+    uint8_t* vf = batch->v[0xF];
+    const uint8_t* src = (quirks & C8_QUIRK_SHIFT) != 0 ? vx : vy;
+    const bool vf_reset = (quirks & C8_QUIRK_VF_RESET) != 0;
+
+    for (uint32_t lane = 0; lane < batch->count; ++lane) {
+        if (batch->mask[lane] == 0) {
+            continue;
+        }
+
+        const uint8_t a = vx[lane];
+        const uint8_t b = vy[lane];
+        switch (insn->kind) {
+        case C8_OP_SE_VX_NN:
+            batch->cond[lane] = a == insn->nn;
+            break;
+        case C8_OP_SNE_VX_NN:
+            batch->cond[lane] = a != insn->nn;
+            break;
+        case C8_OP_SE_VX_VY:
+            batch->cond[lane] = a == b;
+            break;
+        case C8_OP_SNE_VX_VY:
+            batch->cond[lane] = a != b;
+            break;
+        case C8_OP_LD_VX_NN:
+            vx[lane] = insn->nn;
+            break;
+        case C8_OP_ADD_VX_NN:
+            vx[lane] = a + insn->nn;
+            break;
+        case C8_OP_LD_VX_VY:
+            vx[lane] = b;
+            break;
+        case C8_OP_OR:
+            vx[lane] = a | b;
+            vf[lane] = vf_reset ? 0 : vf[lane];
+            break;
+        case C8_OP_AND:
+            vx[lane] = a & b;
+            vf[lane] = vf_reset ? 0 : vf[lane];
+            break;
+        case C8_OP_XOR:
+            vx[lane] = a ^ b;
+            vf[lane] = vf_reset ? 0 : vf[lane];
+            break;
+        case C8_OP_ADD_VX_VY:
+            vx[lane] = a + b;
+            vf[lane] = a + b > 0xFF;
+            break;
+        case C8_OP_SUB:
+            vx[lane] = a - b;
+            vf[lane] = a > b;
+            break;
+        case C8_OP_SUBN:
+            vx[lane] = b - a;
+            vf[lane] = b > a;
+            break;
+        case C8_OP_SHR: {
+            const uint8_t value = src[lane];
+            vx[lane] = value >> 1;
+            vf[lane] = value & 0x1;
+            break;
+        }
+        case C8_OP_SHL: {
+            const uint8_t value = src[lane];
+            vx[lane] = value << 1;
+            vf[lane] = (value & 0x80) >> 7;
+            break;
+        }
+        case C8_OP_LD_VX_DT:
+            vx[lane] = batch->dt[lane];
+            break;
+        case C8_OP_LD_DT_VX:
+            batch->dt[lane] = a;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+#ifdef C8_BATCH_AVX2
+/**
+ * AVX2 version of `c8_batch_exec_bytes()`, 32 lanes per operation. Every
+ * result is blended into the arrays under the group mask, so lanes outside
+ * the group keep their values.
+ */
+__attribute__((target("avx2")))
+static void c8_batch_exec_bytes_avx2(c8_batch* batch, const c8_insn* insn) {
+    const uint32_t quirks = batch->config.quirks;
+    uint8_t* vx = batch->v[insn->x];
+    const uint8_t* vy = batch->v[insn->y];
+    uint8_t* vf = batch->v[0xF];
+    const uint8_t* src = (quirks & C8_QUIRK_SHIFT) != 0 ? vx : vy;
+    const bool vf_reset = (quirks & C8_QUIRK_VF_RESET) != 0;
+
+    const bool writes_vf = insn->kind == C8_OP_ADD_VX_VY
+        || insn->kind == C8_OP_SUB || insn->kind == C8_OP_SUBN
+        || insn->kind == C8_OP_SHR || insn->kind == C8_OP_SHL
+        || (vf_reset && (insn->kind == C8_OP_OR || insn->kind == C8_OP_AND
+                         || insn->kind == C8_OP_XOR));
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i nn = _mm256_set1_epi8((char)insn->nn);
+
+    for (uint32_t lane = 0; lane < batch->lanes; lane += 32) {
+        const __m256i mask =
+            _mm256_loadu_si256((const __m256i*)&batch->mask[lane]);
+        if (_mm256_testz_si256(mask, mask)) {
+            continue;
+        }
+
+        const __m256i a = _mm256_loadu_si256((const __m256i*)&vx[lane]);
+        const __m256i b = _mm256_loadu_si256((const __m256i*)&vy[lane]);
+        __m256i r = a;
+        __m256i f = _mm256_loadu_si256((const __m256i*)&vf[lane]);
+        __m256i* out = (__m256i*)&vx[lane];
+
+        switch (insn->kind) {
+        case C8_OP_SE_VX_NN:
+        case C8_OP_SNE_VX_NN:
+        case C8_OP_SE_VX_VY:
+        case C8_OP_SNE_VX_VY: {
+            const bool with_nn = insn->kind == C8_OP_SE_VX_NN
+                || insn->kind == C8_OP_SNE_VX_NN;
+            __m256i eq = _mm256_cmpeq_epi8(a, with_nn ? nn : b);
+            if (insn->kind == C8_OP_SNE_VX_NN
+                || insn->kind == C8_OP_SNE_VX_VY) {
+                eq = _mm256_xor_si256(eq, _mm256_set1_epi8(-1));
+            }
+            _mm256_storeu_si256((__m256i*)&batch->cond[lane],
+                                _mm256_and_si256(eq, one));
+            continue;
+        }
+        case C8_OP_LD_VX_NN:
+            r = nn;
+            break;
+        case C8_OP_ADD_VX_NN:
+            r = _mm256_add_epi8(a, nn);
+            break;
+        case C8_OP_LD_VX_VY:
+            r = b;
+            break;
+        case C8_OP_OR:
+        case C8_OP_AND:
+        case C8_OP_XOR:
+            r = insn->kind == C8_OP_OR ? _mm256_or_si256(a, b)
+                : insn->kind == C8_OP_AND ? _mm256_and_si256(a, b)
+                : _mm256_xor_si256(a, b);
+            f = zero;
+            break;
+        case C8_OP_ADD_VX_VY:
+            // Carry out iff the wrapped sum is smaller than an operand
+            r = _mm256_add_epi8(a, b);
+            f = _mm256_andnot_si256(
+                _mm256_cmpeq_epi8(_mm256_max_epu8(r, a), r),
+                one
+            );
+            break;
+        case C8_OP_SUB:
+            r = _mm256_sub_epi8(a, b);
+            f = _mm256_andnot_si256(
+                _mm256_cmpeq_epi8(_mm256_min_epu8(a, b), a),
+                one
+            );
+            break;
+        case C8_OP_SUBN:
+            r = _mm256_sub_epi8(b, a);
+            f = _mm256_andnot_si256(
+                _mm256_cmpeq_epi8(_mm256_min_epu8(a, b), b),
+                one
+            );
+            break;
+        case C8_OP_SHR: {
+            const __m256i value =
+                _mm256_loadu_si256((const __m256i*)&src[lane]);
+            r = _mm256_and_si256(_mm256_srli_epi16(value, 1),
+                                 _mm256_set1_epi8(0x7F));
+            f = _mm256_and_si256(value, one);
+            break;
+        }
+        case C8_OP_SHL: {
+            const __m256i value =
+                _mm256_loadu_si256((const __m256i*)&src[lane]);
+            r = _mm256_add_epi8(value, value);
+            f = _mm256_and_si256(_mm256_srli_epi16(value, 7), one);
+            break;
+        }
+        case C8_OP_LD_VX_DT:
+            r = _mm256_loadu_si256((const __m256i*)&batch->dt[lane]);
+            break;
+        case C8_OP_LD_DT_VX:
+            out = (__m256i*)&batch->dt[lane];
+            r = a;
+            break;
+        default:
+            continue;
+        }
+
+        // VX is written before VF, so VF wins when X is F
+        const __m256i old = _mm256_loadu_si256(out);
+        _mm256_storeu_si256(out, _mm256_blendv_epi8(old, r, mask));
+        if (writes_vf) {
+            const __m256i old_f =
+                _mm256_loadu_si256((const __m256i*)&vf[lane]);
+            _mm256_storeu_si256((__m256i*)&vf[lane],
+                                _mm256_blendv_epi8(old_f, f, mask));
+        }
+    }
+}
+
+/**
+ * AVX2 version of `c8_batch_select()`.
+ */
+__attribute__((target("avx2")))
+static uint32_t c8_batch_select_avx2(c8_batch* batch,
+                                     uint16_t pc,
+                                     bool image_matches) {
+    if (!image_matches) {
+        memset(batch->mask, 0, batch->lanes);
+        return 0;
+    }
+
+    const __m256i target = _mm256_set1_epi16((short)pc);
+    uint32_t result = 0;
+    for (uint32_t lane = 0; lane < batch->lanes; lane += 32) {
+        const __m256i lo = _mm256_cmpeq_epi16(
+            _mm256_loadu_si256((const __m256i*)&batch->pc[lane]),
+            target
+        );
+        const __m256i hi = _mm256_cmpeq_epi16(
+            _mm256_loadu_si256((const __m256i*)&batch->pc[lane + 16]),
+            target
+        );
+        // packs works within 128-bit halves, restore the lane order
+        const __m256i at_pc = _mm256_permute4x64_epi64(
+            _mm256_packs_epi16(lo, hi),
+            0xD8
+        );
+        const __m256i busy = _mm256_or_si256(
+            _mm256_loadu_si256((const __m256i*)&batch->done[lane]),
+            _mm256_loadu_si256((const __m256i*)&batch->own_code[lane])
+        );
+        const __m256i mask = _mm256_andnot_si256(
+            _mm256_cmpgt_epi8(busy, _mm256_setzero_si256()),
+            at_pc
+        );
+        _mm256_storeu_si256((__m256i*)&batch->mask[lane], mask);
+        result += __builtin_popcount((uint32_t)_mm256_movemask_epi8(mask));
+    }
+    return result;
+}
+
+static bool c8_batch_has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#else
+static bool c8_batch_has_avx2(void) {
+    return false;
+}
+#endif
+
+static uint32_t c8_batch_select_lanes(c8_batch* batch,
+                                      uint16_t pc,
+                                      bool image_matches) {
+#ifdef C8_BATCH_AVX2
+    if (batch->avx2) {
+        return c8_batch_select_avx2(batch, pc, image_matches);
+    }
+#endif
+    return c8_batch_select(batch, pc, image_matches);
+}
+
+/**
+ * Runs an instruction at `pc` on every lane of the group.
+ */
+static void c8_batch_exec_group(c8_batch* batch,
+                                const c8_insn* insn,
+                                uint16_t pc) {
+#ifdef C8_BATCH_AVX2
+    if (batch->avx2) {
+        c8_batch_exec_bytes_avx2(batch, insn);
+    } else {
+        c8_batch_exec_bytes(batch, insn);
+    }
+#else
+    c8_batch_exec_bytes(batch, insn);
+#endif
+
+    // Every lane of the group is at the same PC
+    const uint16_t memory_size = batch->config.memory_size;
+    const uint16_t next = insn->kind == C8_OP_JP_NNN ? insn->nnn : pc + 2;
+    const uint16_t skip = pc + 4;
+    const bool is_skip = insn->kind == C8_OP_SE_VX_NN
+        || insn->kind == C8_OP_SNE_VX_NN || insn->kind == C8_OP_SE_VX_VY
+        || insn->kind == C8_OP_SNE_VX_VY;
+
+    const uint8_t* vx = batch->v[insn->x];
+    for (uint32_t lane = 0; lane < batch->count; ++lane) {
+        if (batch->mask[lane] == 0) {
+            continue;
+        }
+
+        batch->pc[lane] = is_skip && batch->cond[lane] != 0 ? skip : next;
+        if (batch->pc[lane] >= memory_size) {
+            c8_raise_fault(batch->states[lane], C8_FAULT_PC_OUT_OF_BOUNDS, pc);
+            batch->pc[lane] = C8_PC_ON_FAULT;
+        }
+        if (insn->kind == C8_OP_LD_I_NNN) {
+            batch->i[lane] = insn->nnn;
+        } else if (insn->kind == C8_OP_ADD_I_VX) {
+            const uint16_t i = batch->i[lane] + vx[lane];
+            batch->v[0xF][lane] = i > 0x0FFF ? 1 : 0;
+            batch->i[lane] = i & 0xFFF;
+        }
+
+        batch->mask[lane] = 0;
+        batch->done[lane] = 1;
+    }
+}
+
+#pragma endregion
+
+c8_batch* c8_batch_create(c8_machine_config config, uint32_t count) {
+    if (count == 0) {
+        return nullptr;
+    }
+
+    config.engine = C8_ENGINE_INTERPRETER;
+
+    c8_batch* result = calloc(1, sizeof(c8_batch));
+    if (result == nullptr) {
+        return nullptr;
+    }
+
+    result->config = config;
+    result->count = count;
+    result->lanes = (count + C8_BATCH_LANE_ALIGN - 1)
+        / C8_BATCH_LANE_ALIGN * C8_BATCH_LANE_ALIGN;
+    result->avx2 = c8_batch_has_avx2();
+
+    const uint32_t lanes = result->lanes;
+    bool ok = true;
+    for (uint8_t k = 0; k < 16; ++k) {
+        result->v[k] = calloc(lanes, sizeof(uint8_t));
+        result->stack[k] = calloc(lanes, sizeof(uint16_t));
+        ok = ok && result->v[k] != nullptr && result->stack[k] != nullptr;
+    }
+    result->i = calloc(lanes, sizeof(uint16_t));
+    result->pc = calloc(lanes, sizeof(uint16_t));
+    result->sp = calloc(lanes, sizeof(uint8_t));
+    result->dt = calloc(lanes, sizeof(uint8_t));
+    result->st = calloc(lanes, sizeof(uint8_t));
+    result->mask = calloc(lanes, sizeof(uint8_t));
+    result->cond = calloc(lanes, sizeof(uint8_t));
+    result->done = calloc(lanes, sizeof(uint8_t));
+    result->states = calloc(count, sizeof(c8_state*));
+    result->image = calloc(config.memory_size, sizeof(uint8_t));
+    result->own_code = calloc(lanes, sizeof(uint8_t));
+    result->waiting = calloc(lanes, sizeof(uint8_t));
+    ok = ok && result->i != nullptr && result->pc != nullptr
+        && result->sp != nullptr && result->dt != nullptr
+        && result->st != nullptr && result->mask != nullptr
+        && result->cond != nullptr && result->done != nullptr
+        && result->states != nullptr
+        && result->image != nullptr && result->own_code != nullptr
+        && result->waiting != nullptr;
+
+    result->pool = c8_pool_create(config, count);
+    for (uint32_t lane = 0; ok && lane < count; ++lane) {
+        result->states[lane] = c8_pool_acquire(result->pool);
+        ok = result->states[lane] != nullptr;
+    }
+
+    if (!ok) {
+        c8_batch_destroy(result);
+        return nullptr;
+    }
+
+    memcpy(result->image, c8_get_memory(result->states[0]), config.memory_size);
+    // Padding lanes never run
+    memset(result->waiting + count, 1, lanes - count);
+    c8_batch_sync_all(result);
+    return result;
+}
+
+void c8_batch_destroy(c8_batch* batch) {
+    if (batch == nullptr) {
+        return;
+    }
+
+    c8_pool_destroy(batch->pool);
+    for (uint8_t k = 0; k < 16; ++k) {
+        free(batch->v[k]);
+        free(batch->stack[k]);
+    }
+    free(batch->i);
+    free(batch->pc);
+    free(batch->sp);
+    free(batch->dt);
+    free(batch->st);
+    free(batch->mask);
+    free(batch->cond);
+    free(batch->done);
+    free(batch->states);
+    free(batch->image);
+    free(batch->own_code);
+    free(batch->waiting);
+    free(batch);
+}
+
+uint32_t c8_batch_count(const c8_batch* batch) {
+    if (batch == nullptr) {
+        return 0;
+    }
+
+    return batch->count;
+}
+
+void c8_batch_reset(c8_batch* batch) {
+    if (batch == nullptr) {
+        return;
+    }
+
+    for (uint32_t lane = 0; lane < batch->count; ++lane) {
+        c8_reset(batch->states[lane]);
+    }
+    memcpy(batch->image,
+           c8_get_memory(batch->states[0]),
+           batch->config.memory_size);
+    memset(batch->own_code, 0, batch->lanes);
+    batch->own_code_count = 0;
+    c8_batch_sync_all(batch);
+}
+
+void c8_batch_restart(c8_batch* batch, uint32_t index) {
+    if (batch == nullptr || index >= batch->count) {
+        return;
+    }
+
+    // The pristine image of every instance matches `image`
+    c8_state* state = batch->states[index];
+    c8_reset_to_pristine(state);
+
+    if (batch->own_code[index] != 0) {
+        batch->own_code[index] = 0;
+        --batch->own_code_count;
+    }
+    c8_batch_lane_from_state(batch, index);
+    batch->waiting[index] = state->waiting_for_key;
+}
+
+void c8_batch_load_rom(c8_batch* batch, const uint8_t* rom, uint16_t size) {
+    if (batch == nullptr || rom == nullptr) {
+        return;
+    }
+
+    for (uint32_t lane = 0; lane < batch->count; ++lane) {
+        c8_load_rom(batch->states[lane], rom, size);
+    }
+    // Same copy as c8_load_rom(), instances that wrote elsewhere keep
+    // their own code
+    const int sz = C8_MIN(size, batch->config.memory_size - 0x200);
+    memmove(batch->image + 0x200, rom, sz);
+    c8_batch_sync_all(batch);
+}
+
+void c8_batch_set_rng_seed(c8_batch* batch, uint32_t index, uint32_t seed) {
+    if (batch == nullptr || index >= batch->count) {
+        return;
+    }
+
+    c8_set_rng_seed(batch->states[index], seed);
+}
+
+void c8_batch_press_key(c8_batch* batch, uint32_t index, c8_key key) {
+    if (batch == nullptr || index >= batch->count) {
+        return;
+    }
+
+    c8_press_key(batch->states[index], key);
+    batch->waiting[index] = batch->states[index]->waiting_for_key;
+}
+
+void c8_batch_release_key(c8_batch* batch, uint32_t index, c8_key key) {
+    if (batch == nullptr || index >= batch->count) {
+        return;
+    }
+
+    c8_release_key(batch->states[index], key);
+    batch->waiting[index] = batch->states[index]->waiting_for_key;
+}
+
+void c8_batch_update_timers(c8_batch* batch, float delta_time) {
+    if (batch == nullptr) {
+        return;
+    }
+
+    for (uint32_t lane = 0; lane < batch->count; ++lane) {
+        c8_state* state = batch->states[lane];
+        state->registers.dt = batch->dt[lane];
+        state->registers.st = batch->st[lane];
+        c8_update_timers(state, delta_time);
+        batch->dt[lane] = state->registers.dt;
+        batch->st[lane] = state->registers.st;
+    }
+}
+
+void c8_batch_step(c8_batch* batch) {
+    if (batch == nullptr) {
+        return;
+    }
+
+    memcpy(batch->done, batch->waiting, batch->lanes);
+
+    uint32_t lead = 0;
+    for (uint32_t groups = 0; groups < C8_BATCH_MAX_GROUPS; ++groups) {
+        while (lead < batch->count && batch->done[lead] != 0) {
+            ++lead;
+        }
+        if (lead == batch->count) {
+            return;
+        }
+
+        const uint16_t pc = batch->pc[lead];
+        const uint16_t op = c8_batch_fetch_lane(batch, lead);
+        const c8_insn insn = c8_decode(batch->states[lead], op);
+
+        if (!c8_batch_is_vector_kind(insn.kind)) {
+            c8_batch_step_scalar(batch, lead);
+            batch->done[lead] = 1;
+            continue;
+        }
+
+        uint32_t group_size = c8_batch_select_lanes(
+            batch,
+            pc,
+            c8_batch_fetch(batch, batch->image, pc) == op
+        );
+        if (batch->own_code_count > 0) {
+            for (uint32_t lane = lead; lane < batch->count; ++lane) {
+                if (batch->own_code[lane] != 0 && batch->done[lane] == 0
+                    && batch->pc[lane] == pc
+                    && c8_batch_fetch_lane(batch, lane) == op) {
+                    batch->mask[lane] = 0xFF;
+                    ++group_size;
+                }
+            }
+        }
+
+        if (group_size >= C8_BATCH_MIN_GROUP) {
+            c8_batch_exec_group(batch, &insn, pc);
+            batch->stats.vector_steps += group_size;
+            ++batch->stats.groups;
+            continue;
+        }
+
+        for (uint32_t lane = lead; lane < batch->count; ++lane) {
+            if (batch->mask[lane] != 0) {
+                batch->mask[lane] = 0;
+                batch->done[lane] = 1;
+                c8_batch_step_scalar(batch, lane);
+            }
+        }
+    }
+
+    // Diverged instances
+    for (uint32_t lane = lead; lane < batch->count; ++lane) {
+        if (batch->done[lane] == 0) {
+            c8_batch_step_scalar(batch, lane);
+        }
+    }
+}
+
+void c8_batch_step_frame(c8_batch* batch) {
+    if (batch == nullptr) {
+        return;
+    }
+
+    for (uint32_t cycle = 0; cycle < batch->config.cycles_per_frame; ++cycle) {
+        c8_batch_step(batch);
+    }
+}
+
+bool c8_batch_get_registers(const c8_batch* batch,
+                            uint32_t index,
+                            c8_registers* regs) {
+    if (batch == nullptr || regs == nullptr || index >= batch->count) {
+        return false;
+    }
+
+    for (uint8_t k = 0; k < 16; ++k) {
+        regs->v[k] = batch->v[k][index];
+        regs->stack[k] = batch->stack[k][index];
+    }
+    regs->i = batch->i[index];
+    regs->pc = batch->pc[index];
+    regs->sp = batch->sp[index];
+    regs->dt = batch->dt[index];
+    regs->st = batch->st[index];
+    return true;
+}
+
+const uint8_t* c8_batch_get_memory(c8_batch* batch, uint32_t index) {
+    if (batch == nullptr || index >= batch->count) {
+        return nullptr;
+    }
+
+    return c8_get_memory(batch->states[index]);
+}
+
+const uint64_t* c8_batch_get_display_rows(const c8_batch* batch,
+                                          uint32_t index,
+                                          uint32_t* words_per_row) {
+    if (batch == nullptr || index >= batch->count) {
+        return nullptr;
+    }
+
+    return c8_get_display_rows(batch->states[index], words_per_row);
+}
+
+bool c8_batch_is_waiting_for_key(const c8_batch* batch, uint32_t index) {
+    if (batch == nullptr || index >= batch->count) {
+        return false;
+    }
+
+    return batch->waiting[index] != 0;
+}
+
+uint32_t c8_batch_get_fault(const c8_batch* batch,
+                            uint32_t index,
+                            uint16_t* addr) {
+    if (batch == nullptr || index >= batch->count) {
+        return C8_FAULT_NONE;
+    }
+
+    return c8_get_fault(batch->states[index], addr);
+}
+
+c8_batch_stats c8_batch_get_stats(const c8_batch* batch) {
+    if (batch == nullptr) {
+        return (c8_batch_stats){ 0 };
+    }
+
+    return batch->stats;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "c8.h"
+
+/*
+ * Lockstep batch engine: many machines with the same config, typically the
+ * same ROM with different seeds and inputs.
+ *
+ * Registers are stored as a structure of arrays: each of V0..VF, I, PC, SP,
+ * DT, ST and the stack slots is an array across instances. On every step
+ * instances sharing a PC and an opcode run together, register-only
+ * instructions as one vector operation over the whole group (AVX2 on hosts
+ * that have it). Everything else, and instances that diverged, run through
+ * the regular interpreter one by one. Results are bit-identical to calling
+ * `c8_step()` on separate machines.
+ */
+
+/**
+ * Lockstep batch state.
+ */
+typedef struct c8_batch c8_batch;
+
+/**
+ * Execution counters of a batch.
+ */
+typedef struct c8_batch_stats {
+    uint64_t vector_steps; ///< Instance steps executed by vector operations.
+    uint64_t scalar_steps; ///< Instance steps executed by the interpreter.
+    uint64_t groups; ///< Vector operations.
+} c8_batch_stats;
+
+/**
+ * Creates a batch of machines.
+ *
+ * @param config Machine config shared by all instances. The interpreter is
+ * always used, `engine` is ignored.
+ * @param count Number of instances.
+ * @return Batch, or NULL if `count` is 0.
+ */
+c8_batch* c8_batch_create(c8_machine_config config, uint32_t count);
+
+/**
+ * Destroys a batch.
+ *
+ * @param batch Batch.
+ */
+void c8_batch_destroy(c8_batch* batch);
+
+/**
+ * Gets the number of instances.
+ *
+ * @param batch Batch.
+ * @return Number of instances.
+ */
+uint32_t c8_batch_count(const c8_batch* batch);
+
+/**
+ * Resets every instance, see `c8_reset()`.
+ *
+ * @param batch Batch.
+ */
+void c8_batch_reset(c8_batch* batch);
+
+/**
+ * Resets one instance and gives it the memory of an instance that never
+ * wrote to it: the font and the ROMs loaded with `c8_batch_load_rom()`.
+ * The RNG keeps its state.
+ *
+ * @param batch Batch.
+ * @param index Instance index.
+ */
+void c8_batch_restart(c8_batch* batch, uint32_t index);
+
+/**
+ * Loads a ROM into every instance.
+ *
+ * @param batch Batch.
+ * @param rom ROM.
+ * @param size ROM size.
+ */
+void c8_batch_load_rom(c8_batch* batch, const uint8_t* rom, uint16_t size);
+
+/**
+ * Sets the RNG seed of an instance.
+ *
+ * @param batch Batch.
+ * @param index Instance index.
+ * @param seed RNG seed.
+ */
+void c8_batch_set_rng_seed(c8_batch* batch, uint32_t index, uint32_t seed);
+
+/**
+ * Passes a key press to an instance.
+ *
+ * @param batch Batch.
+ * @param index Instance index.
+ * @param key Pressed key (0-F).
+ */
+void c8_batch_press_key(c8_batch* batch, uint32_t index, c8_key key);
+
+/**
+ * Passes a key release to an instance.
+ *
+ * @param batch Batch.
+ * @param index Instance index.
+ * @param key Released key (0-F).
+ */
+void c8_batch_release_key(c8_batch* batch, uint32_t index, c8_key key);
+
+/**
+ * Updates the timers of every instance, see `c8_update_timers()`.
+ *
+ * @param batch Batch.
+ * @param delta_time Time passed, in milliseconds.
+ */
+void c8_batch_update_timers(c8_batch* batch, float delta_time);
+
+/**
+ * Executes one instruction on every instance not waiting for a key.
+ *
+ * @param batch Batch.
+ */
+void c8_batch_step(c8_batch* batch);
+
+/**
+ * Executes `cycles_per_frame` steps.
+ *
+ * @param batch Batch.
+ */
+void c8_batch_step_frame(c8_batch* batch);
+
+/**
+ * Gets the registers of an instance.
+ *
+ * @param batch Batch.
+ * @param index Instance index.
+ * @param regs Output registers.
+ * @return false if `index` is out of range.
+ */
+bool c8_batch_get_registers(const c8_batch* batch,
+                            uint32_t index,
+                            c8_registers* regs);
+
+/**
+ * Gets the memory of an instance.
+ *
+ * @param batch Batch.
+ * @param index Instance index.
+ * @return Memory, or NULL if `index` is out of range.
+ */
+const uint8_t* c8_batch_get_memory(c8_batch* batch, uint32_t index);
+
+/**
+ * Gets the packed display of an instance, see `c8_get_display_rows()`.
+ *
+ * @param batch Batch.
+ * @param index Instance index.
+ * @param words_per_row Output number of 64-bit words per row.
+ * @return Packed display rows, or NULL if `index` is out of range.
+ */
+const uint64_t* c8_batch_get_display_rows(const c8_batch* batch,
+                                          uint32_t index,
+                                          uint32_t* words_per_row);
+
+/**
+ * Checks whether an instance is blocked on `FX0A`.
+ *
+ * @param batch Batch.
+ * @param index Instance index.
+ * @return true if the instance is waiting for a key.
+ */
+bool c8_batch_is_waiting_for_key(const c8_batch* batch, uint32_t index);
+
+/**
+ * Gets the fault register of an instance, see `c8_get_fault()`.
+ *
+ * @param batch Batch.
+ * @param index Instance index.
+ * @param addr Output address of the faulting instruction, may be NULL.
+ * @return A `c8_fault` code, C8_FAULT_NONE if `index` is out of range.
+ */
+uint32_t c8_batch_get_fault(const c8_batch* batch,
+                            uint32_t index,
+                            uint16_t* addr);
+
+/**
+ * Gets the execution counters.
+ *
+ * @param batch Batch.
+ * @return Counters since the batch was created.
+ */
+c8_batch_stats c8_batch_get_stats(const c8_batch* batch);
@@ -0,0 +1,190 @@
+#include "c8_env.h"
+#include "c8_batch.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct c8_env {
+    c8_env_config config;
+    c8_batch* batch;
+    uint16_t* keys; ///< Keys held by each environment.
+    uint32_t* episode_frames; ///< Frames since each episode started.
+    bool* finished; ///< Episodes that ended during the current action.
+    size_t observation_words; ///< 64-bit words per observation.
+};
+
+/**
+ * Presses and releases keys until the held keys of an environment match
+ * `keys`.
+ */
+static void c8_env_set_keys(c8_env* env, uint32_t index, uint16_t keys) {
+    const uint16_t changed = env->keys[index] ^ keys;
+    for (c8_key key = C8_KEY_0; key < C8_KEY_MAX; ++key) {
+        if (((changed >> key) & 1) == 0) {
+            continue;
+        }
+
+        if (((keys >> key) & 1) != 0) {
+            c8_batch_press_key(env->batch, index, key);
+        } else {
+            c8_batch_release_key(env->batch, index, key);
+        }
+    }
+    env->keys[index] = keys;
+}
+
+static void c8_env_restart(c8_env* env, uint32_t index) {
+    c8_batch_restart(env->batch, index);
+    env->keys[index] = 0;
+    env->episode_frames[index] = 0;
+}
+
+static void c8_env_observe(c8_env* env, uint64_t* observations) {
+    if (observations == nullptr) {
+        return;
+    }
+
+    for (uint32_t index = 0; index < env->config.count; ++index) {
+        uint32_t words_per_row;
+        const uint64_t* rows =
+            c8_batch_get_display_rows(env->batch, index, &words_per_row);
+        memcpy(observations + index * env->observation_words,
+               rows,
+               env->observation_words * sizeof(uint64_t));
+    }
+}
+
+c8_env* c8_env_create(const c8_env_config* config) {
+    if (config == nullptr || config->rom == nullptr || config->count == 0
+        || config->frames_per_action == 0) {
+        return nullptr;
+    }
+
+    c8_env* result = calloc(1, sizeof(c8_env));
+    if (result == nullptr) {
+        return nullptr;
+    }
+
+    result->config = *config;
+    result->config.rom = nullptr;
+    result->batch = c8_batch_create(config->machine, config->count);
+    result->keys = calloc(config->count, sizeof(uint16_t));
+    result->episode_frames = calloc(config->count, sizeof(uint32_t));
+    result->finished = calloc(config->count, sizeof(bool));
+    if (result->batch == nullptr || result->keys == nullptr
+        || result->episode_frames == nullptr || result->finished == nullptr) {
+        c8_env_destroy(result);
+        return nullptr;
+    }
+
+    result->observation_words = (config->machine.screen_width + 63) / 64
+        * config->machine.screen_height;
+
+    c8_batch_load_rom(result->batch, config->rom, config->rom_size);
+    c8_env_reset(result, nullptr);
+    return result;
+}
+
+void c8_env_destroy(c8_env* env) {
+    if (env == nullptr) {
+        return;
+    }
+
+    c8_batch_destroy(env->batch);
+    free(env->keys);
+    free(env->episode_frames);
+    free(env->finished);
+    free(env);
+}
+
+uint32_t c8_env_count(const c8_env* env) {
+    if (env == nullptr) {
+        return 0;
+    }
+
+    return env->config.count;
+}
+
+size_t c8_env_observation_size(const c8_env* env) {
+    if (env == nullptr) {
+        return 0;
+    }
+
+    return env->observation_words * sizeof(uint64_t);
+}
+
+void c8_env_reset(c8_env* env, uint64_t* observations) {
+    if (env == nullptr) {
+        return;
+    }
+
+    for (uint32_t index = 0; index < env->config.count; ++index) {
+        c8_env_restart(env, index);
+        c8_batch_set_rng_seed(env->batch, index, env->config.seed + index);
+    }
+    c8_env_observe(env, observations);
+}
+
+void c8_env_step(c8_env* env,
+                 const uint16_t* actions,
+                 uint64_t* observations,
+                 float* rewards,
+                 bool* dones) {
+    if (env == nullptr || actions == nullptr) {
+        return;
+    }
+
+    const uint32_t count = env->config.count;
+    for (uint32_t index = 0; index < count; ++index) {
+        c8_env_set_keys(env, index, actions[index]);
+        env->finished[index] = false;
+        if (rewards != nullptr) {
+            rewards[index] = 0.f;
+        }
+    }
+
+    const float MS_PER_FRAME = 1000.f / 60.f;
+    const bool use_reward = rewards != nullptr && env->config.reward != nullptr;
+    const uint32_t max_frames = env->config.max_episode_frames;
+    for (uint32_t frame = 0; frame < env->config.frames_per_action; ++frame) {
+        c8_batch_step_frame(env->batch);
+        c8_batch_update_timers(env->batch, MS_PER_FRAME);
+
+        // Finished environments keep running in lockstep until the restart,
+        // their frames are not scored
+        for (uint32_t index = 0; index < count; ++index) {
+            if (env->finished[index]) {
+                continue;
+            }
+
+            const uint8_t* memory = c8_batch_get_memory(env->batch, index);
+            c8_registers registers;
+            c8_batch_get_registers(env->batch, index, &registers);
+
+            if (use_reward) {
+                rewards[index] += env->config.reward(env->config.user,
+                                                     index,
+                                                     memory,
+                                                     &registers);
+            }
+
+            ++env->episode_frames[index];
+            env->finished[index] =
+                (max_frames > 0 && env->episode_frames[index] >= max_frames)
+                    || (env->config.done != nullptr
+                        && env->config.done(env->config.user,
+                                            index,
+                                            memory,
+                                            &registers));
+        }
+    }
+
+    for (uint32_t index = 0; index < count; ++index) {
+        if (env->finished[index]) {
+            c8_env_restart(env, index);
+        }
+        if (dones != nullptr) {
+            dones[index] = env->finished[index];
+        }
+    }
+    c8_env_observe(env, observations);
+}
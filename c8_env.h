@@ -0,0 +1,122 @@
+#pragma once
+
+#include "c8.h"
+
+/*
+ * Vectorized reinforcement learning environment on top of the lockstep
+ * batch engine.
+ *
+ * Every call steps all environments. An action is a key bitmask (bit N is
+ * key N) held for `frames_per_action` frames. Observations are the packed
+ * displays (see `c8_get_display_rows()`), written back to back into one
+ * caller-owned buffer of `count * c8_env_observation_size()` bytes. Rewards
+ * and episode ends come from hooks that read guest memory. Environments
+ * whose episode ended are restarted right away, so the observation returned
+ * for them is the first one of the next episode.
+ *
+ * Stepping does not allocate.
+ */
+
+/**
+ * Vectorized environment.
+ */
+typedef struct c8_env c8_env;
+
+/**
+ * Reward hook, called once per frame for every running environment.
+ *
+ * @param user `user` of the environment config.
+ * @param index Environment index.
+ * @param memory Guest memory.
+ * @param registers Guest registers.
+ * @return Reward for the frame.
+ */
+typedef float (* c8_env_reward_fn)(void* user,
+                                   uint32_t index,
+                                   const uint8_t* memory,
+                                   const c8_registers* registers);
+
+/**
+ * Episode end hook, called once per frame for every running environment.
+ *
+ * @param user `user` of the environment config.
+ * @param index Environment index.
+ * @param memory Guest memory.
+ * @param registers Guest registers.
+ * @return true if the episode is over.
+ */
+typedef bool (* c8_env_done_fn)(void* user,
+                                uint32_t index,
+                                const uint8_t* memory,
+                                const c8_registers* registers);
+
+/**
+ * Environment config.
+ */
+typedef struct c8_env_config {
+    c8_machine_config machine; ///< Machine config of every environment.
+    const uint8_t* rom; ///< ROM, only read by `c8_env_create()`.
+    uint16_t rom_size; ///< ROM size.
+    uint32_t count; ///< Number of environments.
+    uint32_t frames_per_action; ///< Frames every action is held for.
+    uint32_t max_episode_frames; ///< Episode length limit, 0 for none.
+    uint32_t seed; ///< RNG seed of environment 0, environment N uses seed + N.
+    c8_env_reward_fn reward; ///< Reward hook, NULL for no reward.
+    c8_env_done_fn done; ///< Episode end hook, NULL to only use the limit.
+    void* user; ///< Passed to the hooks.
+} c8_env_config;
+
+/**
+ * Creates environments and resets them.
+ *
+ * @param config Environment config.
+ * @return Environments, or NULL if `count` or `frames_per_action` is 0.
+ */
+c8_env* c8_env_create(const c8_env_config* config);
+
+/**
+ * Destroys environments.
+ *
+ * @param env Environments.
+ */
+void c8_env_destroy(c8_env* env);
+
+/**
+ * Gets the number of environments.
+ *
+ * @param env Environments.
+ * @return Number of environments.
+ */
+uint32_t c8_env_count(const c8_env* env);
+
+/**
+ * Gets the observation size of one environment.
+ *
+ * @param env Environments.
+ * @return Observation size, in bytes.
+ */
+size_t c8_env_observation_size(const c8_env* env);
+
+/**
+ * Starts a new episode in every environment and reseeds the RNGs.
+ *
+ * @param env Environments.
+ * @param observations Output observations, may be NULL.
+ */
+void c8_env_reset(c8_env* env, uint64_t* observations);
+
+/**
+ * Runs one action in every environment.
+ *
+ * @param env Environments.
+ * @param actions Key bitmask of every environment.
+ * @param observations Output observations, may be NULL.
+ * @param rewards Output sum of the rewards over the action, may be NULL.
+ * @param dones Output whether the episode ended and was restarted, may be
+ * NULL.
+ */
+void c8_env_step(c8_env* env,
+                 const uint16_t* actions,
+                 uint64_t* observations,
+                 float* rewards,
+                 bool* dones);
@@ -0,0 +1,261 @@
+#include "c8_internal.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) \
+    && !defined(C8_HASH_NO_SSE42)
+    #define C8_HASH_SSE42
+    #include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    #define C8_HASH_ARM_CRC32
+    #include <arm_acle.h>
+#endif
+
+/*
+ * Machine state hashing.
+ *
+ * Every memory byte, packed display word and word of packed registers is a
+ * cell with a 64-bit key. The state hash is the sum of every cell value
+ * times its key, modulo 2^64, through a final mix. Changing a cell changes
+ * the sum by its key times the difference, so memory writes and sprite draws
+ * add that as they go. Getting the hash only sums the few register words.
+ *
+ * This is not Zobrist hashing. XOR of keys picked by cell alone can't tell
+ * the values of a cell apart, and a key per cell and value would need a
+ * table 256 times the size of memory. Multiplying by the value keeps one key
+ * per cell and still updates in O(1).
+ *
+ * Memory sums are kept per page, so pages shared with forks and the pristine
+ * image carry their sums and remapping a page costs one subtraction.
+ *
+ * Keys are the CRC32C of the cell number spread to 64 bits by multiplies.
+ * CRC32C uses the SSE 4.2 or ARMv8 CRC instructions when the CPU has them, a
+ * table when it doesn't. Display and register keys are looked up in tables
+ * built once, memory keys are computed on every write.
+ *
+ * `c8_compute_state_hash()` sums every cell from scratch with the same keys.
+ * It checks the incremental bookkeeping, not the keys: it is not an
+ * independent hash, and a weak key would fool both.
+ */
+
+/// Reflected CRC32C (Castagnoli) polynomial.
+#define C8_CRC32C_POLY 0x82F63B78u
+/// CRC32C start value of the keys.
+#define C8_HASH_KEY_SEED 0x9E3779B9u
+
+uint64_t c8_hash_display_keys[C8_HASH_DISPLAY_WORDS];
+
+static uint64_t c8_hash_register_keys[C8_HASH_REGISTER_WORDS];
+static uint32_t c8_crc32c_table[256];
+
+/**
+ * Spreads the CRC32C of a cell to a key.
+ */
+static inline uint64_t c8_hash_spread_key(uint32_t crc) {
+    uint64_t key = (uint64_t)crc * UINT64_C(0x9E3779B97F4A7C15);
+    key ^= key >> 29;
+    key *= UINT64_C(0xD6E8FEB86659FD93);
+    key ^= key >> 32;
+    return key | 1;
+}
+
+/**
+ * Computes a key with the ARMv8 CRC instructions if the build targets them,
+ * with the table otherwise.
+ */
+static uint64_t c8_hash_key_portable(uint32_t cell) {
+#ifdef C8_HASH_ARM_CRC32
+    return c8_hash_spread_key(__crc32cw(C8_HASH_KEY_SEED, cell));
+#else
+    uint32_t crc = C8_HASH_KEY_SEED;
+    for (uint32_t i = 0; i < 4; ++i) {
+        crc = c8_crc32c_table[(crc ^ cell) & 0xFF] ^ (crc >> 8);
+        cell >>= 8;
+    }
+    return c8_hash_spread_key(crc);
+#endif
+}
+
+static uint64_t c8_hash_memory_delta_portable(uint16_t addr,
+                                          const uint8_t* old,
+                                          const uint8_t* data,
+                                          uint32_t size) {
+    uint64_t delta = 0;
+    for (uint32_t i = 0; i < size; ++i) {
+        const uint8_t value = data != nullptr ? data[i] : 0;
+        if (value != old[i]) {
+            delta +=
+                c8_hash_key_portable(addr + i) * (uint64_t)(value - old[i]);
+        }
+    }
+    return delta;
+}
+
+#ifdef C8_HASH_SSE42
+static bool c8_hash_sse42;
+
+__attribute__((target("sse4.2")))
+static inline uint64_t c8_hash_key_sse42(uint32_t cell) {
+    return c8_hash_spread_key(_mm_crc32_u32(C8_HASH_KEY_SEED, cell));
+}
+
+/**
+ * SSE 4.2 version of `c8_hash_memory_delta_portable()`.
+ */
+__attribute__((target("sse4.2")))
+static uint64_t c8_hash_memory_delta_sse42(uint16_t addr,
+                                           const uint8_t* old,
+                                           const uint8_t* data,
+                                           uint32_t size) {
+    uint64_t delta = 0;
+    for (uint32_t i = 0; i < size; ++i) {
+        const uint8_t value = data != nullptr ? data[i] : 0;
+        if (value != old[i]) {
+            delta += c8_hash_key_sse42(addr + i) * (uint64_t)(value - old[i]);
+        }
+    }
+    return delta;
+}
+#endif
+
+uint64_t c8_hash_key(uint32_t cell) {
+#ifdef C8_HASH_SSE42
+    if (c8_hash_sse42) {
+        return c8_hash_key_sse42(cell);
+    }
+#endif
+    return c8_hash_key_portable(cell);
+}
+
+/**
+ * Spreads the sum over every bit, so hashes can index tables by any part.
+ */
+static uint64_t c8_hash_finish(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xFF51AFD7ED558CCD);
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xC4CEB9FE1A85EC53);
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static void c8_hash_build_tables(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (uint32_t bit = 0; bit < 8; ++bit) {
+            crc = crc & 1 ? (crc >> 1) ^ C8_CRC32C_POLY : crc >> 1;
+        }
+        c8_crc32c_table[i] = crc;
+    }
+
+#ifdef C8_HASH_SSE42
+    __builtin_cpu_init();
+    c8_hash_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+
+    for (uint32_t i = 0; i < C8_HASH_DISPLAY_WORDS; ++i) {
+        c8_hash_display_keys[i] = c8_hash_key(C8_HASH_DISPLAY_CELL + i);
+    }
+    for (uint32_t i = 0; i < C8_HASH_REGISTER_WORDS; ++i) {
+        c8_hash_register_keys[i] = c8_hash_key(C8_HASH_REGISTER_CELL + i);
+    }
+}
+
+#ifdef _WIN32
+static INIT_ONCE c8_hash_tables_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK c8_hash_build_tables_once(PINIT_ONCE once,
+                                              PVOID param,
+                                              PVOID* context) {
+    c8_hash_build_tables();
+    return TRUE;
+}
+
+void c8_hash_init(void) {
+    InitOnceExecuteOnce(&c8_hash_tables_once,
+                        c8_hash_build_tables_once,
+                        nullptr,
+                        nullptr);
+}
+#else
+static pthread_once_t c8_hash_tables_once = PTHREAD_ONCE_INIT;
+
+void c8_hash_init(void) {
+    pthread_once(&c8_hash_tables_once, c8_hash_build_tables);
+}
+#endif
+
+uint64_t c8_hash_memory_delta(uint16_t addr,
+                              const uint8_t* old,
+                              const uint8_t* data,
+                              uint32_t size) {
+#ifdef C8_HASH_SSE42
+    if (c8_hash_sse42) {
+        return c8_hash_memory_delta_sse42(addr, old, data, size);
+    }
+#endif
+    return c8_hash_memory_delta_portable(addr, old, data, size);
+}
+
+/**
+ * Sums the terms of the registers, RNG, key wait and fault, packed in words.
+ */
+static uint64_t c8_hash_registers(const c8_state* state) {
+    const c8_registers* registers = &state->registers;
+    uint64_t words[C8_HASH_REGISTER_WORDS] = { 0, };
+    for (uint32_t i = 0; i < 16; ++i) {
+        words[i / 4] |= (uint64_t)registers->stack[i] << (16 * (i % 4));
+        words[4 + i / 8] |= (uint64_t)registers->v[i] << (8 * (i % 8));
+    }
+    words[6] = registers->pc
+        | (uint64_t)registers->i << 16
+        | (uint64_t)registers->sp << 32
+        | (uint64_t)registers->dt << 40
+        | (uint64_t)registers->st << 48;
+    words[7] = state->rng.seed
+        | (uint64_t)state->waiting_for_key << 32
+        | (uint64_t)state->key_wait_key << 40
+        | (uint64_t)state->fault << 48
+        | (uint64_t)state->halted << 56;
+
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < C8_HASH_REGISTER_WORDS; ++i) {
+        sum += c8_hash_register_keys[i] * words[i];
+    }
+    return sum;
+}
+
+uint64_t c8_get_state_hash(const c8_state* state) {
+    if (state == nullptr) {
+        return 0;
+    }
+    if (!state->hashing) {
+        return c8_compute_state_hash(state);
+    }
+
+    return c8_hash_finish(state->memory_hash
+                          + state->display_hash
+                          + c8_hash_registers(state));
+}
+
+uint64_t c8_compute_state_hash(const c8_state* state) {
+    if (state == nullptr) {
+        return 0;
+    }
+
+    uint64_t sum = 0;
+    for (uint32_t addr = 0; addr < state->config.memory_size; ++addr) {
+        sum += c8_hash_key(addr) * c8_read_byte(state, addr);
+    }
+
+    const uint32_t words = state->display_words * state->config.screen_height;
+    for (uint32_t i = 0; i < words; ++i) {
+        sum += c8_hash_key(C8_HASH_DISPLAY_CELL + i) * state->display_rows[i];
+    }
+
+    return c8_hash_finish(sum + c8_hash_registers(state));
+}
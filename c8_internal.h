@@ -0,0 +1,562 @@
+#pragma once
+
+/*
+ * Private definitions shared between the CHIP-8 core translation units.
+ * Not a part of the public API.
+ */
+
+#include "c8.h"
+
+#ifndef _WIN32
+    #include <stdatomic.h>
+#endif
+
+enum c8_machine_params
+#ifndef C23_COMPAT_NO_ENUM_TYPES
+    : uint16_t
+#endif
+{
+    C8_MEM_FONT_OFFSET = 0x50, C8_PC_ON_FAULT = 0x0,
+    C8_EXT_CLAIMS_SIZE = 0x10000 / 8, ///< Routing bitmap, bit per opcode.
+    C8_STATE_ALIGNMENT = 64, ///< Alignment of every part of a state block.
+    C8_PAGE_SIZE = 0x100, ///< Bytes per memory page.
+    C8_MAX_PAGES = 0x10000 / C8_PAGE_SIZE, ///< Pages of the largest memory.
+};
+
+/**
+ * Cells of the state hash, see `c8_hash_key()`. Memory bytes are cells 0 to
+ * `memory_size - 1`.
+ */
+enum c8_hash_cells {
+    C8_HASH_DISPLAY_CELL = 0x10000, ///< First packed display word.
+    C8_HASH_DISPLAY_WORDS = 4 * 256, ///< Words of the largest display.
+    C8_HASH_REGISTER_CELL = 0x20000, ///< First word of packed registers.
+    C8_HASH_REGISTER_WORDS = 8, ///< Registers, RNG, key wait and fault.
+};
+
+/**
+ * Decoded instruction kinds.
+ */
+enum c8_op_kind
+#ifndef C23_COMPAT_NO_ENUM_TYPES
+    : uint8_t
+#endif
+{
+    C8_OP_UNDECODED = 0, ///< Not decoded yet.
+    C8_OP_ILLEGAL, ///< Not a CHIP-8 instruction.
+    C8_OP_EXT, ///< Claimed by an extension handler.
+    C8_OP_BREAK, ///< Any instruction at a breakpoint address.
+    C8_OP_SYS,
+    C8_OP_CLS,
+    C8_OP_RET,
+    C8_OP_JP_NNN,
+    C8_OP_CALL,
+    C8_OP_SE_VX_NN,
+    C8_OP_SNE_VX_NN,
+    C8_OP_SE_VX_VY,
+    C8_OP_LD_VX_NN,
+    C8_OP_ADD_VX_NN,
+    C8_OP_LD_VX_VY,
+    C8_OP_OR,
+    C8_OP_AND,
+    C8_OP_XOR,
+    C8_OP_ADD_VX_VY,
+    C8_OP_SUB,
+    C8_OP_SHR,
+    C8_OP_SUBN,
+    C8_OP_SHL,
+    C8_OP_SNE_VX_VY,
+    C8_OP_LD_I_NNN,
+    C8_OP_JP_V0_NNN,
+    C8_OP_RND,
+    C8_OP_DRW,
+    C8_OP_SKP,
+    C8_OP_SKNP,
+    C8_OP_LD_VX_DT,
+    C8_OP_LD_VX_KEY,
+    C8_OP_LD_DT_VX,
+    C8_OP_LD_ST_VX,
+    C8_OP_ADD_I_VX,
+    C8_OP_LD_I_FONT_VX,
+    C8_OP_BCD,
+    C8_OP_LD_I_VX,
+    C8_OP_LD_VX_I,
+    C8_OP_KIND_MAX
+};
+
+/**
+ * A decoded instruction with pre-extracted operands.
+ */
+typedef struct c8_insn {
+    uint8_t kind; ///< Instruction kind, see `c8_op_kind`.
+    uint8_t x; ///< Bits 8-11.
+    uint8_t y; ///< Bits 4-7.
+    uint8_t n; ///< Bits 0-3.
+    uint8_t nn; ///< Bits 0-7.
+    uint16_t nnn; ///< Bits 0-11.
+    uint16_t op; ///< Raw opcode.
+} c8_insn;
+
+#ifdef _WIN32
+typedef volatile long c8_page_refs;
+#else
+typedef _Atomic uint32_t c8_page_refs;
+#endif
+
+/**
+ * C8_PAGE_SIZE bytes of memory with the instructions decoded from them.
+ *
+ * Page tables of forked machines and pristine images point to the same
+ * pages until one of them writes, then the writer gets its own copy. A
+ * page that has never been in the tables of a fork is only shared by the
+ * tables of the machine that took it from the arena.
+ */
+typedef struct c8_page {
+    /**
+     * Decoded instruction at every offset. The last one decodes a byte of
+     * the next page as well, so it's never cached.
+     */
+    c8_insn insns[C8_PAGE_SIZE];
+    uint8_t bytes[C8_PAGE_SIZE];
+    uint64_t hash; ///< State hash terms of `bytes` if `hashed`.
+    bool hashed; ///< `hash` is up to date.
+    struct c8_page* next; ///< Next free page of the arena.
+    c8_page_refs refs; ///< Page table entries pointing to the page.
+    bool forked; ///< Has been in the tables of a fork.
+} c8_page;
+
+/**
+ * Pages allocated from the heap when an arena runs out.
+ */
+typedef struct c8_page_chunk {
+    struct c8_page_chunk* next;
+    c8_page pages[];
+} c8_page_chunk;
+
+/**
+ * Pages of a machine and all its forks, and of the machines of a pool.
+ *
+ * Pages start in the block the arena was created in, and more are taken
+ * from the heap in chunks when they run out. Released pages go back to the
+ * free list rather than to the heap, until the last machine using the
+ * arena is destroyed.
+ */
+typedef struct c8_page_arena {
+    c8_page_refs refs; ///< Machines using the arena, plus its pool.
+    c8_page_refs lock; ///< Spinlock of `free_pages`, 1 while held.
+    c8_page* free_pages; ///< Free pages, linked by `c8_page::next`.
+    c8_page_chunk* chunks; ///< Pages allocated from the heap.
+    uint32_t chunk_pages; ///< Pages per chunk.
+    uint8_t* ext_claims; ///< Routing bitmap of the config, or NULL.
+    void* allocation; ///< Block to free with the arena, NULL if not owned.
+} c8_page_arena;
+
+/**
+ * A function pointer type for decoded instruction handler.
+ */
+typedef void (* c8_op_exec)(c8_state* state, const c8_insn* insn);
+
+/**
+ * Basic-block JIT compiler state.
+ */
+typedef struct c8_jit c8_jit;
+
+#ifdef C8_ENABLE_PROFILER
+#include "c8_profile.h"
+
+/**
+ * A node of the profiler call tree, one per distinct guest call stack.
+ */
+typedef struct c8_profile_call {
+    uint16_t entry; ///< Subroutine address, unused by the root.
+    uint16_t parent; ///< Caller node.
+    uint16_t child; ///< First callee node, 0 if none.
+    uint16_t sibling; ///< Next callee node of the caller, 0 if none.
+    uint64_t cycles; ///< Cycles spent in the subroutine itself.
+} c8_profile_call;
+
+/**
+ * Call tree node a CALL instruction entered last, and the node it was made
+ * from.
+ */
+typedef struct c8_profile_site {
+    uint16_t caller; ///< Node of the stack the CALL ran in.
+    uint16_t callee; ///< Node it entered, 0 if none yet.
+} c8_profile_site;
+
+/**
+ * Profiler state of a machine.
+ */
+typedef struct c8_profiler {
+    c8_profile counts;
+    c8_op_exec exec[C8_OP_KIND_MAX]; ///< Handlers wrapped by the profiler.
+    uint64_t* address_counts; ///< Executions per address.
+    uint64_t* loop_counts; ///< Taken backward jumps per jump address.
+    uint16_t* loop_targets; ///< Last backward jump target per jump address.
+    c8_profile_call* calls; ///< Call tree, node 0 is the top level.
+    c8_profile_site* call_sites; ///< Last callee per CALL address.
+    uint16_t call_count; ///< Nodes in `calls`.
+    uint16_t call; ///< Node of the current guest call stack.
+    uint64_t* call_cycles; ///< Cycles of `call`.
+    uint8_t call_depth; ///< Guest stack depth `call` was found for.
+    bool call_exact; ///< Whether `call` has the whole guest stack.
+} c8_profiler;
+#endif
+
+/*
+ * A state is one block, every part aligned to C8_STATE_ALIGNMENT: the
+ * c8_state itself and display_rows, then the memory view and display unless
+ * the machine is a fork, then the page arena with ext_claims and pages for
+ * two page tables if the machine made it.
+ * Only breakpoints, watchpoints, the JIT, the profiler, the views of forks
+ * and pages past those of the arena block are allocated on their own, and
+ * only when used.
+ */
+struct c8_state {
+    c8_machine_config config;
+    c8_op_exec exec[C8_OP_KIND_MAX];
+    uint8_t* ext_claims; ///< Bitmap of the arena, or NULL if not needed.
+    c8_registers registers;
+    bool pressed_keys[C8_KEY_MAX];
+    c8_page* pages[C8_MAX_PAGES]; ///< Memory page table.
+    c8_page* pristine[C8_MAX_PAGES]; ///< Memory after reset and ROM loads.
+    uint16_t page_count; ///< Used entries of the page tables.
+    uint16_t pristine_end; ///< End of the ROMs loaded into `pristine`.
+    c8_page_arena* arena; ///< Where the pages come from.
+    uint64_t memory_hash; ///< State hash terms of memory if `hashing`.
+    uint8_t* memory; ///< Contiguous copy of memory for `c8_get_memory()`.
+    void* views; ///< Heap block of `memory` and `display`, or NULL.
+    uint64_t memory_stale[4]; ///< Pages `memory` is outdated for.
+    uint64_t* display_rows; ///< Packed display, 1 bit per pixel, MSB first.
+    uint8_t* display; ///< Byte per pixel view of `display_rows`.
+    uint8_t display_words; ///< Words per packed display row.
+    bool display_view_stale; ///< `display` needs to be rebuilt.
+    uint64_t display_hash; ///< State hash terms of `display_rows` if `hashing`.
+    uint64_t dirty_rows[4]; ///< Display rows changed since the last clear.
+    uint8_t dirty_x_min; ///< Leftmost changed column.
+    uint8_t dirty_x_max; ///< Rightmost changed column.
+    union {
+        uint32_t seed;
+        uint8_t b[4];
+    } rng;
+    bool waiting_for_key; ///< Fx0A sleeps until a key state changes.
+    uint8_t key_wait_key; ///< Key to be released, or C8_KEY_MAX.
+    uint8_t fault; ///< First `c8_fault` since the last reset or clear.
+    uint16_t fault_addr; ///< Address of the faulting instruction.
+    bool halt_on_fault; ///< Faults halt instead of jumping to the handler.
+    bool hashing; ///< Writes keep `memory_hash` and `display_hash` updated.
+    bool halted; ///< Halted on a fault, nothing is executed.
+    float delta_time;
+    uint16_t vblank;
+    uint32_t side_effects; ///< Bumped on every memory or display write.
+    uint32_t code_writes; ///< Bumped on every memory write.
+    uint32_t events; ///< `c8_stop_reason` flags raised during `c8_run()`.
+    uint8_t* breakpoints; ///< Breakpoint bitmap, or NULL if none were set.
+    uint32_t breakpoint_count;
+    bool break_armed; ///< Breakpoints stop execution instead of passing.
+    uint8_t* watch_read; ///< Read watchpoint bitmap, or NULL.
+    uint8_t* watch_write; ///< Write watchpoint bitmap, or NULL.
+    uint32_t watch_count;
+    uint16_t watch_hit; ///< Address of the last watchpoint hit.
+    c8_op_exec exec_unwatched[C8_OP_KIND_MAX]; ///< `exec` without watches.
+    c8_jit* jit; ///< Block cache, or NULL if the interpreter is used.
+#ifdef C8_ENABLE_PROFILER
+    c8_profiler* profiler; ///< Profiler, or NULL if not profiling.
+#endif
+    void* allocation; ///< Allocated block, NULL if the caller owns it.
+};
+
+/**
+ * Marks columns `x_min` to `x_max` of display row `y` as changed.
+ */
+static inline void c8_display_mark_dirty(c8_state* state,
+                                         uint8_t y,
+                                         uint8_t x_min,
+                                         uint8_t x_max) {
+    state->dirty_rows[y >> 6] |= UINT64_C(1) << (y & 63);
+    state->events |= C8_STOP_DISPLAY;
+    state->dirty_x_min = C8_MIN(state->dirty_x_min, x_min);
+    state->dirty_x_max = C8_MAX(state->dirty_x_max, x_max);
+}
+
+/**
+ * Records a fault the instruction recovers from, like a clipped memory
+ * access. Execution goes on unless the machine halts on faults.
+ *
+ * @param state CHIP-8 machine state.
+ * @param fault Fault code, see `c8_fault`.
+ * @param addr Address of the faulting instruction.
+ */
+static inline void c8_record_fault(c8_state* state,
+                                   uint8_t fault,
+                                   uint16_t addr) {
+    if (state->fault == C8_FAULT_NONE) {
+        state->fault = fault;
+        state->fault_addr = addr;
+    }
+    state->halted = state->halt_on_fault;
+    state->events |= C8_STOP_FAULT;
+}
+
+/**
+ * Records a fault and jumps to the fault handler. Instructions that can't
+ * go on call it and change nothing else.
+ *
+ * @param state CHIP-8 machine state.
+ * @param fault Fault code, see `c8_fault`.
+ * @param addr Address of the faulting instruction.
+ */
+static inline void c8_raise_fault(c8_state* state,
+                                  uint8_t fault,
+                                  uint16_t addr) {
+    c8_record_fault(state, fault, addr);
+    state->registers.pc = C8_PC_ON_FAULT;
+}
+
+/**
+ * Reads a byte of memory.
+ *
+ * @param state CHIP-8 machine state.
+ * @param addr Address, less than `memory_size`.
+ * @return The byte.
+ */
+static inline uint8_t c8_read_byte(const c8_state* state, uint16_t addr) {
+    return state->pages[addr / C8_PAGE_SIZE]->bytes[addr % C8_PAGE_SIZE];
+}
+
+/**
+ * Reads the opcode at an address, like the interpreter fetches it.
+ *
+ * @param state CHIP-8 machine state.
+ * @param pc Address, less than `memory_size`.
+ * @return The opcode, with a zero low byte past the end of memory.
+ */
+static inline uint16_t c8_fetch(const c8_state* state, uint16_t pc) {
+    const uint8_t low = pc + 1 < state->config.memory_size
+        ? c8_read_byte(state, pc + 1)
+        : 0;
+    return c8_read_byte(state, pc) << 8 | low;
+}
+
+/**
+ * Gets the instruction cache entry of an address.
+ *
+ * @param state CHIP-8 machine state.
+ * @param pc Address, less than `memory_size`.
+ * @return The entry, C8_OP_UNDECODED if it's not cached.
+ */
+static inline const c8_insn* c8_cached_insn(const c8_state* state,
+                                            uint16_t pc) {
+    return &state->pages[pc / C8_PAGE_SIZE]->insns[pc % C8_PAGE_SIZE];
+}
+
+/**
+ * Reads memory. Bytes past the end of memory read as 0.
+ *
+ * @param state CHIP-8 machine state.
+ * @param addr First address.
+ * @param out Output buffer.
+ * @param size Number of bytes.
+ */
+void c8_read_memory(const c8_state* state,
+                    uint16_t addr,
+                    uint8_t* out,
+                    uint32_t size);
+
+/**
+ * Writes memory, copying shared pages first, and drops decoded and
+ * translated code overlapping the written bytes. Bytes past the end of
+ * memory are dropped.
+ *
+ * @param state CHIP-8 machine state.
+ * @param addr First address.
+ * @param data Bytes to write.
+ * @param size Number of bytes.
+ */
+void c8_write_memory(c8_state* state,
+                     uint16_t addr,
+                     const uint8_t* data,
+                     uint32_t size);
+
+/**
+ * Creates a page arena on the heap, for the machines of a pool.
+ *
+ * @param config Config of the machines.
+ * @param machines Machines to allocate pages for up front, two per page
+ * table entry each.
+ * @return Arena with a single reference, or NULL if out of memory.
+ */
+c8_page_arena* c8_page_arena_create(const c8_machine_config* config,
+                                    uint32_t machines);
+
+/**
+ * Drops a reference to a page arena, freeing it with the last one.
+ *
+ * @param arena Page arena, or NULL.
+ */
+void c8_page_arena_release(c8_page_arena* arena);
+
+/**
+ * Gets the storage size `c8_create_pooled()` and `c8_fork_pooled()` need:
+ * a state block without the arena.
+ *
+ * @param config CHIP-8 machine configuration.
+ * @return Size in bytes, alignment slack included.
+ */
+size_t c8_pooled_state_size(const c8_machine_config* config);
+
+/**
+ * Creates a machine taking its pages from an arena, see `c8_create_in()`.
+ *
+ * @param config CHIP-8 machine configuration, the one of the arena.
+ * @param arena Page arena.
+ * @param buffer Storage of `c8_pooled_state_size()` bytes.
+ * @return CHIP-8 machine state, or NULL if out of memory.
+ */
+c8_state* c8_create_pooled(const c8_machine_config* config,
+                           c8_page_arena* arena,
+                           void* buffer);
+
+/**
+ * Forks a machine with the memory and display views in the block, see
+ * `c8_fork_in()`.
+ *
+ * @param state CHIP-8 machine state.
+ * @param buffer Storage of `c8_pooled_state_size()` bytes.
+ * @return The fork.
+ */
+c8_state* c8_fork_pooled(c8_state* state, void* buffer);
+
+/// Keys of the packed display words, `c8_hash_key()` of their cells.
+extern uint64_t c8_hash_display_keys[C8_HASH_DISPLAY_WORDS];
+
+/**
+ * Builds the key tables of the state hash. Called by `c8_create_in()`, safe
+ * to call from several threads.
+ */
+void c8_hash_init(void);
+
+/**
+ * Gets the key of a state hash cell. The state hash is the sum of every
+ * cell value times its key.
+ *
+ * @param cell Cell, see `c8_hash_cells`.
+ * @return The key, always odd.
+ */
+uint64_t c8_hash_key(uint32_t cell);
+
+/**
+ * Gets the change of the state hash when memory bytes are overwritten.
+ *
+ * @param addr First address.
+ * @param old Bytes before the write.
+ * @param data Bytes written, or NULL for zeroes.
+ * @param size Number of bytes.
+ * @return Amount to add to the state hash.
+ */
+uint64_t c8_hash_memory_delta(uint16_t addr,
+                              const uint8_t* old,
+                              const uint8_t* data,
+                              uint32_t size);
+
+/**
+ * Decodes an opcode for the given machine.
+ *
+ * @param state CHIP-8 machine state.
+ * @param op Opcode.
+ * @return A decoded instruction.
+ */
+c8_insn c8_decode(const c8_state* state, uint16_t op);
+
+/**
+ * Creates a JIT compiler for the given machine.
+ *
+ * @param state CHIP-8 machine state.
+ * @return JIT compiler state or NULL if the host is not supported.
+ */
+c8_jit* c8_jit_create(const c8_state* state);
+
+/**
+ * Destroys a JIT compiler and releases translated code.
+ *
+ * @param jit JIT compiler state.
+ */
+void c8_jit_destroy(c8_jit* jit);
+
+/**
+ * Drops every translated block.
+ *
+ * @param jit JIT compiler state.
+ */
+void c8_jit_flush(c8_jit* jit);
+
+/**
+ * Drops translated blocks overlapping `size` bytes of memory starting at
+ * `addr`.
+ *
+ * @param jit JIT compiler state.
+ * @param addr First written address.
+ * @param size Number of written bytes.
+ */
+void c8_jit_invalidate(c8_jit* jit, uint16_t addr, uint16_t size);
+
+/**
+ * Runs a translated block starting at current PC, translating it first if
+ * needed.
+ *
+ * @param state CHIP-8 machine state.
+ * @param budget Maximum number of cycles the block may take.
+ * @return Number of executed cycles, or 0 if the block cannot be run and the
+ * interpreter has to execute the next instruction.
+ */
+uint32_t c8_jit_run(c8_state* state, uint32_t budget);
+
+#ifdef C8_ENABLE_PROFILER
+/**
+ * Counts an instruction executed from an undecoded or breakpoint cache
+ * entry, or a CALL or RET.
+ *
+ * @param state CHIP-8 machine state.
+ * @param pc Address of the instruction.
+ * @param kind Kind of the cache entry before execution.
+ */
+void c8_profile_count_slow(c8_state* state, uint16_t pc, uint8_t kind);
+
+/**
+ * Counts an executed instruction. Called after every interpreted step of a
+ * profiled machine.
+ *
+ * @param state CHIP-8 machine state.
+ * @param pc Address of the instruction.
+ * @param kind Kind of the cache entry before execution.
+ */
+static inline void c8_profile_count(c8_state* state,
+                                    uint16_t pc,
+                                    uint8_t kind) {
+    // CALL and RET also move to another call tree node
+    const uint64_t slow_kinds = (1ull << C8_OP_UNDECODED)
+        | (1ull << C8_OP_BREAK) | (1ull << C8_OP_CALL) | (1ull << C8_OP_RET);
+    if (((slow_kinds >> kind) & 1) != 0) {
+        c8_profile_count_slow(state, pc, kind);
+        return;
+    }
+
+    c8_profiler* profiler = state->profiler;
+    ++profiler->address_counts[pc];
+    ++profiler->counts.op_counts[kind];
+    ++*profiler->call_cycles;
+}
+
+/**
+ * Counts cycles spent blocked in FX0A.
+ *
+ * @param state CHIP-8 machine state.
+ * @param cycles Number of cycles.
+ */
+static inline void c8_profile_count_key_wait(c8_state* state,
+                                             uint32_t cycles) {
+    c8_profiler* profiler = state->profiler;
+    profiler->counts.key_wait_cycles += cycles;
+    *profiler->call_cycles += cycles;
+}
+#endif
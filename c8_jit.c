@@ -0,0 +1,636 @@
+#include "c8_internal.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <memory.h>
+
+/*
+ * Basic-block JIT compiler for x86-64 (System V ABI).
+ *
+ * A block is a run of instructions starting at some address and ending at
+ * the first instruction that transfers control (JP, CALL, RET, skips),
+ * may stall (DXYN, Fx0A) or writes memory (Fx33, Fx55). Register-only
+ * instructions are translated into native code, everything else is a call
+ * to the machine's instruction handler, so quirks are honored exactly as in
+ * the interpreter. Instructions the decoder routes to extension handlers or
+ * does not know are never translated; the block stops right before them.
+ *
+ * A block is run only if it fits into the remaining cycle budget, otherwise
+ * the interpreter executes the next instruction and the following one may
+ * start a shorter block. That keeps `cycles_per_frame` accounting exact.
+ */
+
+#if defined(__x86_64__) && !defined(_WIN32)
+    #define C8_JIT_SUPPORTED
+    #include <sys/mman.h>
+#endif
+
+#ifdef C8_JIT_SUPPORTED
+
+enum c8_jit_params {
+    C8_JIT_CODE_SIZE = 256 * 1024, ///< Size of code buffer, in bytes.
+    C8_JIT_MAX_BLOCKS = 4096, ///< Number of blocks in the block pool.
+    C8_JIT_MAX_INSNS = 16384, ///< Number of instructions in the insn pool.
+    C8_JIT_MAX_BLOCK_LENGTH = 32, ///< Max instructions per block.
+    C8_JIT_MAX_INSN_CODE = 64, ///< Max native code size per instruction.
+};
+
+typedef void (* c8_jit_fn)(c8_state* state);
+
+typedef struct c8_jit_block {
+    c8_jit_fn code; ///< Native code, or NULL if the block is not translated.
+    uint16_t begin; ///< Address of the first instruction.
+    uint16_t end; ///< Address past the last instruction.
+    uint16_t length; ///< Number of instructions.
+} c8_jit_block;
+
+struct c8_jit {
+    uint8_t* code;
+    uint32_t code_used;
+    c8_jit_block blocks[C8_JIT_MAX_BLOCKS];
+    uint32_t blocks_used;
+    c8_insn insns[C8_JIT_MAX_INSNS];
+    uint32_t insns_used;
+    c8_jit_block** entries; ///< Block starting at every memory address.
+    uint8_t* code_map; ///< Non-zero for every translated memory address.
+    uint16_t memory_size;
+};
+
+#pragma region x86-64 emitter
+
+enum c8_x86_reg8 {
+    C8_X86_AL = 0, C8_X86_CL = 1, C8_X86_DL = 2,
+};
+
+#define C8_JIT_REG(field)                                                      \
+    ((int32_t)(offsetof(c8_state, registers) + offsetof(c8_registers, field)))
+#define C8_JIT_V(x) (C8_JIT_REG(v) + (x))
+
+typedef struct c8_emitter {
+    uint8_t* p;
+} c8_emitter;
+
+static void c8_emit8(c8_emitter* e, uint8_t b) {
+    *e->p++ = b;
+}
+
+static void c8_emit16(c8_emitter* e, uint16_t w) {
+    memcpy(e->p, &w, 2);
+    e->p += 2;
+}
+
+static void c8_emit32(c8_emitter* e, uint32_t d) {
+    memcpy(e->p, &d, 4);
+    e->p += 4;
+}
+
+static void c8_emit64(c8_emitter* e, uint64_t q) {
+    memcpy(e->p, &q, 8);
+    e->p += 8;
+}
+
+/**
+ * Emits ModRM for `[rbx + disp32]` memory operand.
+ */
+static void c8_emit_mem(c8_emitter* e, uint8_t reg, int32_t disp) {
+    c8_emit8(e, 0x80 | (reg << 3) | 0x3);
+    c8_emit32(e, (uint32_t)disp);
+}
+
+/**
+ * mov r8, byte [rbx + disp]
+ */
+static void c8_emit_load8(c8_emitter* e, uint8_t reg, int32_t disp) {
+    c8_emit8(e, 0x8A);
+    c8_emit_mem(e, reg, disp);
+}
+
+/**
+ * mov byte [rbx + disp], r8
+ */
+static void c8_emit_store8(c8_emitter* e, int32_t disp, uint8_t reg) {
+    c8_emit8(e, 0x88);
+    c8_emit_mem(e, reg, disp);
+}
+
+/**
+ * mov byte [rbx + disp], imm8
+ */
+static void c8_emit_store8_imm(c8_emitter* e, int32_t disp, uint8_t imm) {
+    c8_emit8(e, 0xC6);
+    c8_emit_mem(e, 0, disp);
+    c8_emit8(e, imm);
+}
+
+/**
+ * mov word [rbx + disp], imm16
+ */
+static void c8_emit_store16_imm(c8_emitter* e, int32_t disp, uint16_t imm) {
+    c8_emit8(e, 0x66);
+    c8_emit8(e, 0xC7);
+    c8_emit_mem(e, 0, disp);
+    c8_emit16(e, imm);
+}
+
+/**
+ * Sets PC to `target_if_true` if the flags match `cc`, to `target` otherwise.
+ * `cc` is the low nibble of Jcc/SETcc/CMOVcc opcodes.
+ */
+static void c8_emit_select_pc(c8_emitter* e,
+                              uint8_t cc,
+                              uint16_t target_if_true,
+                              uint16_t target) {
+    // mov eax, target
+    c8_emit8(e, 0xB8);
+    c8_emit32(e, target);
+    // mov edx, target_if_true
+    c8_emit8(e, 0xBA);
+    c8_emit32(e, target_if_true);
+    // cmovcc eax, edx
+    c8_emit8(e, 0x0F);
+    c8_emit8(e, 0x40 | cc);
+    c8_emit8(e, 0xC2);
+    // mov word [rbx + pc], ax
+    c8_emit8(e, 0x66);
+    c8_emit8(e, 0x89);
+    c8_emit_mem(e, C8_X86_AL, C8_JIT_REG(pc));
+}
+
+enum c8_x86_cc {
+    C8_X86_CC_B = 0x2, C8_X86_CC_E = 0x4, C8_X86_CC_NE = 0x5,
+    C8_X86_CC_A = 0x7,
+};
+
+/**
+ * Emits a call to the machine's instruction handler.
+ */
+static void c8_emit_call(c8_emitter* e,
+                         const c8_state* state,
+                         const c8_insn* insn,
+                         uint16_t pc) {
+    c8_emit_store16_imm(e, C8_JIT_REG(pc), pc);
+    // mov rdi, rbx
+    c8_emit8(e, 0x48);
+    c8_emit8(e, 0x89);
+    c8_emit8(e, 0xDF);
+    // mov rsi, insn
+    c8_emit8(e, 0x48);
+    c8_emit8(e, 0xBE);
+    c8_emit64(e, (uint64_t)(uintptr_t)insn);
+    // mov rax, handler
+    c8_emit8(e, 0x48);
+    c8_emit8(e, 0xB8);
+    c8_emit64(e, (uint64_t)(uintptr_t)state->exec[insn->kind]);
+    // call rax
+    c8_emit8(e, 0xFF);
+    c8_emit8(e, 0xD0);
+}
+
+#pragma endregion
+
+/**
+ * Translates a register-only instruction into native code.
+ *
+ * @return false if the instruction has to go through its handler.
+ */
+static bool c8_jit_emit_native(c8_emitter* e,
+                               const c8_state* state,
+                               const c8_insn* insn,
+                               uint16_t pc) {
+    const uint32_t quirks = state->config.quirks;
+    const int32_t vx = C8_JIT_V(insn->x);
+    const int32_t vy = C8_JIT_V(insn->y);
+    const int32_t vf = C8_JIT_V(0xF);
+
+    switch (insn->kind) {
+        case C8_OP_SYS:
+            return true;
+        case C8_OP_JP_NNN:
+            c8_emit_store16_imm(e, C8_JIT_REG(pc), insn->nnn);
+            return true;
+        case C8_OP_SE_VX_NN:
+        case C8_OP_SNE_VX_NN:
+            // cmp byte [vx], nn
+            c8_emit8(e, 0x80);
+            c8_emit_mem(e, 7, vx);
+            c8_emit8(e, insn->nn);
+            c8_emit_select_pc(
+                e,
+                insn->kind == C8_OP_SE_VX_NN ? C8_X86_CC_E : C8_X86_CC_NE,
+                pc + 4,
+                pc + 2
+            );
+            return true;
+        case C8_OP_SE_VX_VY:
+        case C8_OP_SNE_VX_VY:
+            c8_emit_load8(e, C8_X86_AL, vx);
+            // cmp al, byte [vy]
+            c8_emit8(e, 0x3A);
+            c8_emit_mem(e, C8_X86_AL, vy);
+            c8_emit_select_pc(
+                e,
+                insn->kind == C8_OP_SE_VX_VY ? C8_X86_CC_E : C8_X86_CC_NE,
+                pc + 4,
+                pc + 2
+            );
+            return true;
+        case C8_OP_LD_VX_NN:
+            c8_emit_store8_imm(e, vx, insn->nn);
+            return true;
+        case C8_OP_ADD_VX_NN:
+            // add byte [vx], nn
+            c8_emit8(e, 0x80);
+            c8_emit_mem(e, 0, vx);
+            c8_emit8(e, insn->nn);
+            return true;
+        case C8_OP_LD_VX_VY:
+            c8_emit_load8(e, C8_X86_AL, vy);
+            c8_emit_store8(e, vx, C8_X86_AL);
+            return true;
+        case C8_OP_OR:
+        case C8_OP_AND:
+        case C8_OP_XOR:
+            c8_emit_load8(e, C8_X86_AL, vy);
+            // or/and/xor byte [vx], al
+            c8_emit8(e, insn->kind == C8_OP_OR
+                ? 0x08
+                : insn->kind == C8_OP_AND ? 0x20 : 0x30);
+            c8_emit_mem(e, C8_X86_AL, vx);
+            if ((quirks & C8_QUIRK_VF_RESET) != 0) {
+                c8_emit_store8_imm(e, vf, 0);
+            }
+            return true;
+        case C8_OP_ADD_VX_VY:
+            c8_emit_load8(e, C8_X86_AL, vx);
+            // add al, byte [vy]
+            c8_emit8(e, 0x02);
+            c8_emit_mem(e, C8_X86_AL, vy);
+            // setb cl
+            c8_emit8(e, 0x0F);
+            c8_emit8(e, 0x90 | C8_X86_CC_B);
+            c8_emit8(e, 0xC1);
+            c8_emit_store8(e, vx, C8_X86_AL);
+            c8_emit_store8(e, vf, C8_X86_CL);
+            return true;
+        case C8_OP_SUB:
+        case C8_OP_SUBN:
+            // VF is set if minuend is strictly greater than subtrahend
+            c8_emit_load8(e, C8_X86_AL, insn->kind == C8_OP_SUB ? vx : vy);
+            c8_emit_load8(e, C8_X86_DL, insn->kind == C8_OP_SUB ? vy : vx);
+            // cmp al, dl
+            c8_emit8(e, 0x38);
+            c8_emit8(e, 0xD0);
+            // seta cl
+            c8_emit8(e, 0x0F);
+            c8_emit8(e, 0x90 | C8_X86_CC_A);
+            c8_emit8(e, 0xC1);
+            // sub al, dl
+            c8_emit8(e, 0x28);
+            c8_emit8(e, 0xD0);
+            c8_emit_store8(e, vx, C8_X86_AL);
+            c8_emit_store8(e, vf, C8_X86_CL);
+            return true;
+        case C8_OP_SHR:
+        case C8_OP_SHL:
+            c8_emit_load8(
+                e,
+                C8_X86_AL,
+                (quirks & C8_QUIRK_SHIFT) != 0 ? vx : vy
+            );
+            // mov cl, al
+            c8_emit8(e, 0x88);
+            c8_emit8(e, 0xC1);
+            if (insn->kind == C8_OP_SHR) {
+                // and cl, 1
+                c8_emit8(e, 0x80);
+                c8_emit8(e, 0xE1);
+                c8_emit8(e, 0x01);
+                // shr al, 1
+                c8_emit8(e, 0xD0);
+                c8_emit8(e, 0xE8);
+            }
+            else {
+                // shr cl, 7
+                c8_emit8(e, 0xC0);
+                c8_emit8(e, 0xE9);
+                c8_emit8(e, 0x07);
+                // add al, al
+                c8_emit8(e, 0x00);
+                c8_emit8(e, 0xC0);
+            }
+            c8_emit_store8(e, vx, C8_X86_AL);
+            c8_emit_store8(e, vf, C8_X86_CL);
+            return true;
+        case C8_OP_LD_I_NNN:
+            c8_emit_store16_imm(e, C8_JIT_REG(i), insn->nnn);
+            return true;
+        case C8_OP_LD_VX_DT:
+            c8_emit_load8(e, C8_X86_AL, C8_JIT_REG(dt));
+            c8_emit_store8(e, vx, C8_X86_AL);
+            return true;
+        case C8_OP_LD_DT_VX:
+            c8_emit_load8(e, C8_X86_AL, vx);
+            c8_emit_store8(e, C8_JIT_REG(dt), C8_X86_AL);
+            return true;
+        case C8_OP_ADD_I_VX:
+            // movzx eax, byte [vx]
+            c8_emit8(e, 0x0F);
+            c8_emit8(e, 0xB6);
+            c8_emit_mem(e, C8_X86_AL, vx);
+            // add ax, word [i]
+            c8_emit8(e, 0x66);
+            c8_emit8(e, 0x03);
+            c8_emit_mem(e, C8_X86_AL, C8_JIT_REG(i));
+            // cmp ax, 0xFFF
+            c8_emit8(e, 0x66);
+            c8_emit8(e, 0x3D);
+            c8_emit16(e, 0x0FFF);
+            // seta cl
+            c8_emit8(e, 0x0F);
+            c8_emit8(e, 0x90 | C8_X86_CC_A);
+            c8_emit8(e, 0xC1);
+            // and ax, 0xFFF
+            c8_emit8(e, 0x66);
+            c8_emit8(e, 0x25);
+            c8_emit16(e, 0x0FFF);
+            // mov word [i], ax
+            c8_emit8(e, 0x66);
+            c8_emit8(e, 0x89);
+            c8_emit_mem(e, C8_X86_AL, C8_JIT_REG(i));
+            c8_emit_store8(e, vf, C8_X86_CL);
+            return true;
+        case C8_OP_LD_I_FONT_VX:
+            // movzx eax, byte [vx]
+            c8_emit8(e, 0x0F);
+            c8_emit8(e, 0xB6);
+            c8_emit_mem(e, C8_X86_AL, vx);
+            // and eax, 0xF
+            c8_emit8(e, 0x83);
+            c8_emit8(e, 0xE0);
+            c8_emit8(e, 0x0F);
+            // lea eax, [rax + rax * 4 + font]
+            c8_emit8(e, 0x8D);
+            c8_emit8(e, 0x84);
+            c8_emit8(e, 0x80);
+            c8_emit32(e, C8_MEM_FONT_OFFSET);
+            // mov word [i], ax
+            c8_emit8(e, 0x66);
+            c8_emit8(e, 0x89);
+            c8_emit_mem(e, C8_X86_AL, C8_JIT_REG(i));
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Checks if an instruction ends a block. Besides control transfers and
+ * memory writes, instructions raising `c8_run()` stop events end blocks,
+ * so that a run stops right after them.
+ */
+static bool c8_jit_ends_block(uint8_t kind) {
+    switch (kind) {
+        case C8_OP_CLS:
+        case C8_OP_LD_ST_VX:
+        case C8_OP_RET:
+        case C8_OP_JP_NNN:
+        case C8_OP_CALL:
+        case C8_OP_SE_VX_NN:
+        case C8_OP_SNE_VX_NN:
+        case C8_OP_SE_VX_VY:
+        case C8_OP_SNE_VX_VY:
+        case C8_OP_JP_V0_NNN:
+        case C8_OP_DRW:
+        case C8_OP_SKP:
+        case C8_OP_SKNP:
+        case C8_OP_LD_VX_KEY:
+        case C8_OP_BCD:
+        case C8_OP_LD_I_VX:
+        case C8_OP_LD_VX_I:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Checks if an instruction can be a part of a block at all.
+ */
+static bool c8_jit_can_translate(uint8_t kind) {
+    return kind != C8_OP_UNDECODED
+        && kind != C8_OP_ILLEGAL
+        && kind != C8_OP_EXT;
+}
+
+static bool c8_jit_unprotect(c8_jit* jit) {
+    return mprotect(jit->code, C8_JIT_CODE_SIZE, PROT_READ | PROT_WRITE) == 0;
+}
+
+static bool c8_jit_protect(c8_jit* jit) {
+    return mprotect(jit->code, C8_JIT_CODE_SIZE, PROT_READ | PROT_EXEC) == 0;
+}
+
+/**
+ * Translates a block starting at `pc`.
+ *
+ * @return A new block. Its `code` is NULL if nothing could be translated.
+ */
+static c8_jit_block* c8_jit_compile(c8_state* state, uint16_t pc) {
+    c8_jit* jit = state->jit;
+    const uint16_t memory_size = jit->memory_size;
+
+    const uint32_t max_code = C8_JIT_MAX_BLOCK_LENGTH * C8_JIT_MAX_INSN_CODE;
+    if (jit->blocks_used == C8_JIT_MAX_BLOCKS
+        || jit->insns_used + C8_JIT_MAX_BLOCK_LENGTH > C8_JIT_MAX_INSNS
+        || jit->code_used + max_code > C8_JIT_CODE_SIZE) {
+        c8_jit_flush(jit);
+    }
+
+    c8_jit_block* block = &jit->blocks[jit->blocks_used++];
+    block->code = nullptr;
+    block->begin = pc;
+    block->length = 0;
+
+    if (!c8_jit_unprotect(jit)) {
+        block->end = pc + 2;
+        return block;
+    }
+
+    c8_emitter e = { .p = jit->code + jit->code_used };
+    uint8_t* const entry = e.p;
+
+    // push rbx; mov rbx, rdi
+    c8_emit8(&e, 0x53);
+    c8_emit8(&e, 0x48);
+    c8_emit8(&e, 0x89);
+    c8_emit8(&e, 0xFB);
+
+    uint16_t addr = pc;
+    bool pc_set = false;
+    while (block->length < C8_JIT_MAX_BLOCK_LENGTH
+        && addr + 1 < memory_size) {
+        const uint16_t op = c8_fetch(state, addr);
+        const c8_insn decoded = c8_decode(state, op);
+        if (!c8_jit_can_translate(decoded.kind)) {
+            break;
+        }
+
+        c8_insn* insn = &jit->insns[jit->insns_used++];
+        *insn = decoded;
+
+        if (!c8_jit_emit_native(&e, state, insn, addr)) {
+            c8_emit_call(&e, state, insn, addr);
+        }
+
+        ++block->length;
+        addr += 2;
+
+        if (c8_jit_ends_block(insn->kind)) {
+            pc_set = true;
+            break;
+        }
+    }
+
+    if (block->length == 0) {
+        c8_jit_protect(jit);
+        block->end = pc + 2;
+        return block;
+    }
+
+    if (!pc_set) {
+        c8_emit_store16_imm(&e, C8_JIT_REG(pc), addr);
+    }
+
+    // pop rbx; ret
+    c8_emit8(&e, 0x5B);
+    c8_emit8(&e, 0xC3);
+
+    if (!c8_jit_protect(jit)) {
+        block->length = 0;
+        block->end = pc + 2;
+        return block;
+    }
+
+    jit->code_used += (uint32_t)(e.p - entry);
+    block->code = (c8_jit_fn)(void*)entry;
+    block->end = addr;
+
+    return block;
+}
+
+c8_jit* c8_jit_create(const c8_state* state) {
+    c8_jit* jit = calloc(1, sizeof(c8_jit));
+    if (jit == nullptr) {
+        return nullptr;
+    }
+
+    jit->memory_size = state->config.memory_size;
+    jit->code = mmap(nullptr,
+                     C8_JIT_CODE_SIZE,
+                     PROT_READ | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1,
+                     0);
+    jit->entries = calloc(jit->memory_size, sizeof(c8_jit_block*));
+    jit->code_map = calloc(jit->memory_size, 1);
+
+    if (jit->code == MAP_FAILED
+        || jit->entries == nullptr
+        || jit->code_map == nullptr) {
+        if (jit->code == MAP_FAILED) {
+            jit->code = nullptr;
+        }
+        c8_jit_destroy(jit);
+        return nullptr;
+    }
+
+    return jit;
+}
+
+void c8_jit_destroy(c8_jit* jit) {
+    if (jit == nullptr) {
+        return;
+    }
+
+    if (jit->code != nullptr) {
+        munmap(jit->code, C8_JIT_CODE_SIZE);
+    }
+    free(jit->entries);
+    free(jit->code_map);
+    free(jit);
+}
+
+void c8_jit_flush(c8_jit* jit) {
+    jit->code_used = 0;
+    jit->blocks_used = 0;
+    jit->insns_used = 0;
+    memset(jit->entries, 0, jit->memory_size * sizeof(c8_jit_block*));
+    memset(jit->code_map, 0, jit->memory_size);
+}
+
+void c8_jit_invalidate(c8_jit* jit, uint16_t addr, uint16_t size) {
+    const uint32_t end = C8_MIN((uint32_t)addr + size, jit->memory_size);
+
+    bool translated = false;
+    for (uint32_t a = addr; a < end; ++a) {
+        translated |= jit->code_map[a] != 0;
+    }
+    if (!translated) {
+        return;
+    }
+
+    const uint32_t max_bytes = C8_JIT_MAX_BLOCK_LENGTH * 2;
+    const uint32_t begin = addr > max_bytes ? addr - max_bytes : 0;
+    for (uint32_t a = begin; a < end; ++a) {
+        const c8_jit_block* block = jit->entries[a];
+        if (block != nullptr && block->begin < end && block->end > addr) {
+            jit->entries[a] = nullptr;
+        }
+    }
+}
+
+uint32_t c8_jit_run(c8_state* state, uint32_t budget) {
+    c8_jit* jit = state->jit;
+    const uint16_t pc = state->registers.pc;
+
+    c8_jit_block* block = jit->entries[pc];
+    if (block == nullptr) {
+        block = c8_jit_compile(state, pc);
+        jit->entries[pc] = block;
+        const uint16_t end = C8_MIN(block->end, jit->memory_size);
+        memset(jit->code_map + pc, 1, end - pc);
+    }
+
+    if (block->code == nullptr || block->length > budget) {
+        return 0;
+    }
+
+    block->code(state);
+
+    // Only the last instruction of a block can move PC anywhere
+    if (state->registers.pc >= state->config.memory_size) {
+        c8_raise_fault(state, C8_FAULT_PC_OUT_OF_BOUNDS, block->end - 2);
+    }
+
+    return block->length;
+}
+
+#else
+
+c8_jit* c8_jit_create(const c8_state* state) {
+    return nullptr;
+}
+
+void c8_jit_destroy(c8_jit* jit) {
+}
+
+void c8_jit_flush(c8_jit* jit) {
+}
+
+void c8_jit_invalidate(c8_jit* jit, uint16_t addr, uint16_t size) {
+}
+
+uint32_t c8_jit_run(c8_state* state, uint32_t budget) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,264 @@
+#include "c8_movie.h"
+#include <stdlib.h>
+
+/*
+ * Fields use host byte order, like snapshots.
+ */
+
+enum c8_movie_params {
+    C8_MOVIE_MAGIC = 0x564D3843, ///< "C8MV" in little endian.
+    C8_MOVIE_VERSION = 1,
+    C8_MOVIE_RECORD_FRAME = 1,
+    C8_MOVIE_RECORD_RESET = 2,
+    C8_MOVIE_RECORD_END = 3, ///< Followed by the final state hash.
+};
+
+typedef struct c8_movie_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t rom_hash;
+    uint32_t rom_size;
+    uint32_t seed; ///< RNG seed right after the ROM was loaded.
+    uint32_t quirks;
+    uint16_t memory_size;
+    uint16_t cycles_per_frame;
+    uint8_t screen_width;
+    uint8_t screen_height;
+    uint8_t engine;
+    uint8_t reserved;
+} c8_movie_header;
+
+typedef struct c8_movie_record {
+    uint32_t cycles;
+    float delta_time;
+    uint16_t keys;
+    uint8_t type;
+    uint8_t reserved;
+} c8_movie_record;
+
+struct c8_movie_writer {
+    FILE* stream;
+};
+
+/**
+ * FNV-1a hash.
+ */
+static uint64_t c8_movie_hash(const uint8_t* data, size_t size) {
+    uint64_t h = UINT64_C(0xCBF29CE484222325);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= data[i];
+        h *= UINT64_C(0x100000001B3);
+    }
+    return h;
+}
+
+/**
+ * Hashes the snapshot of a machine, so everything a snapshot restores is
+ * covered.
+ *
+ * @return false if out of memory.
+ */
+static bool c8_movie_hash_state(const c8_state* state, uint64_t* hash) {
+    const size_t size = c8_snapshot_size(state);
+    uint8_t* snapshot = malloc(size);
+    if (snapshot == nullptr) {
+        return false;
+    }
+
+    c8_snapshot_save(state, snapshot, size);
+    *hash = c8_movie_hash(snapshot, size);
+    free(snapshot);
+    return true;
+}
+
+static void c8_movie_set_keys(c8_state* state, uint16_t keys) {
+    for (uint8_t key = 0; key < C8_KEY_MAX; ++key) {
+        if ((keys >> key) & 1) {
+            c8_press_key(state, key);
+        }
+        else {
+            c8_release_key(state, key);
+        }
+    }
+}
+
+static bool c8_movie_write_record(c8_movie_writer* writer,
+                                  uint8_t type,
+                                  uint32_t cycles,
+                                  float delta_time,
+                                  uint16_t keys) {
+    const c8_movie_record record = {
+        .cycles = cycles,
+        .delta_time = delta_time,
+        .keys = keys,
+        .type = type,
+        .reserved = 0,
+    };
+    return fwrite(&record, sizeof(record), 1, writer->stream) == 1;
+}
+
+c8_movie_writer* c8_movie_writer_create(FILE* stream,
+                                        c8_state* state,
+                                        const uint8_t* rom,
+                                        uint16_t rom_size) {
+    if (stream == nullptr || state == nullptr || rom == nullptr) {
+        return nullptr;
+    }
+
+    const c8_machine_config* config = c8_get_machine_config(state);
+    const c8_movie_header header = {
+        .magic = C8_MOVIE_MAGIC,
+        .version = C8_MOVIE_VERSION,
+        .header_size = sizeof(c8_movie_header),
+        .rom_hash = c8_movie_hash(rom, rom_size),
+        .rom_size = rom_size,
+        .seed = c8_get_rng_seed(state),
+        .quirks = config->quirks,
+        .memory_size = config->memory_size,
+        .cycles_per_frame = config->cycles_per_frame,
+        .screen_width = config->screen_width,
+        .screen_height = config->screen_height,
+        .engine = config->engine,
+        .reserved = 0,
+    };
+    if (fwrite(&header, sizeof(header), 1, stream) != 1) {
+        return nullptr;
+    }
+
+    c8_movie_writer* writer = malloc(sizeof(c8_movie_writer));
+    if (writer == nullptr) {
+        return nullptr;
+    }
+    writer->stream = stream;
+    return writer;
+}
+
+bool c8_movie_write_frame(c8_movie_writer* writer,
+                          uint32_t cycles,
+                          float delta_time,
+                          uint16_t keys) {
+    if (writer == nullptr) {
+        return false;
+    }
+
+    return c8_movie_write_record(
+        writer,
+        C8_MOVIE_RECORD_FRAME,
+        cycles,
+        delta_time,
+        keys
+    );
+}
+
+bool c8_movie_write_reset(c8_movie_writer* writer) {
+    if (writer == nullptr) {
+        return false;
+    }
+
+    return c8_movie_write_record(writer, C8_MOVIE_RECORD_RESET, 0, 0.f, 0);
+}
+
+bool c8_movie_writer_finish(c8_movie_writer* writer, const c8_state* state) {
+    if (writer == nullptr) {
+        return false;
+    }
+
+    uint64_t hash = 0;
+    bool ok = c8_movie_hash_state(state, &hash);
+    ok = ok && c8_movie_write_record(writer, C8_MOVIE_RECORD_END, 0, 0.f, 0);
+    ok = ok && fwrite(&hash, sizeof(hash), 1, writer->stream) == 1;
+    ok = ok && fflush(writer->stream) == 0;
+
+    free(writer);
+    return ok;
+}
+
+c8_movie_replay_result c8_movie_replay(FILE* stream,
+                                       const uint8_t* rom,
+                                       uint16_t rom_size) {
+    c8_movie_replay_result result = {
+        .status = C8_MOVIE_IO_ERROR,
+        .frames = 0,
+        .cycles = 0,
+        .hash = 0,
+        .expected_hash = 0,
+    };
+    if (stream == nullptr || rom == nullptr) {
+        return result;
+    }
+
+    c8_movie_header header;
+    if (fread(&header, sizeof(header), 1, stream) != 1) {
+        return result;
+    }
+
+    if (header.magic != C8_MOVIE_MAGIC
+        || header.version != C8_MOVIE_VERSION
+        || header.header_size != sizeof(c8_movie_header)
+        || header.memory_size < 0x200 + header.rom_size
+        || header.screen_width == 0
+        || header.screen_height == 0
+        || header.engine > C8_ENGINE_JIT) {
+        result.status = C8_MOVIE_BAD_FORMAT;
+        return result;
+    }
+
+    if (header.rom_size != rom_size
+        || header.rom_hash != c8_movie_hash(rom, rom_size)) {
+        result.status = C8_MOVIE_ROM_MISMATCH;
+        return result;
+    }
+
+    c8_machine_config config = c8_get_default_machine_config();
+    config.quirks = header.quirks;
+    config.memory_size = header.memory_size;
+    config.cycles_per_frame = header.cycles_per_frame;
+    config.screen_width = header.screen_width;
+    config.screen_height = header.screen_height;
+    config.engine = header.engine;
+
+    c8_state* state = c8_create(config);
+    if (state == nullptr) {
+        return result;
+    }
+    c8_set_rng_seed(state, header.seed);
+    c8_load_rom(state, rom, rom_size);
+
+    result.status = C8_MOVIE_TRUNCATED;
+    c8_movie_record record;
+    while (fread(&record, sizeof(record), 1, stream) == 1) {
+        if (record.type == C8_MOVIE_RECORD_FRAME) {
+            const c8_run_result run =
+                c8_run(state, record.cycles, C8_STOP_BUDGET);
+            c8_update_timers(state, record.delta_time);
+            c8_movie_set_keys(state, record.keys);
+            result.cycles += run.cycles;
+            ++result.frames;
+        }
+        else if (record.type == C8_MOVIE_RECORD_RESET) {
+            c8_reset_to_pristine(state);
+        }
+        else if (record.type == C8_MOVIE_RECORD_END) {
+            if (fread(&result.expected_hash,
+                      sizeof(result.expected_hash),
+                      1,
+                      stream) == 1) {
+                result.status = C8_MOVIE_IO_ERROR;
+                if (c8_movie_hash_state(state, &result.hash)) {
+                    result.status = result.hash == result.expected_hash
+                        ? C8_MOVIE_OK
+                        : C8_MOVIE_HASH_MISMATCH;
+                }
+            }
+            break;
+        }
+        else {
+            result.status = C8_MOVIE_BAD_FORMAT;
+            break;
+        }
+    }
+
+    c8_destroy(state);
+    return result;
+}
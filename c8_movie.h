@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "c8.h"
+
+/*
+ * Input movies: everything needed to replay a session deterministically.
+ *
+ * A movie is a header with the machine config, the RNG seed and a hash of
+ * the ROM, followed by one record per emulated frame (cycles run, timer
+ * delta and pressed keys) and an end record with a hash of the final state.
+ * Records are appended as the session goes, so a movie can be streamed
+ * straight to a file.
+ */
+
+/**
+ * Movie replay status.
+ */
+typedef enum c8_movie_status
+#ifndef C23_COMPAT_NO_ENUM_TYPES
+    : uint32_t
+#endif
+{
+    C8_MOVIE_OK = 0, ///< Replayed, the final state matches.
+    C8_MOVIE_IO_ERROR = 1, ///< The stream could not be read, or out of memory.
+    C8_MOVIE_BAD_FORMAT = 2, ///< Not a supported movie, or a corrupt record.
+    C8_MOVIE_ROM_MISMATCH = 3, ///< The movie was recorded with another ROM.
+    C8_MOVIE_TRUNCATED = 4, ///< The stream ends before the end record.
+    C8_MOVIE_HASH_MISMATCH = 5, ///< The final state differs.
+} c8_movie_status;
+
+/**
+ * Movie replay result.
+ */
+typedef struct c8_movie_replay_result {
+    uint32_t status; ///< See `c8_movie_status`.
+    uint32_t frames; ///< Replayed frames.
+    uint64_t cycles; ///< Executed cycles.
+    uint64_t hash; ///< Final state hash.
+    uint64_t expected_hash; ///< Final state hash stored in the movie.
+} c8_movie_replay_result;
+
+/**
+ * Movie writer state.
+ */
+typedef struct c8_movie_writer c8_movie_writer;
+
+/**
+ * Starts recording a movie.
+ *
+ * Must be called right after `c8_load_rom()`: the movie stores the machine
+ * config and the current RNG seed, and replay starts from a freshly loaded
+ * machine.
+ *
+ * @param stream Output stream, stays open after the movie is finished.
+ * @param state CHIP-8 machine state.
+ * @param rom ROM loaded into the machine.
+ * @param rom_size ROM size.
+ * @return Movie writer, or NULL if the header could not be written or out
+ * of memory.
+ */
+c8_movie_writer* c8_movie_writer_create(FILE* stream,
+                                        c8_state* state,
+                                        const uint8_t* rom,
+                                        uint16_t rom_size);
+
+/**
+ * Records an emulated frame.
+ *
+ * Replay runs `cycles` cycles, then updates the timers with `delta_time`,
+ * then sets the key states to `keys`.
+ *
+ * @param writer Movie writer.
+ * @param cycles Cycles executed in the frame, see `c8_run_result`.
+ * @param delta_time Time passed to `c8_update_timers()`.
+ * @param keys Pressed keys after the frame, bit N is key N.
+ * @return false on a write error.
+ */
+bool c8_movie_write_frame(c8_movie_writer* writer,
+                          uint32_t cycles,
+                          float delta_time,
+                          uint16_t keys);
+
+/**
+ * Records a `c8_reset()` followed by loading the same ROM again.
+ *
+ * @param writer Movie writer.
+ * @return false on a write error.
+ */
+bool c8_movie_write_reset(c8_movie_writer* writer);
+
+/**
+ * Writes the end record with a hash of the final state and destroys the
+ * writer.
+ *
+ * @param writer Movie writer.
+ * @param state CHIP-8 machine state.
+ * @return false on a write error or out of memory.
+ */
+bool c8_movie_writer_finish(c8_movie_writer* writer, const c8_state* state);
+
+/**
+ * Replays a movie on a new machine as fast as possible.
+ *
+ * @param stream Input stream positioned at the movie header.
+ * @param rom ROM the movie was recorded with.
+ * @param rom_size ROM size.
+ * @return Replay result.
+ */
+c8_movie_replay_result c8_movie_replay(FILE* stream,
+                                       const uint8_t* rom,
+                                       uint16_t rom_size);
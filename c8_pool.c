@@ -0,0 +1,130 @@
+#include "c8_pool.h"
+#include "c8_internal.h"
+#include <stdlib.h>
+
+/*
+ * Slots are `c8_pooled_state_size()` bytes apart in the slab, machines in
+ * them take their pages from the arena of the pool. Free slots form a
+ * stack, so the most recently released one, still warm in the cache, is
+ * acquired next.
+ */
+
+struct c8_pool {
+    c8_machine_config config;
+    c8_page_arena* arena; ///< Pages of the machines acquired from the pool.
+    uint8_t* slab;
+    size_t slot_size;
+    uint32_t capacity;
+    c8_state** states; ///< Machine of every slot, NULL if free.
+    uint32_t* free_slots; ///< Stack of free slot indices.
+    uint32_t free_count;
+};
+
+c8_pool* c8_pool_create(c8_machine_config config, uint32_t capacity) {
+    if (capacity == 0) {
+        return nullptr;
+    }
+
+    c8_pool* pool = calloc(1, sizeof(c8_pool));
+    if (pool == nullptr) {
+        return nullptr;
+    }
+
+    pool->config = config;
+    pool->slot_size = c8_pooled_state_size(&config);
+    pool->capacity = capacity;
+    pool->arena = c8_page_arena_create(&config, capacity);
+    pool->slab = malloc(pool->slot_size * capacity);
+    pool->states = calloc(capacity, sizeof(c8_state*));
+    pool->free_slots = calloc(capacity, sizeof(uint32_t));
+    if (pool->arena == nullptr || pool->slab == nullptr
+        || pool->states == nullptr || pool->free_slots == nullptr) {
+        c8_pool_destroy(pool);
+        return nullptr;
+    }
+
+    for (uint32_t i = 0; i < capacity; ++i) {
+        pool->free_slots[i] = capacity - 1 - i;
+    }
+    pool->free_count = capacity;
+    return pool;
+}
+
+void c8_pool_destroy(c8_pool* pool) {
+    if (pool == nullptr) {
+        return;
+    }
+
+    if (pool->states != nullptr) {
+        for (uint32_t i = 0; i < pool->capacity; ++i) {
+            c8_destroy(pool->states[i]);
+        }
+    }
+    c8_page_arena_release(pool->arena);
+    free(pool->slab);
+    free(pool->states);
+    free(pool->free_slots);
+    free(pool);
+}
+
+/**
+ * Creates a machine in a free slot, by forking `parent` or from scratch.
+ */
+static c8_state* c8_pool_take(c8_pool* pool, c8_state* parent) {
+    if (pool == nullptr || pool->free_count == 0) {
+        return nullptr;
+    }
+
+    const uint32_t slot = pool->free_slots[--pool->free_count];
+    uint8_t* storage = pool->slab + slot * pool->slot_size;
+    c8_state* state = parent != nullptr
+        ? c8_fork_pooled(parent, storage)
+        : c8_create_pooled(&pool->config, pool->arena, storage);
+    if (state == nullptr) {
+        ++pool->free_count;
+        return nullptr;
+    }
+
+    pool->states[slot] = state;
+    return state;
+}
+
+c8_state* c8_pool_acquire(c8_pool* pool) {
+    return c8_pool_take(pool, nullptr);
+}
+
+c8_state* c8_pool_fork(c8_pool* pool, c8_state* state) {
+    if (state == nullptr) {
+        return nullptr;
+    }
+
+    return c8_pool_take(pool, state);
+}
+
+void c8_pool_release(c8_pool* pool, c8_state* state) {
+    if (pool == nullptr || state == nullptr) {
+        return;
+    }
+
+    // The state sits at the aligned start of its slot
+    const uint8_t* address = (const uint8_t*)state;
+    if (address < pool->slab) {
+        return;
+    }
+    const size_t slot = (size_t)(address - pool->slab) / pool->slot_size;
+    if (slot >= pool->capacity || pool->states[slot] != state) {
+        return;
+    }
+
+    c8_destroy(state);
+    pool->states[slot] = nullptr;
+    pool->free_slots[pool->free_count++] = (uint32_t)slot;
+}
+
+uint32_t c8_pool_used(const c8_pool* pool) {
+    if (pool == nullptr) {
+        return 0;
+    }
+
+    return pool->capacity - pool->free_count;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "c8.h"
+
+/*
+ * Pool of machines sharing one config, for harnesses that create and
+ * destroy machines at high rates.
+ *
+ * All machines live in one slab allocated up front, and take their pages
+ * from a free list of the pool holding enough for every slot, so acquiring
+ * and releasing them never touches the heap. Neither does forking a pool
+ * machine into the pool: forks copy pages from the same free list, which
+ * only grows on the heap once forks made with `c8_fork()` use it too.
+ * Forks of other machines take their pages from their parent. A pool is
+ * not thread safe, give every thread its own.
+ */
+
+/**
+ * Machine pool.
+ */
+typedef struct c8_pool c8_pool;
+
+/**
+ * Creates a pool.
+ *
+ * @param config Config of every machine.
+ * @param capacity Maximum number of machines acquired at once.
+ * @return Pool, or NULL if `capacity` is 0 or out of memory.
+ */
+c8_pool* c8_pool_create(c8_machine_config config, uint32_t capacity);
+
+/**
+ * Destroys a pool and every machine still acquired from it.
+ *
+ * @param pool Pool.
+ */
+void c8_pool_destroy(c8_pool* pool);
+
+/**
+ * Creates a machine in a free slot of the pool.
+ *
+ * @param pool Pool.
+ * @return Freshly reset machine, or NULL if all slots are in use or out of
+ * memory.
+ */
+c8_state* c8_pool_acquire(c8_pool* pool);
+
+/**
+ * Forks a machine into a free slot of the pool, see `c8_fork()`.
+ *
+ * @param pool Pool.
+ * @param state Machine with the config of the pool, from the pool or not.
+ * @return The fork, or NULL if all slots are in use.
+ */
+c8_state* c8_pool_fork(c8_pool* pool, c8_state* state);
+
+/**
+ * Destroys a machine acquired from the pool and frees its slot.
+ *
+ * @param pool Pool.
+ * @param state Machine acquired from `pool`.
+ */
+void c8_pool_release(c8_pool* pool, c8_state* state);
+
+/**
+ * Gets the number of machines acquired and not released yet.
+ *
+ * @param pool Pool.
+ * @return Number of machines in use.
+ */
+uint32_t c8_pool_used(const c8_pool* pool);
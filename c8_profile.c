@@ -0,0 +1,589 @@
+#include "c8_profile.h"
+#include "c8_internal.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Guest execution profiler, see c8_profile.h.
+ *
+ * `c8_step()` counts every instruction of a profiled machine, see
+ * `c8_profile_count()`. DXYN and jumps get wrapped handlers, the same way
+ * watchpoints swap memory accessing handlers, so the per step path stays
+ * short. Loops are found from backward jumps: the jump address and its last
+ * target bound the loop, and its cycles are the executions of the addresses
+ * in between.
+ *
+ * Cycles are also attributed to the current guest call stack, a node of a
+ * call tree. CALL and RET take the slow counting path, which counts the step
+ * on the node it ran in and then moves to the callee or the caller. Whenever
+ * the guest stack depth doesn't match the node, for example after a snapshot
+ * load, the path is rebuilt from the return addresses on the guest stack:
+ * every one of them points at the CALL that made the frame.
+ */
+
+enum c8_profile_params {
+    C8_PROFILE_DUMP_ADDRESSES = 16, ///< Hottest addresses in a dump.
+    C8_PROFILE_DUMP_LOOPS = 8, ///< Hottest loops in a dump.
+    C8_PROFILE_MAX_CALLS = 4096, ///< Call tree nodes, deeper stacks are cut.
+};
+
+static_assert(C8_PROFILE_OP_CLASSES == C8_OP_KIND_MAX,
+              "opcode classes must match decoded instruction kinds");
+
+static const char* const C8_PROFILE_OP_CLASS_NAMES[C8_OP_KIND_MAX] = {
+    [C8_OP_UNDECODED] = "undecoded",
+    [C8_OP_ILLEGAL] = "illegal",
+    [C8_OP_EXT] = "extension",
+    [C8_OP_BREAK] = "breakpoint",
+    [C8_OP_SYS] = "0nnn SYS",
+    [C8_OP_CLS] = "00E0 CLS",
+    [C8_OP_RET] = "00EE RET",
+    [C8_OP_JP_NNN] = "1nnn JP",
+    [C8_OP_CALL] = "2nnn CALL",
+    [C8_OP_SE_VX_NN] = "3xnn SE",
+    [C8_OP_SNE_VX_NN] = "4xnn SNE",
+    [C8_OP_SE_VX_VY] = "5xy0 SE",
+    [C8_OP_LD_VX_NN] = "6xnn LD",
+    [C8_OP_ADD_VX_NN] = "7xnn ADD",
+    [C8_OP_LD_VX_VY] = "8xy0 LD",
+    [C8_OP_OR] = "8xy1 OR",
+    [C8_OP_AND] = "8xy2 AND",
+    [C8_OP_XOR] = "8xy3 XOR",
+    [C8_OP_ADD_VX_VY] = "8xy4 ADD",
+    [C8_OP_SUB] = "8xy5 SUB",
+    [C8_OP_SHR] = "8xy6 SHR",
+    [C8_OP_SUBN] = "8xy7 SUBN",
+    [C8_OP_SHL] = "8xyE SHL",
+    [C8_OP_SNE_VX_VY] = "9xy0 SNE",
+    [C8_OP_LD_I_NNN] = "Annn LD I",
+    [C8_OP_JP_V0_NNN] = "Bnnn JP V0",
+    [C8_OP_RND] = "Cxnn RND",
+    [C8_OP_DRW] = "Dxyn DRW",
+    [C8_OP_SKP] = "Ex9E SKP",
+    [C8_OP_SKNP] = "ExA1 SKNP",
+    [C8_OP_LD_VX_DT] = "Fx07 LD DT",
+    [C8_OP_LD_VX_KEY] = "Fx0A LD K",
+    [C8_OP_LD_DT_VX] = "Fx15 LD DT",
+    [C8_OP_LD_ST_VX] = "Fx18 LD ST",
+    [C8_OP_ADD_I_VX] = "Fx1E ADD I",
+    [C8_OP_LD_I_FONT_VX] = "Fx29 LD F",
+    [C8_OP_BCD] = "Fx33 BCD",
+    [C8_OP_LD_I_VX] = "Fx55 LD [I]",
+    [C8_OP_LD_VX_I] = "Fx65 LD [I]",
+};
+
+const char* c8_profile_op_class_name(uint32_t op_class) {
+    if (op_class >= C8_OP_KIND_MAX) {
+        return nullptr;
+    }
+
+    return C8_PROFILE_OP_CLASS_NAMES[op_class];
+}
+
+#ifdef C8_ENABLE_PROFILER
+
+/**
+ * Runs a DXYN and counts drawn rows. A DXYN that doesn't advance PC waits
+ * for vblank and draws nothing.
+ */
+static void c8_exec_profiled_drw(c8_state* state, const c8_insn* insn) {
+    const uint16_t pc = state->registers.pc;
+    c8_profiler* profiler = state->profiler;
+    profiler->exec[insn->kind](state, insn);
+
+    if (state->registers.pc == pc) {
+        ++profiler->counts.vblank_stall_cycles;
+    } else {
+        profiler->counts.sprite_rows += insn->n;
+    }
+}
+
+/**
+ * Runs a jump and remembers backward jumps as loops.
+ */
+static void c8_exec_profiled_jump(c8_state* state, const c8_insn* insn) {
+    const uint16_t pc = state->registers.pc;
+    c8_profiler* profiler = state->profiler;
+    profiler->exec[insn->kind](state, insn);
+
+    if (state->registers.pc <= pc) {
+        ++profiler->loop_counts[pc];
+        profiler->loop_targets[pc] = state->registers.pc;
+    }
+}
+
+/**
+ * Finds or adds the call tree node of a subroutine called from a node.
+ *
+ * @return Node, or 0 if the tree is full.
+ */
+static uint16_t c8_profile_callee(c8_profiler* profiler,
+                                  uint16_t caller,
+                                  uint16_t entry) {
+    uint16_t node = profiler->calls[caller].child;
+    while (node != 0 && profiler->calls[node].entry != entry) {
+        node = profiler->calls[node].sibling;
+    }
+    if (node != 0 || profiler->call_count == C8_PROFILE_MAX_CALLS) {
+        return node;
+    }
+
+    node = profiler->call_count++;
+    profiler->calls[node] = (c8_profile_call){
+        .entry = entry,
+        .parent = caller,
+        .child = 0,
+        .sibling = profiler->calls[caller].child,
+        .cycles = 0,
+    };
+    profiler->calls[caller].child = node;
+    return node;
+}
+
+/**
+ * Finds the call tree node of the guest stack from its return addresses.
+ */
+static void c8_profile_find_call(c8_state* state) {
+    c8_profiler* profiler = state->profiler;
+    const c8_registers* registers = &state->registers;
+    const uint8_t depth = C8_MIN(registers->sp, 16);
+
+    uint16_t node = 0;
+    profiler->call_exact = true;
+    for (uint8_t k = 0; k < depth; ++k) {
+        // The CALL that pushed the frame, or the address itself if it's gone
+        const uint16_t site = registers->stack[k];
+        uint16_t entry = site;
+        if (site + 1 < state->config.memory_size
+            && (c8_read_byte(state, site) >> 4) == 0x2) {
+            entry = c8_fetch(state, site) & 0xFFF;
+        }
+
+        const uint16_t callee = c8_profile_callee(profiler, node, entry);
+        if (callee == 0) {
+            profiler->call_exact = false;
+            break;
+        }
+        node = callee;
+    }
+
+    profiler->call = node;
+    profiler->call_cycles = &profiler->calls[node].cycles;
+    profiler->call_depth = registers->sp;
+}
+
+/**
+ * Moves to the call tree node of the guest stack after a CALL or RET.
+ *
+ * @param pc Address of the instruction.
+ * @param kind C8_OP_CALL or C8_OP_RET.
+ */
+static void c8_profile_follow_call(c8_state* state,
+                                   uint16_t pc,
+                                   uint8_t kind) {
+    c8_profiler* profiler = state->profiler;
+    const uint16_t node = profiler->call;
+    const uint8_t sp = state->registers.sp;
+
+    uint16_t next = 0;
+    bool found = false;
+    if (profiler->call_exact && kind == C8_OP_CALL
+        && sp == profiler->call_depth + 1 && sp <= 16) {
+        // The CALL went to its subroutine, so PC is the entry. A CALL mostly
+        // runs in the same stack, so the node it entered last is cached.
+        const uint16_t entry = state->registers.pc;
+        c8_profile_site* site = &profiler->call_sites[pc];
+        next = site->callee;
+        if (next == 0 || site->caller != node
+            || profiler->calls[next].entry != entry) {
+            next = c8_profile_callee(profiler, node, entry);
+            *site = (c8_profile_site){ .caller = node, .callee = next };
+        }
+        found = next != 0;
+    } else if (profiler->call_exact && kind == C8_OP_RET
+               && sp + 1 == profiler->call_depth) {
+        next = profiler->calls[node].parent;
+        found = true;
+    }
+
+    if (!found) {
+        c8_profile_find_call(state);
+        return;
+    }
+    profiler->call = next;
+    profiler->call_cycles = &profiler->calls[next].cycles;
+    profiler->call_depth = sp;
+}
+
+void c8_profile_count_slow(c8_state* state, uint16_t pc, uint8_t kind) {
+    if (kind == C8_OP_BREAK && state->break_armed) {
+        // Stopped at the breakpoint, nothing was executed
+        return;
+    }
+
+    if (kind == C8_OP_UNDECODED || kind == C8_OP_BREAK) {
+        const c8_insn* insn = c8_cached_insn(state, pc);
+        if (insn->kind == C8_OP_UNDECODED || insn->kind == C8_OP_BREAK) {
+            // The instruction wrote over itself, sits on a breakpoint, or at
+            // the end of a page, where it's never cached
+            kind = c8_decode(state, c8_fetch(state, pc)).kind;
+        } else {
+            kind = insn->kind;
+        }
+    }
+
+    // The step belongs to the node it ran in, count it before moving on
+    c8_profiler* profiler = state->profiler;
+    ++profiler->address_counts[pc];
+    ++profiler->counts.op_counts[kind];
+    ++*profiler->call_cycles;
+
+    if (kind == C8_OP_CALL || kind == C8_OP_RET) {
+        c8_profile_follow_call(state, pc, kind);
+    }
+}
+
+/**
+ * Instructions with profiler handlers.
+ */
+static const uint8_t C8_PROFILE_WRAPPED_KINDS[] = {
+    C8_OP_DRW, C8_OP_JP_NNN, C8_OP_JP_V0_NNN,
+};
+
+/**
+ * Installs or removes the DXYN and jump handlers of the profiler. Handlers
+ * swapped out by watchpoints are only replaced in `exec_unwatched`, which
+ * they call.
+ */
+static void c8_profiler_wrap(c8_state* state, bool wrap) {
+    c8_profiler* profiler = state->profiler;
+    const uint32_t kinds_size =
+        sizeof(C8_PROFILE_WRAPPED_KINDS) / sizeof(C8_PROFILE_WRAPPED_KINDS[0]);
+    for (uint32_t k = 0; k < kinds_size; ++k) {
+        const uint8_t kind = C8_PROFILE_WRAPPED_KINDS[k];
+        c8_op_exec handler = profiler->exec[kind];
+        if (wrap) {
+            profiler->exec[kind] = state->exec_unwatched[kind];
+            handler = kind == C8_OP_DRW
+                ? c8_exec_profiled_drw
+                : c8_exec_profiled_jump;
+        }
+
+        if (state->exec[kind] == state->exec_unwatched[kind]) {
+            state->exec[kind] = handler;
+        }
+        state->exec_unwatched[kind] = handler;
+    }
+
+    // Translated code calls handlers directly
+    if (state->jit != nullptr) {
+        c8_jit_flush(state->jit);
+    }
+}
+
+static void c8_profiler_destroy(c8_profiler* profiler) {
+    if (profiler == nullptr) {
+        return;
+    }
+
+    free(profiler->address_counts);
+    free(profiler->loop_counts);
+    free(profiler->loop_targets);
+    free(profiler->calls);
+    free(profiler->call_sites);
+    free(profiler);
+}
+
+bool c8_profile_enable(c8_state* state, bool enabled) {
+    if (state == nullptr) {
+        return false;
+    }
+
+    if (state->profiler != nullptr) {
+        if (!enabled) {
+            c8_profiler_wrap(state, false);
+            c8_profiler_destroy(state->profiler);
+            state->profiler = nullptr;
+        }
+        return true;
+    }
+
+    if (!enabled) {
+        return true;
+    }
+
+    const uint16_t memory_size = state->config.memory_size;
+    c8_profiler* profiler = calloc(1, sizeof(c8_profiler));
+    if (profiler == nullptr) {
+        return false;
+    }
+    profiler->address_counts = calloc(memory_size, sizeof(uint64_t));
+    profiler->loop_counts = calloc(memory_size, sizeof(uint64_t));
+    profiler->loop_targets = calloc(memory_size, sizeof(uint16_t));
+    profiler->calls = calloc(C8_PROFILE_MAX_CALLS, sizeof(c8_profile_call));
+    profiler->call_sites = calloc(memory_size, sizeof(c8_profile_site));
+    if (profiler->address_counts == nullptr
+        || profiler->loop_counts == nullptr
+        || profiler->loop_targets == nullptr
+        || profiler->calls == nullptr
+        || profiler->call_sites == nullptr) {
+        c8_profiler_destroy(profiler);
+        return false;
+    }
+
+    profiler->call_count = 1;
+    state->profiler = profiler;
+    c8_profile_find_call(state);
+    c8_profiler_wrap(state, true);
+    return true;
+}
+
+bool c8_profile_is_enabled(const c8_state* state) {
+    return state != nullptr && state->profiler != nullptr;
+}
+
+void c8_profile_reset(c8_state* state) {
+    if (state == nullptr || state->profiler == nullptr) {
+        return;
+    }
+
+    const uint16_t memory_size = state->config.memory_size;
+    c8_profiler* profiler = state->profiler;
+    memset(&profiler->counts, 0, sizeof(profiler->counts));
+    memset(profiler->address_counts, 0, memory_size * sizeof(uint64_t));
+    memset(profiler->loop_counts, 0, memory_size * sizeof(uint64_t));
+    memset(profiler->loop_targets, 0, memory_size * sizeof(uint16_t));
+    memset(&profiler->calls[0], 0, sizeof(c8_profile_call));
+    memset(profiler->call_sites, 0, memory_size * sizeof(c8_profile_site));
+    profiler->call_count = 1;
+    c8_profile_find_call(state);
+}
+
+bool c8_profile_get(const c8_state* state, c8_profile* profile) {
+    if (state == nullptr || profile == nullptr || state->profiler == nullptr) {
+        return false;
+    }
+
+    *profile = state->profiler->counts;
+    profile->instructions = 0;
+    for (uint32_t kind = 0; kind < C8_OP_KIND_MAX; ++kind) {
+        profile->instructions += profile->op_counts[kind];
+    }
+    return true;
+}
+
+const uint64_t* c8_profile_get_address_counts(const c8_state* state) {
+    if (state == nullptr || state->profiler == nullptr) {
+        return nullptr;
+    }
+
+    return state->profiler->address_counts;
+}
+
+uint32_t c8_profile_get_hot_loops(const c8_state* state,
+                                  c8_profile_loop* loops,
+                                  uint32_t max_loops) {
+    if (state == nullptr || loops == nullptr || state->profiler == nullptr) {
+        return 0;
+    }
+
+    const c8_profiler* profiler = state->profiler;
+    uint32_t count = 0;
+    for (uint32_t end = 0; end < state->config.memory_size; ++end) {
+        if (profiler->loop_counts[end] == 0) {
+            continue;
+        }
+
+        c8_profile_loop loop = {
+            .start = profiler->loop_targets[end],
+            .end = end,
+            .iterations = profiler->loop_counts[end],
+            .cycles = 0,
+        };
+        for (uint32_t addr = loop.start; addr <= end; ++addr) {
+            loop.cycles += profiler->address_counts[addr];
+        }
+
+        // Insertion into the sorted output
+        uint32_t slot = count < max_loops ? count++ : max_loops;
+        while (slot > 0 && loops[slot - 1].cycles < loop.cycles) {
+            if (slot < max_loops) {
+                loops[slot] = loops[slot - 1];
+            }
+            --slot;
+        }
+        if (slot < max_loops) {
+            loops[slot] = loop;
+        }
+    }
+    return count;
+}
+
+static double c8_profile_percent(uint64_t part, uint64_t total) {
+    return total > 0 ? 100. * (double)part / (double)total : 0.;
+}
+
+bool c8_profile_dump(const c8_state* state, FILE* file) {
+    if (state == nullptr || file == nullptr || state->profiler == nullptr) {
+        return false;
+    }
+
+    const c8_profiler* profiler = state->profiler;
+    c8_profile profile;
+    c8_profile_get(state, &profile);
+    const c8_profile* counts = &profile;
+    const uint64_t total = counts->instructions;
+    const uint64_t cycles = counts->instructions + counts->key_wait_cycles;
+
+    fprintf(file, "instructions         %llu\n", (unsigned long long)total);
+    fprintf(file,
+            "sprite rows          %llu\n",
+            (unsigned long long)counts->sprite_rows);
+    fprintf(file,
+            "vblank stall cycles  %llu (%.1f%%)\n",
+            (unsigned long long)counts->vblank_stall_cycles,
+            c8_profile_percent(counts->vblank_stall_cycles, cycles));
+    fprintf(file,
+            "key wait cycles      %llu (%.1f%%)\n",
+            (unsigned long long)counts->key_wait_cycles,
+            c8_profile_percent(counts->key_wait_cycles, cycles));
+
+    fprintf(file, "\nopcode classes\n");
+    bool listed[C8_OP_KIND_MAX] = { false };
+    for (uint32_t i = 0; i < C8_OP_KIND_MAX; ++i) {
+        uint32_t best = C8_OP_KIND_MAX;
+        for (uint32_t kind = 0; kind < C8_OP_KIND_MAX; ++kind) {
+            if (!listed[kind] && counts->op_counts[kind] > 0
+                && (best == C8_OP_KIND_MAX
+                    || counts->op_counts[kind] > counts->op_counts[best])) {
+                best = kind;
+            }
+        }
+        if (best == C8_OP_KIND_MAX) {
+            break;
+        }
+
+        listed[best] = true;
+        fprintf(file,
+                "  %-12s %12llu %6.1f%%\n",
+                C8_PROFILE_OP_CLASS_NAMES[best],
+                (unsigned long long)counts->op_counts[best],
+                c8_profile_percent(counts->op_counts[best], total));
+    }
+
+    fprintf(file, "\nhottest addresses\n");
+    uint16_t hot[C8_PROFILE_DUMP_ADDRESSES];
+    uint32_t hot_count = 0;
+    for (uint32_t addr = 0; addr < state->config.memory_size; ++addr) {
+        const uint64_t executions = profiler->address_counts[addr];
+        if (executions == 0) {
+            continue;
+        }
+
+        uint32_t slot = hot_count < C8_PROFILE_DUMP_ADDRESSES
+            ? hot_count++
+            : C8_PROFILE_DUMP_ADDRESSES;
+        while (slot > 0
+               && profiler->address_counts[hot[slot - 1]] < executions) {
+            if (slot < C8_PROFILE_DUMP_ADDRESSES) {
+                hot[slot] = hot[slot - 1];
+            }
+            --slot;
+        }
+        if (slot < C8_PROFILE_DUMP_ADDRESSES) {
+            hot[slot] = addr;
+        }
+    }
+    for (uint32_t i = 0; i < hot_count; ++i) {
+        const uint64_t executions = profiler->address_counts[hot[i]];
+        fprintf(file,
+                "  %04X %12llu %6.1f%%\n",
+                hot[i],
+                (unsigned long long)executions,
+                c8_profile_percent(executions, total));
+    }
+
+    fprintf(file, "\nhottest loops\n");
+    c8_profile_loop loops[C8_PROFILE_DUMP_LOOPS];
+    const uint32_t loop_count =
+        c8_profile_get_hot_loops(state, loops, C8_PROFILE_DUMP_LOOPS);
+    for (uint32_t i = 0; i < loop_count; ++i) {
+        fprintf(file,
+                "  %04X-%04X %12llu iterations %12llu cycles %6.1f%%\n",
+                loops[i].start,
+                loops[i].end,
+                (unsigned long long)loops[i].iterations,
+                (unsigned long long)loops[i].cycles,
+                c8_profile_percent(loops[i].cycles, total));
+    }
+
+    return true;
+}
+
+bool c8_profile_dump_folded(const c8_state* state, FILE* file) {
+    if (state == nullptr || file == nullptr || state->profiler == nullptr) {
+        return false;
+    }
+
+    const c8_profiler* profiler = state->profiler;
+    for (uint16_t node = 0; node < profiler->call_count; ++node) {
+        const uint64_t cycles = profiler->calls[node].cycles;
+        if (cycles == 0) {
+            continue;
+        }
+
+        // Callers first, the tree is as deep as the guest stack
+        uint16_t path[16];
+        uint32_t depth = 0;
+        for (uint16_t frame = node; frame != 0;
+             frame = profiler->calls[frame].parent) {
+            path[depth++] = frame;
+        }
+
+        fprintf(file, "main");
+        while (depth > 0) {
+            fprintf(file, ";sub_%04X", profiler->calls[path[--depth]].entry);
+        }
+        fprintf(file, " %llu\n", (unsigned long long)cycles);
+    }
+
+    return true;
+}
+
+#else
+
+bool c8_profile_enable(c8_state* state, bool enabled) {
+    return false;
+}
+
+bool c8_profile_is_enabled(const c8_state* state) {
+    return false;
+}
+
+void c8_profile_reset(c8_state* state) {
+}
+
+bool c8_profile_get(const c8_state* state, c8_profile* profile) {
+    return false;
+}
+
+const uint64_t* c8_profile_get_address_counts(const c8_state* state) {
+    return nullptr;
+}
+
+uint32_t c8_profile_get_hot_loops(const c8_state* state,
+                                  c8_profile_loop* loops,
+                                  uint32_t max_loops) {
+    return 0;
+}
+
+bool c8_profile_dump(const c8_state* state, FILE* file) {
+    return false;
+}
+
+bool c8_profile_dump_folded(const c8_state* state, FILE* file) {
+    return false;
+}
+
+#endif
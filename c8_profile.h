@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdio.h>
+#include "c8.h"
+
+/*
+ * Guest execution profiler.
+ *
+ * Compiled into the core only when C8_ENABLE_PROFILER is defined (the
+ * C8_ENABLE_PROFILER CMake option). Without it every function below is a
+ * stub and the interpreter has no profiling code at all. With it, a machine
+ * only pays for profiling after `c8_profile_enable()`.
+ *
+ * A profiled machine runs everything through the interpreter, translated
+ * blocks can't be counted per address.
+ *
+ * Cycles are also attributed to guest call stacks, by following CALL and
+ * RET, and can be written as folded stacks for flame graph tools.
+ */
+
+/// Number of opcode classes in `c8_profile::op_counts`.
+#define C8_PROFILE_OP_CLASSES 39
+
+/**
+ * Profile counters.
+ */
+typedef struct c8_profile {
+    uint64_t instructions; ///< Executed instructions.
+    uint64_t op_counts[C8_PROFILE_OP_CLASSES]; ///< Executions per class.
+    uint64_t sprite_rows; ///< Sum of N over executed DXYN instructions.
+    uint64_t vblank_stall_cycles; ///< DXYN cycles spent waiting for vblank.
+    uint64_t key_wait_cycles; ///< Cycles spent blocked in FX0A.
+} c8_profile;
+
+/**
+ * A loop closed by a backward jump.
+ */
+typedef struct c8_profile_loop {
+    uint16_t start; ///< Jump target.
+    uint16_t end; ///< Address of the jump.
+    uint64_t iterations; ///< Times the jump was taken.
+    uint64_t cycles; ///< Instructions executed between `start` and `end`.
+} c8_profile_loop;
+
+/**
+ * Starts or stops profiling. Stopping drops the collected data.
+ *
+ * @param state CHIP-8 machine state.
+ * @param enabled Whether to profile.
+ * @return false if the profiler is compiled out or out of memory.
+ */
+bool c8_profile_enable(c8_state* state, bool enabled);
+
+/**
+ * Checks whether a machine is being profiled.
+ *
+ * @param state CHIP-8 machine state.
+ * @return true if profiling.
+ */
+bool c8_profile_is_enabled(const c8_state* state);
+
+/**
+ * Clears the collected data.
+ *
+ * @param state CHIP-8 machine state.
+ */
+void c8_profile_reset(c8_state* state);
+
+/**
+ * Gets the counters.
+ *
+ * @param state CHIP-8 machine state.
+ * @param profile Output counters.
+ * @return false if the machine is not being profiled.
+ */
+bool c8_profile_get(const c8_state* state, c8_profile* profile);
+
+/**
+ * Gets the number of executions of every address.
+ *
+ * @param state CHIP-8 machine state.
+ * @return `memory_size` counters, or NULL if not profiling.
+ */
+const uint64_t* c8_profile_get_address_counts(const c8_state* state);
+
+/**
+ * Gets the loops with the most executed instructions.
+ *
+ * @param state CHIP-8 machine state.
+ * @param loops Output loops, hottest first.
+ * @param max_loops Size of `loops`.
+ * @return Number of loops written.
+ */
+uint32_t c8_profile_get_hot_loops(const c8_state* state,
+                                  c8_profile_loop* loops,
+                                  uint32_t max_loops);
+
+/**
+ * Gets the name of an opcode class.
+ *
+ * @param op_class Index into `c8_profile::op_counts`.
+ * @return Name, such as "8xy4 ADD", or NULL if out of range.
+ */
+const char* c8_profile_op_class_name(uint32_t op_class);
+
+/**
+ * Writes a text report: counters, opcode histogram, hottest addresses and
+ * loops.
+ *
+ * @param state CHIP-8 machine state.
+ * @param file Output file.
+ * @return false if the machine is not being profiled.
+ */
+bool c8_profile_dump(const c8_state* state, FILE* file);
+
+/**
+ * Writes the cycles spent in every guest call stack as folded stacks, one
+ * line per stack, like `main;sub_0246;sub_02A0 1234`. `main` is code outside
+ * of any subroutine and `sub_NNNN` a subroutine called with 2NNN. Only the
+ * cycles of the innermost subroutine itself are on its line, so the lines
+ * can be fed to flame graph tools as is.
+ *
+ * @param state CHIP-8 machine state.
+ * @param file Output file.
+ * @return false if the machine is not being profiled.
+ */
+bool c8_profile_dump_folded(const c8_state* state, FILE* file);
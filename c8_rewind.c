@@ -0,0 +1,476 @@
+#include "c8_rewind.h"
+#include <stdlib.h>
+#include <memory.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) \
+    && !defined(C8_REWIND_NO_SIMD)
+    #define C8_REWIND_X86
+    #include <immintrin.h>
+#elif defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+/*
+ * Frames live in a byte ring, each one stored contiguously. A keyframe is a
+ * raw snapshot. A delta is the snapshot XORed with its keyframe word by word
+ * and run-length encoded as a sequence of
+ *
+ *     uint16_t zero_words, uint16_t literal_words, uint64_t literals[]
+ *
+ * groups covering the whole snapshot. Consecutive frames mostly differ in
+ * registers, a few memory bytes and display rows, so deltas are small.
+ *
+ * Encoding XORs the frame with its keyframe and notes which words are
+ * nonzero in one pass, with AVX2 or SSE2 on x86-64. Runs are then read off
+ * that bitmap 64 words at a time.
+ */
+
+enum c8_rewind_params {
+    C8_REWIND_BYTES_PER_ENTRY = 128, ///< Budget bytes per index entry.
+    C8_REWIND_MIN_ENTRIES = 16,
+};
+
+typedef struct c8_rewind_entry {
+    uint32_t offset; ///< Data offset in the ring.
+    uint32_t size; ///< Data size.
+    uint32_t key; ///< Sequence number of the keyframe, own one for keyframes.
+} c8_rewind_entry;
+
+struct c8_rewind {
+    size_t snapshot_size;
+    size_t words; ///< Snapshot size in 64-bit words, rounded up.
+    uint64_t* frame; ///< Scratch snapshot.
+    uint64_t* key; ///< Keyframe new deltas are encoded against.
+    uint64_t* nonzero; ///< Bitmap of the nonzero words of an XORed frame.
+    uint8_t* delta; ///< Scratch encoded delta.
+    size_t delta_capacity;
+
+    uint8_t* data;
+    size_t capacity;
+
+    c8_rewind_entry* entries;
+    uint32_t max_entries;
+    uint32_t first; ///< Sequence number of the oldest frame.
+    uint32_t next; ///< Sequence number of the next pushed frame.
+
+    uint32_t keyframe_interval;
+    bool key_valid; ///< `key` holds the newest frame's keyframe.
+    bool avx2; ///< Encode with AVX2 instead of SSE2.
+};
+
+static c8_rewind_entry* c8_rewind_entry_at(c8_rewind* rewind, uint32_t seq) {
+    return &rewind->entries[seq % rewind->max_entries];
+}
+
+c8_rewind* c8_rewind_create(const c8_state* state,
+                            size_t capacity,
+                            uint32_t keyframe_interval) {
+    const size_t snapshot_size = c8_snapshot_size(state);
+    if (snapshot_size == 0 || capacity < snapshot_size) {
+        return nullptr;
+    }
+
+    c8_rewind* rewind = calloc(1, sizeof(c8_rewind));
+    if (rewind == nullptr) {
+        return nullptr;
+    }
+
+    rewind->snapshot_size = snapshot_size;
+    rewind->words = (snapshot_size + 7) / 8;
+    rewind->frame = calloc(rewind->words, sizeof(uint64_t));
+    rewind->key = calloc(rewind->words, sizeof(uint64_t));
+    rewind->nonzero = calloc((rewind->words + 63) / 64, sizeof(uint64_t));
+    // Worst case is a single zero word between literals
+    rewind->delta_capacity =
+        rewind->words * sizeof(uint64_t) + (rewind->words / 2 + 1) * 4;
+    rewind->delta = malloc(rewind->delta_capacity);
+    rewind->data = malloc(capacity);
+    rewind->capacity = capacity;
+    rewind->max_entries = C8_MAX(capacity / C8_REWIND_BYTES_PER_ENTRY,
+                                 C8_REWIND_MIN_ENTRIES);
+    rewind->entries = calloc(rewind->max_entries, sizeof(c8_rewind_entry));
+    if (rewind->frame == nullptr || rewind->key == nullptr
+        || rewind->nonzero == nullptr || rewind->delta == nullptr
+        || rewind->data == nullptr || rewind->entries == nullptr) {
+        c8_rewind_destroy(rewind);
+        return nullptr;
+    }
+
+    rewind->keyframe_interval = C8_MAX(keyframe_interval, 1);
+#ifdef C8_REWIND_X86
+    __builtin_cpu_init();
+    rewind->avx2 = __builtin_cpu_supports("avx2");
+#endif
+    return rewind;
+}
+
+void c8_rewind_destroy(c8_rewind* rewind) {
+    if (rewind == nullptr) {
+        return;
+    }
+
+    free(rewind->entries);
+    free(rewind->data);
+    free(rewind->delta);
+    free(rewind->nonzero);
+    free(rewind->key);
+    free(rewind->frame);
+    free(rewind);
+}
+
+void c8_rewind_clear(c8_rewind* rewind) {
+    if (rewind == nullptr) {
+        return;
+    }
+
+    rewind->first = rewind->next;
+    rewind->key_valid = false;
+}
+
+/**
+ * Drops the oldest keyframe and the deltas depending on it.
+ */
+static void c8_rewind_evict(c8_rewind* rewind) {
+    do {
+        ++rewind->first;
+    } while (rewind->first != rewind->next
+        && c8_rewind_entry_at(rewind, rewind->first)->key != rewind->first);
+
+    if (rewind->first == rewind->next) {
+        rewind->key_valid = false;
+    }
+}
+
+/**
+ * Finds ring space for `size` bytes, evicting old frames if needed.
+ *
+ * @return Data offset.
+ */
+static uint32_t c8_rewind_alloc(c8_rewind* rewind, size_t size) {
+    while (rewind->first != rewind->next) {
+        const c8_rewind_entry* oldest =
+            c8_rewind_entry_at(rewind, rewind->first);
+        const c8_rewind_entry* newest =
+            c8_rewind_entry_at(rewind, rewind->next - 1);
+        const size_t tail = newest->offset + newest->size;
+
+        const bool index_full =
+            rewind->next - rewind->first >= rewind->max_entries;
+        if (!index_full) {
+            if (newest->offset >= oldest->offset) {
+                if (rewind->capacity - tail >= size) {
+                    return tail;
+                }
+                if (oldest->offset >= size) {
+                    return 0;
+                }
+            }
+            else if (oldest->offset - tail >= size) {
+                return tail;
+            }
+        }
+
+        c8_rewind_evict(rewind);
+    }
+
+    return 0;
+}
+
+/**
+ * XORs `frame` with `key` and sets the bits of the nonzero words in the
+ * zeroed `nonzero` bitmap. Vector versions do whole bitmap words and leave
+ * the rest to this one.
+ *
+ * @param first First word.
+ */
+static void c8_rewind_xor_portable(uint64_t* restrict frame,
+                                   const uint64_t* restrict key,
+                                   uint64_t* restrict nonzero,
+                                   size_t first,
+                                   size_t words) {
+    size_t i = first;
+    while (i < words) {
+        const size_t end = C8_MIN((i / 64 + 1) * 64, words);
+        uint64_t bits = 0;
+        for (; i < end; ++i) {
+            frame[i] ^= key[i];
+            bits |= (uint64_t)(frame[i] != 0) << (i % 64);
+        }
+        nonzero[(end - 1) / 64] |= bits;
+    }
+}
+
+#ifdef C8_REWIND_X86
+/**
+ * SSE2 version of `c8_rewind_xor_portable()`, 2 words at a time.
+ */
+static void c8_rewind_xor_sse2(uint64_t* restrict frame,
+                               const uint64_t* restrict key,
+                               uint64_t* restrict nonzero,
+                               size_t words) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 64 <= words; i += 64) {
+        uint64_t bits = 0;
+        for (uint32_t j = 0; j < 64; j += 2) {
+            const __m128i x = _mm_xor_si128(
+                _mm_loadu_si128((const __m128i*)(frame + i + j)),
+                _mm_loadu_si128((const __m128i*)(key + i + j))
+            );
+            _mm_storeu_si128((__m128i*)(frame + i + j), x);
+
+            // A word is zero if all of its bytes are
+            const uint32_t zeros =
+                _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero));
+            bits |= (uint64_t)((zeros & 0xFF) != 0xFF) << j
+                | (uint64_t)((zeros >> 8) != 0xFF) << (j + 1);
+        }
+        nonzero[i / 64] = bits;
+    }
+    c8_rewind_xor_portable(frame, key, nonzero, i, words);
+}
+
+/**
+ * AVX2 version of `c8_rewind_xor_portable()`, 4 words at a time.
+ */
+__attribute__((target("avx2")))
+static void c8_rewind_xor_avx2(uint64_t* restrict frame,
+                               const uint64_t* restrict key,
+                               uint64_t* restrict nonzero,
+                               size_t words) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= words; i += 64) {
+        uint64_t bits = 0;
+        for (uint32_t j = 0; j < 64; j += 4) {
+            const __m256i x = _mm256_xor_si256(
+                _mm256_loadu_si256((const __m256i*)(frame + i + j)),
+                _mm256_loadu_si256((const __m256i*)(key + i + j))
+            );
+            _mm256_storeu_si256((__m256i*)(frame + i + j), x);
+
+            const uint32_t zeros = _mm256_movemask_pd(
+                _mm256_castsi256_pd(_mm256_cmpeq_epi64(x, zero))
+            );
+            bits |= (uint64_t)(~zeros & 0xF) << j;
+        }
+        nonzero[i / 64] = bits;
+    }
+    c8_rewind_xor_portable(frame, key, nonzero, i, words);
+}
+#endif
+
+/**
+ * Gets the index of the lowest set bit.
+ *
+ * @param bits Bits, not 0.
+ */
+static uint32_t c8_rewind_lowest_bit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (uint32_t)__builtin_ctzll(bits);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return index;
+#else
+    uint32_t index = 0;
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+/**
+ * Finds the first word from `first` on whose bit in `nonzero` is `set`.
+ *
+ * @return The word, `words` if there is none.
+ */
+static size_t c8_rewind_find(const uint64_t* nonzero,
+                             size_t first,
+                             size_t words,
+                             bool set) {
+    const uint64_t flip = set ? 0 : UINT64_MAX;
+    size_t k = first / 64;
+    uint64_t bits = (nonzero[k] ^ flip) & (UINT64_MAX << (first % 64));
+    while (bits == 0) {
+        if (++k * 64 >= words) {
+            return words;
+        }
+        bits = nonzero[k] ^ flip;
+    }
+    return C8_MIN(k * 64 + c8_rewind_lowest_bit(bits), words);
+}
+
+/**
+ * Encodes `rewind->frame` against `rewind->key` into `rewind->delta`.
+ *
+ * @return Encoded size.
+ */
+static size_t c8_rewind_encode(c8_rewind* rewind) {
+    const size_t words = rewind->words;
+    uint64_t* frame = rewind->frame;
+    uint64_t* nonzero = rewind->nonzero;
+
+    memset(nonzero, 0, (words + 63) / 64 * sizeof(uint64_t));
+#ifdef C8_REWIND_X86
+    if (rewind->avx2) {
+        c8_rewind_xor_avx2(frame, rewind->key, nonzero, words);
+    } else {
+        c8_rewind_xor_sse2(frame, rewind->key, nonzero, words);
+    }
+#else
+    c8_rewind_xor_portable(frame, rewind->key, nonzero, 0, words);
+#endif
+
+    uint8_t* out = rewind->delta;
+    size_t i = 0;
+    while (i < words) {
+        const size_t zeros_begin = i;
+        const size_t literals_begin = c8_rewind_find(nonzero, i, words, true);
+        i = c8_rewind_find(nonzero, literals_begin, words, false);
+
+        const uint16_t run[2] = {
+            (uint16_t)(literals_begin - zeros_begin),
+            (uint16_t)(i - literals_begin),
+        };
+        memcpy(out, run, sizeof(run));
+        out += sizeof(run);
+        memcpy(out, frame + literals_begin, run[1] * sizeof(uint64_t));
+        out += run[1] * sizeof(uint64_t);
+    }
+
+    return out - rewind->delta;
+}
+
+/**
+ * Applies an encoded delta to `rewind->frame`, which holds its keyframe.
+ */
+static void c8_rewind_decode(c8_rewind* rewind, const uint8_t* in, size_t size) {
+    const uint8_t* end = in + size;
+    uint64_t* frame = rewind->frame;
+    size_t i = 0;
+    while (in < end) {
+        uint16_t run[2];
+        memcpy(run, in, sizeof(run));
+        in += sizeof(run);
+        i += run[0];
+
+        for (uint16_t j = 0; j < run[1]; ++j, ++i) {
+            uint64_t literal;
+            memcpy(&literal, in, sizeof(literal));
+            in += sizeof(literal);
+            frame[i] ^= literal;
+        }
+    }
+}
+
+static bool c8_rewind_store(c8_rewind* rewind,
+                            const void* data,
+                            size_t size,
+                            bool keyframe) {
+    const uint32_t key = keyframe
+        ? rewind->next
+        : c8_rewind_entry_at(rewind, rewind->next - 1)->key;
+    const uint32_t offset = c8_rewind_alloc(rewind, size);
+
+    // Eviction may have dropped the keyframe this delta depends on
+    if (!keyframe && rewind->first == rewind->next) {
+        return false;
+    }
+
+    c8_rewind_entry* entry = c8_rewind_entry_at(rewind, rewind->next);
+    entry->offset = offset;
+    entry->size = (uint32_t)size;
+    entry->key = key;
+    memcpy(rewind->data + offset, data, size);
+    ++rewind->next;
+    return true;
+}
+
+bool c8_rewind_push(c8_rewind* rewind, const c8_state* state) {
+    if (rewind == nullptr || state == nullptr) {
+        return false;
+    }
+
+    if (c8_snapshot_save(state, rewind->frame, rewind->snapshot_size) == 0) {
+        return false;
+    }
+
+    bool keyframe = !rewind->key_valid;
+    if (!keyframe) {
+        const uint32_t key =
+            c8_rewind_entry_at(rewind, rewind->next - 1)->key;
+        keyframe = rewind->next - key >= rewind->keyframe_interval;
+    }
+
+    if (!keyframe) {
+        const size_t size = c8_rewind_encode(rewind);
+        if (size < rewind->snapshot_size
+            && c8_rewind_store(rewind, rewind->delta, size, false)) {
+            return true;
+        }
+
+        // Too large or the keyframe is gone, store it whole
+        c8_snapshot_save(state, rewind->frame, rewind->snapshot_size);
+    }
+
+    c8_rewind_store(rewind, rewind->frame, rewind->snapshot_size, true);
+    memcpy(rewind->key, rewind->frame, rewind->words * sizeof(uint64_t));
+    rewind->key_valid = true;
+    return true;
+}
+
+bool c8_rewind_pop(c8_rewind* rewind, c8_state* state) {
+    if (rewind == nullptr || state == nullptr || rewind->first == rewind->next) {
+        return false;
+    }
+
+    const uint32_t seq = rewind->next - 1;
+    const c8_rewind_entry* entry = c8_rewind_entry_at(rewind, seq);
+    const c8_rewind_entry* key = c8_rewind_entry_at(rewind, entry->key);
+
+    memcpy(rewind->frame, rewind->data + key->offset, rewind->snapshot_size);
+    if (entry->key != seq) {
+        c8_rewind_decode(rewind, rewind->data + entry->offset, entry->size);
+    }
+
+    const bool loaded =
+        c8_snapshot_load(state, rewind->frame, rewind->snapshot_size);
+
+    rewind->next = seq;
+    rewind->key_valid = false;
+    if (rewind->first != rewind->next) {
+        const c8_rewind_entry* newest =
+            c8_rewind_entry_at(rewind, rewind->next - 1);
+        const c8_rewind_entry* newest_key =
+            c8_rewind_entry_at(rewind, newest->key);
+        memcpy(rewind->key,
+               rewind->data + newest_key->offset,
+               rewind->snapshot_size);
+        rewind->key_valid = true;
+    }
+
+    return loaded;
+}
+
+uint32_t c8_rewind_count(const c8_rewind* rewind) {
+    if (rewind == nullptr) {
+        return 0;
+    }
+
+    return rewind->next - rewind->first;
+}
+
+size_t c8_rewind_used(const c8_rewind* rewind) {
+    if (rewind == nullptr) {
+        return 0;
+    }
+
+    size_t used = 0;
+    for (uint32_t seq = rewind->first; seq != rewind->next; ++seq) {
+        used += rewind->entries[seq % rewind->max_entries].size;
+    }
+    return used;
+}
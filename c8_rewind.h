@@ -0,0 +1,79 @@
+#pragma once
+
+#include "c8.h"
+
+/*
+ * Rewind history: a bounded ring of per-frame machine snapshots.
+ *
+ * Every `keyframe_interval` frames a full snapshot is stored, the frames in
+ * between are stored as deltas against the last keyframe. When the history
+ * does not fit into its memory budget, the oldest keyframe is dropped along
+ * with the deltas depending on it.
+ */
+
+/**
+ * Rewind history state.
+ */
+typedef struct c8_rewind c8_rewind;
+
+/**
+ * Creates a rewind history for a machine.
+ *
+ * @param state CHIP-8 machine state. Only its config is used, the history
+ * works for any machine with the same config.
+ * @param capacity Memory budget for stored frames, in bytes.
+ * @param keyframe_interval Frames between full snapshots.
+ * @return Rewind history, or NULL if the budget is too small to hold
+ * a single keyframe, or out of memory.
+ */
+c8_rewind* c8_rewind_create(const c8_state* state,
+                            size_t capacity,
+                            uint32_t keyframe_interval);
+
+/**
+ * Destroys a rewind history.
+ *
+ * @param rewind Rewind history.
+ */
+void c8_rewind_destroy(c8_rewind* rewind);
+
+/**
+ * Drops every stored frame.
+ *
+ * @param rewind Rewind history.
+ */
+void c8_rewind_clear(c8_rewind* rewind);
+
+/**
+ * Stores the current machine state as the newest frame.
+ *
+ * @param rewind Rewind history.
+ * @param state CHIP-8 machine state.
+ * @return false if the state could not be stored.
+ */
+bool c8_rewind_push(c8_rewind* rewind, const c8_state* state);
+
+/**
+ * Restores the newest frame into a machine and drops it from the history.
+ *
+ * @param rewind Rewind history.
+ * @param state CHIP-8 machine state.
+ * @return false if the history is empty.
+ */
+bool c8_rewind_pop(c8_rewind* rewind, c8_state* state);
+
+/**
+ * Gets the number of stored frames.
+ *
+ * @param rewind Rewind history.
+ * @return Number of frames that can be rewound.
+ */
+uint32_t c8_rewind_count(const c8_rewind* rewind);
+
+/**
+ * Gets the memory used by stored frames.
+ *
+ * @param rewind Rewind history.
+ * @return Stored bytes, not counting wasted space at the end of the ring.
+ */
+size_t c8_rewind_used(const c8_rewind* rewind);
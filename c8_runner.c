@@ -0,0 +1,468 @@
+#include "c8_runner.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <stdatomic.h>
+    #include <unistd.h>
+#endif
+
+#pragma region Atomics and threads
+
+#ifdef _WIN32
+typedef volatile LONG64 c8_atomic_u64;
+
+static uint64_t c8_atomic_load(c8_atomic_u64* value) {
+    return (uint64_t)InterlockedCompareExchange64(value, 0, 0);
+}
+
+static void c8_atomic_store(c8_atomic_u64* value, uint64_t desired) {
+    InterlockedExchange64(value, (LONG64)desired);
+}
+
+static bool c8_atomic_cas(c8_atomic_u64* value,
+                          uint64_t* expected,
+                          uint64_t desired) {
+    const uint64_t old = (uint64_t)InterlockedCompareExchange64(
+        value,
+        (LONG64)desired,
+        (LONG64)*expected
+    );
+    if (old == *expected) {
+        return true;
+    }
+    *expected = old;
+    return false;
+}
+
+static void c8_atomic_add(c8_atomic_u64* value, uint64_t addend) {
+    InterlockedExchangeAdd64(value, (LONG64)addend);
+}
+
+typedef HANDLE c8_thread;
+#else
+typedef _Atomic uint64_t c8_atomic_u64;
+
+static uint64_t c8_atomic_load(c8_atomic_u64* value) {
+    return atomic_load_explicit(value, memory_order_acquire);
+}
+
+static void c8_atomic_store(c8_atomic_u64* value, uint64_t desired) {
+    atomic_store_explicit(value, desired, memory_order_release);
+}
+
+static bool c8_atomic_cas(c8_atomic_u64* value,
+                          uint64_t* expected,
+                          uint64_t desired) {
+    return atomic_compare_exchange_weak_explicit(value,
+                                                 expected,
+                                                 desired,
+                                                 memory_order_acq_rel,
+                                                 memory_order_acquire);
+}
+
+static void c8_atomic_add(c8_atomic_u64* value, uint64_t addend) {
+    atomic_fetch_add_explicit(value, addend, memory_order_relaxed);
+}
+
+typedef pthread_t c8_thread;
+#endif
+
+#pragma endregion
+
+#pragma region Workers
+
+enum c8_runner_params {
+    C8_RUNNER_CACHED_MACHINES = 4, ///< Machines a worker keeps for reuse.
+};
+
+typedef struct c8_runner c8_runner;
+
+typedef struct c8_runner_worker {
+    /**
+     * Jobs left to this worker, first index in the low 32 bits and end index
+     * in the high ones. The owner takes from the front, thieves from the
+     * back, both with a CAS.
+     */
+    _Alignas(64) c8_atomic_u64 range;
+    c8_runner* runner;
+    uint32_t index;
+    c8_thread thread;
+    bool started; ///< `thread` is running and has to be joined.
+    c8_state* vms[C8_RUNNER_CACHED_MACHINES]; ///< Reused between jobs.
+    const c8_job* loaded[C8_RUNNER_CACHED_MACHINES]; ///< Last job of `vms`.
+    uint32_t next_evicted; ///< Cache slot to replace on a miss.
+    uint64_t jobs;
+    uint64_t cycles;
+    uint64_t steals;
+    uint64_t machines;
+} c8_runner_worker;
+
+struct c8_runner {
+    const c8_job* jobs;
+    c8_job_result* results;
+    c8_runner_worker* workers;
+    uint32_t worker_count;
+
+    // Totals, each worker adds its own once it is done
+    c8_atomic_u64 jobs_done;
+    c8_atomic_u64 cycles;
+    c8_atomic_u64 steals;
+    c8_atomic_u64 machines;
+};
+
+static uint64_t c8_runner_range(uint32_t begin, uint32_t end) {
+    return (uint64_t)begin | (uint64_t)end << 32;
+}
+
+/**
+ * Takes the first job of a worker's own range.
+ */
+static bool c8_runner_take(c8_runner_worker* worker, uint32_t* job) {
+    uint64_t range = c8_atomic_load(&worker->range);
+    for (;;) {
+        const uint32_t begin = (uint32_t)range;
+        const uint32_t end = (uint32_t)(range >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        if (c8_atomic_cas(&worker->range, &range,
+                          c8_runner_range(begin + 1, end))) {
+            *job = begin;
+            return true;
+        }
+    }
+}
+
+/**
+ * Steals the back half of another worker's range. The first stolen job is
+ * returned, the rest becomes the thief's own range.
+ */
+static bool c8_runner_steal(c8_runner_worker* thief,
+                            c8_runner_worker* victim,
+                            uint32_t* job) {
+    uint64_t range = c8_atomic_load(&victim->range);
+    for (;;) {
+        const uint32_t begin = (uint32_t)range;
+        const uint32_t end = (uint32_t)(range >> 32);
+        if (begin >= end) {
+            return false;
+        }
+
+        const uint32_t taken = (end - begin + 1) / 2;
+        if (c8_atomic_cas(&victim->range, &range,
+                          c8_runner_range(begin, end - taken))) {
+            // Nobody steals from an empty range, a plain store is enough
+            c8_atomic_store(&thief->range,
+                            c8_runner_range(end - taken + 1, end));
+            *job = end - taken;
+            return true;
+        }
+    }
+}
+
+static bool c8_runner_next_job(c8_runner_worker* worker, uint32_t* job) {
+    if (c8_runner_take(worker, job)) {
+        return true;
+    }
+
+    const c8_runner* runner = worker->runner;
+    for (uint32_t i = 1; i < runner->worker_count; ++i) {
+        c8_runner_worker* victim =
+            &runner->workers[(worker->index + i) % runner->worker_count];
+        if (c8_runner_steal(worker, victim, job)) {
+            ++worker->steals;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool c8_runner_same_config(const c8_machine_config* a,
+                                  const c8_machine_config* b) {
+    return a->quirks == b->quirks
+        && a->memory_size == b->memory_size
+        && a->cycles_per_frame == b->cycles_per_frame
+        && a->screen_width == b->screen_width
+        && a->screen_height == b->screen_height
+        && a->engine == b->engine
+        && a->op_handlers_size == b->op_handlers_size
+        && memcmp(a->op_handlers,
+                  b->op_handlers,
+                  a->op_handlers_size * sizeof(c8_op_handler)) == 0
+        && memcmp(a->op_handler_claims,
+                  b->op_handler_claims,
+                  a->op_handlers_size * sizeof(c8_op_claim)) == 0;
+}
+
+static uint64_t c8_runner_hash_display(const c8_state* state,
+                                       uint8_t screen_height) {
+    uint32_t words_per_row = 0;
+    const uint64_t* rows = c8_get_display_rows(state, &words_per_row);
+    const uint8_t* bytes = (const uint8_t*)rows;
+    const size_t size = (size_t)words_per_row * screen_height
+        * sizeof(uint64_t);
+
+    uint64_t h = UINT64_C(0xCBF29CE484222325);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= UINT64_C(0x100000001B3);
+    }
+    return h;
+}
+
+/**
+ * Reports a job whose machine couldn't be created.
+ */
+static void c8_runner_fail_job(c8_runner_worker* worker, uint32_t index) {
+    c8_job_result* result = worker->runner->results;
+    if (result != nullptr) {
+        result += index;
+        memset(result, 0, sizeof(c8_job_result));
+        result->fault = C8_FAULT_OUT_OF_MEMORY;
+    }
+}
+
+static void c8_runner_run_job(c8_runner_worker* worker, uint32_t index) {
+    const c8_job* job = &worker->runner->jobs[index];
+
+    c8_state* vm = nullptr;
+    uint32_t slot = 0;
+    for (uint32_t i = 0; i < C8_RUNNER_CACHED_MACHINES && vm == nullptr; ++i) {
+        if (worker->vms[i] != nullptr
+            && c8_runner_same_config(c8_get_machine_config(worker->vms[i]),
+                                     &job->config)) {
+            vm = worker->vms[i];
+            slot = i;
+        }
+    }
+    if (vm == nullptr) {
+        slot = worker->next_evicted;
+        worker->next_evicted =
+            (worker->next_evicted + 1) % C8_RUNNER_CACHED_MACHINES;
+        c8_destroy(worker->vms[slot]);
+        worker->vms[slot] = vm = c8_create(job->config);
+        worker->loaded[slot] = nullptr;
+        if (vm == nullptr) {
+            c8_runner_fail_job(worker, index);
+            return;
+        }
+        ++worker->machines;
+    }
+
+    // A job with the same ROM only has the memory the last one wrote restored
+    const c8_job* loaded = worker->loaded[slot];
+    if (loaded != nullptr
+        && loaded->rom == job->rom
+        && loaded->rom_size == job->rom_size) {
+        c8_reset_to_pristine(vm);
+    } else {
+        c8_reset(vm);
+        c8_load_rom(vm, job->rom, job->rom_size);
+    }
+    worker->loaded[slot] = job;
+    c8_set_rng_seed(vm, job->seed);
+    c8_set_halt_on_fault(vm, job->halt_on_fault);
+    c8_set_state_hashing(vm, job->skip_loops);
+
+    const float MS_PER_FRAME = 1000.f / 60.f;
+    uint64_t cycles = 0;
+
+    // Brent's cycle detection: compare every frame with a saved one, saved
+    // again after twice as many frames each time
+    uint64_t saved_hash = job->skip_loops ? c8_get_state_hash(vm) : 0;
+    uint32_t saved_frame = 0;
+    uint64_t saved_cycles = 0;
+    uint32_t power = 1;
+    uint32_t loop_frames = 0;
+    uint64_t skipped_cycles = 0;
+    uint32_t frame = 0;
+    for (; frame < job->frames; ++frame) {
+        const c8_run_result run =
+            c8_run(vm, job->config.cycles_per_frame, C8_STOP_BUDGET);
+        cycles += run.cycles;
+        if (run.reason == C8_STOP_FAULT) {
+            // Halted, the frame was cut short
+            ++frame;
+            break;
+        }
+        c8_update_timers(vm, MS_PER_FRAME);
+        if (!job->skip_loops || loop_frames > 0) {
+            continue;
+        }
+
+        const uint32_t done = frame + 1;
+        const uint64_t hash = c8_get_state_hash(vm);
+        if (hash == saved_hash) {
+            // Whole loops end where they started, run only the rest
+            loop_frames = done - saved_frame;
+            const uint32_t loops = (job->frames - done) / loop_frames;
+            skipped_cycles = loops * (cycles - saved_cycles);
+            cycles += skipped_cycles;
+            frame += loops * loop_frames;
+        }
+        else if (done - saved_frame == power) {
+            saved_hash = hash;
+            saved_frame = done;
+            saved_cycles = cycles;
+            power *= 2;
+        }
+    }
+
+    ++worker->jobs;
+    worker->cycles += cycles - skipped_cycles;
+
+    c8_job_result* result = worker->runner->results;
+    if (result != nullptr) {
+        result += index;
+        result->registers = *c8_get_registers(vm);
+        result->display_hash =
+            c8_runner_hash_display(vm, job->config.screen_height);
+        result->cycles = cycles;
+        result->loop_frames = loop_frames;
+        result->frames = frame;
+        result->fault = c8_get_fault(vm, &result->fault_addr);
+    }
+}
+
+static void c8_runner_worker_main(c8_runner_worker* worker) {
+    uint32_t job;
+    while (c8_runner_next_job(worker, &job)) {
+        c8_runner_run_job(worker, job);
+    }
+
+    for (uint32_t i = 0; i < C8_RUNNER_CACHED_MACHINES; ++i) {
+        c8_destroy(worker->vms[i]);
+        worker->vms[i] = nullptr;
+    }
+
+    c8_runner* runner = worker->runner;
+    c8_atomic_add(&runner->jobs_done, worker->jobs);
+    c8_atomic_add(&runner->cycles, worker->cycles);
+    c8_atomic_add(&runner->steals, worker->steals);
+    c8_atomic_add(&runner->machines, worker->machines);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI c8_runner_thread_main(LPVOID worker) {
+    c8_runner_worker_main(worker);
+    return 0;
+}
+
+static bool c8_runner_start(c8_runner_worker* worker) {
+    worker->thread =
+        CreateThread(nullptr, 0, c8_runner_thread_main, worker, 0, nullptr);
+    return worker->thread != nullptr;
+}
+
+static void c8_runner_join(c8_runner_worker* worker) {
+    WaitForSingleObject(worker->thread, INFINITE);
+    CloseHandle(worker->thread);
+}
+#else
+static void* c8_runner_thread_main(void* worker) {
+    c8_runner_worker_main(worker);
+    return nullptr;
+}
+
+static bool c8_runner_start(c8_runner_worker* worker) {
+    return pthread_create(&worker->thread,
+                          nullptr,
+                          c8_runner_thread_main,
+                          worker) == 0;
+}
+
+static void c8_runner_join(c8_runner_worker* worker) {
+    pthread_join(worker->thread, nullptr);
+}
+#endif
+
+#pragma endregion
+
+uint32_t c8_runner_default_threads(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const long cores = (long)info.dwNumberOfProcessors;
+#else
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return cores > 0 ? (uint32_t)cores : 1;
+}
+
+c8_runner_stats c8_runner_run(const c8_job* jobs,
+                              uint32_t count,
+                              c8_job_result* results,
+                              uint32_t threads) {
+    c8_runner_stats stats = {
+        .jobs = 0,
+        .cycles = 0,
+        .steals = 0,
+        .machines = 0,
+        .threads = 0,
+    };
+    if (jobs == nullptr || count == 0) {
+        return stats;
+    }
+
+    if (threads == 0) {
+        threads = c8_runner_default_threads();
+    }
+    threads = C8_MIN(threads, count);
+
+    c8_runner runner = {
+        .jobs = jobs,
+        .results = results,
+        .workers = nullptr,
+        .worker_count = threads,
+    };
+    c8_atomic_store(&runner.jobs_done, 0);
+    c8_atomic_store(&runner.cycles, 0);
+    c8_atomic_store(&runner.steals, 0);
+    c8_atomic_store(&runner.machines, 0);
+
+    // Workers are cache line aligned, so they don't share lines
+    void* workers_memory = calloc(threads + 1, sizeof(c8_runner_worker));
+    if (workers_memory == nullptr) {
+        return stats;
+    }
+    runner.workers = (c8_runner_worker*)(
+        ((uintptr_t)workers_memory + 63) & ~(uintptr_t)63
+    );
+
+    for (uint32_t i = 0; i < threads; ++i) {
+        c8_runner_worker* worker = &runner.workers[i];
+        worker->runner = &runner;
+        worker->index = i;
+        const uint32_t begin = (uint32_t)((uint64_t)count * i / threads);
+        const uint32_t end = (uint32_t)((uint64_t)count * (i + 1) / threads);
+        c8_atomic_store(&worker->range, c8_runner_range(begin, end));
+    }
+
+    // The calling thread is worker 0. Jobs of workers that didn't start are
+    // stolen by the others.
+    uint32_t started = 1;
+    for (uint32_t i = 1; i < threads; ++i) {
+        runner.workers[i].started = c8_runner_start(&runner.workers[i]);
+        started += runner.workers[i].started;
+    }
+    c8_runner_worker_main(&runner.workers[0]);
+    for (uint32_t i = 1; i < threads; ++i) {
+        if (runner.workers[i].started) {
+            c8_runner_join(&runner.workers[i]);
+        }
+    }
+
+    stats.jobs = c8_atomic_load(&runner.jobs_done);
+    stats.cycles = c8_atomic_load(&runner.cycles);
+    stats.steals = c8_atomic_load(&runner.steals);
+    stats.machines = c8_atomic_load(&runner.machines);
+    stats.threads = started;
+
+    free(workers_memory);
+    return stats;
+}
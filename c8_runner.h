@@ -0,0 +1,86 @@
+#pragma once
+
+#include "c8.h"
+
+/*
+ * Parallel runner for many independent machines.
+ *
+ * Jobs are split evenly between worker threads up front. A worker that runs
+ * out of jobs steals half of the remaining jobs of another worker, so uneven
+ * jobs still keep every core busy. Each worker keeps the machines of the
+ * last few configs it ran and resets them for new jobs instead of creating
+ * new ones.
+ *
+ * Jobs have no input, so a job whose machine comes back to an earlier state
+ * at the end of a frame repeats those frames until it ends. With
+ * `skip_loops`, the runner notices that from the state hash and skips ahead
+ * to the same final state. Only those jobs pay for keeping the hash up to
+ * date, see `c8_set_state_hashing()`.
+ *
+ * A job faulting on its stack or PC usually spins in the fault handler until
+ * it ends, and one hitting a bad opcode spins on the opcode. With
+ * `halt_on_fault`, it ends at the first fault.
+ */
+
+/**
+ * A machine to run.
+ */
+typedef struct c8_job {
+    const uint8_t* rom; ///< ROM, shared between jobs and never modified.
+    uint16_t rom_size; ///< ROM size.
+    c8_machine_config config; ///< Machine config.
+    uint32_t seed; ///< RNG seed.
+    uint32_t frames; ///< Frames to run, timers advance a vblank per frame.
+    bool skip_loops; ///< Skip repeated frames, see `c8_job_result`.
+    bool halt_on_fault; ///< End the job at its first fault.
+} c8_job;
+
+/**
+ * Outcome of a job.
+ */
+typedef struct c8_job_result {
+    c8_registers registers; ///< Final registers.
+    uint64_t display_hash; ///< FNV-1a hash of the final packed display.
+    uint64_t cycles; ///< Cycles, skipped frames included.
+    uint32_t loop_frames; ///< Length of the skipped loop, 0 if none.
+    uint32_t frames; ///< Frames run, fewer than asked if halted.
+    /**
+     * First `c8_fault` of the job, C8_FAULT_NONE if none. If its machine
+     * couldn't be created, C8_FAULT_OUT_OF_MEMORY with everything else zero.
+     */
+    uint32_t fault;
+    uint16_t fault_addr; ///< Address of the faulting instruction.
+} c8_job_result;
+
+/**
+ * Totals over all jobs of a run.
+ */
+typedef struct c8_runner_stats {
+    uint64_t jobs; ///< Finished jobs.
+    uint64_t cycles; ///< Executed cycles.
+    uint64_t steals; ///< Successful steals.
+    uint64_t machines; ///< Machines created, the rest of the jobs reused one.
+    uint32_t threads; ///< Worker threads that started.
+} c8_runner_stats;
+
+/**
+ * Gets the number of online CPU cores.
+ *
+ * @return Number of cores, at least 1.
+ */
+uint32_t c8_runner_default_threads(void);
+
+/**
+ * Runs jobs on a pool of worker threads and waits for all of them.
+ *
+ * @param jobs Jobs to run.
+ * @param count Number of jobs.
+ * @param results Array of `count` results, `results[i]` is written by the
+ * worker that runs `jobs[i]`. May be NULL.
+ * @param threads Worker threads, 0 for one per core.
+ * @return Totals over all jobs, all zero if out of memory.
+ */
+c8_runner_stats c8_runner_run(const c8_job* jobs,
+                              uint32_t count,
+                              c8_job_result* results,
+                              uint32_t threads);
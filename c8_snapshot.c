@@ -0,0 +1,229 @@
+#include "c8_internal.h"
+#include <memory.h>
+
+/*
+ * Machine snapshots.
+ *
+ * A snapshot is a header followed by the machine's registers and timers,
+ * memory and packed display, copied as is. Fields use host byte order, so
+ * snapshots can only be moved between hosts of the same endianness.
+ *
+ * Caches (decoded and translated code, the byte-per-pixel display view) are
+ * not saved. On load, only the parts under changed memory and display rows
+ * are dropped and rebuilt on demand. Breakpoints, watchpoints and the
+ * halt on fault setting are left untouched.
+ */
+
+enum c8_snapshot_params {
+    C8_SNAPSHOT_MAGIC = 0x4E533843, ///< "C8SN" in little endian.
+    C8_SNAPSHOT_VERSION = 2,
+    C8_SNAPSHOT_CHUNK = 64, ///< Memory compare granularity, divides a page.
+};
+
+typedef struct c8_snapshot_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t size; ///< Whole snapshot size, including the header.
+    uint32_t checksum; ///< Checksum of everything after the header.
+    uint32_t quirks;
+    uint16_t memory_size;
+    uint8_t screen_width;
+    uint8_t screen_height;
+} c8_snapshot_header;
+
+typedef struct c8_snapshot_machine {
+    c8_registers registers;
+    uint8_t pressed_keys[C8_KEY_MAX];
+    uint32_t rng;
+    float delta_time;
+    uint16_t vblank;
+    uint8_t waiting_for_key;
+    uint8_t key_wait_key;
+    uint8_t fault;
+    uint8_t halted;
+    uint16_t fault_addr;
+} c8_snapshot_machine;
+
+static size_t c8_snapshot_display_size(const c8_state* state) {
+    return state->display_words * state->config.screen_height
+        * sizeof(uint64_t);
+}
+
+/**
+ * Fletcher-style checksum over 64-bit words.
+ */
+static uint32_t c8_snapshot_checksum(const uint8_t* data, size_t size) {
+    uint64_t a = 1;
+    uint64_t b = 0;
+
+    size_t offset = 0;
+    for (; offset + 8 <= size; offset += 8) {
+        uint64_t word;
+        memcpy(&word, data + offset, 8);
+        a += word;
+        b += a;
+    }
+    for (; offset < size; ++offset) {
+        a += data[offset];
+        b += a;
+    }
+
+    const uint64_t h = a ^ (b * UINT64_C(0x9E3779B97F4A7C15));
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+/**
+ * Copies memory from a snapshot. Only code in the changed chunks is dropped,
+ * so loading a snapshot of a nearby state keeps most of the caches.
+ */
+static void c8_snapshot_load_memory(c8_state* state, const uint8_t* memory) {
+    const uint16_t memory_size = state->config.memory_size;
+    for (uint32_t addr = 0; addr < memory_size; addr += C8_SNAPSHOT_CHUNK) {
+        const uint16_t size = C8_MIN(C8_SNAPSHOT_CHUNK, memory_size - addr);
+        const uint8_t* current =
+            state->pages[addr / C8_PAGE_SIZE]->bytes + addr % C8_PAGE_SIZE;
+        if (memcmp(current, memory + addr, size) != 0) {
+            c8_write_memory(state, addr, memory + addr, size);
+        }
+    }
+}
+
+/**
+ * Copies the packed display from a snapshot, marking changed rows.
+ */
+static void c8_snapshot_load_display(c8_state* state, const uint8_t* rows) {
+    const uint8_t words = state->display_words;
+    const size_t row_size = words * sizeof(uint64_t);
+    for (uint8_t y = 0; y < state->config.screen_height; ++y) {
+        const uint32_t first = y * words;
+        uint64_t* row = &state->display_rows[first];
+        if (memcmp(row, rows + y * row_size, row_size) != 0) {
+            for (uint8_t w = 0; state->hashing && w < words; ++w) {
+                uint64_t word;
+                memcpy(&word, rows + y * row_size + w * sizeof(uint64_t), 8);
+                state->display_hash +=
+                    c8_hash_display_keys[first + w] * (word - row[w]);
+            }
+            memcpy(row, rows + y * row_size, row_size);
+            c8_display_mark_dirty(state, y, 0, state->config.screen_width - 1);
+            state->display_view_stale = true;
+        }
+    }
+}
+
+size_t c8_snapshot_size(const c8_state* state) {
+    if (state == nullptr) {
+        return 0;
+    }
+
+    return sizeof(c8_snapshot_header)
+        + sizeof(c8_snapshot_machine)
+        + state->config.memory_size
+        + c8_snapshot_display_size(state);
+}
+
+size_t c8_snapshot_save(const c8_state* state, void* buffer, size_t size) {
+    const size_t snapshot_size = c8_snapshot_size(state);
+    if (state == nullptr || buffer == nullptr || size < snapshot_size) {
+        return 0;
+    }
+
+    uint8_t* out = buffer;
+    uint8_t* payload = out + sizeof(c8_snapshot_header);
+
+    // Zeroed padding keeps snapshots of equal states equal
+    c8_snapshot_machine machine;
+    memset(&machine, 0, sizeof(machine));
+    machine.registers = state->registers;
+    memcpy(machine.pressed_keys, state->pressed_keys, C8_KEY_MAX);
+    machine.rng = state->rng.seed;
+    machine.delta_time = state->delta_time;
+    machine.vblank = state->vblank;
+    machine.waiting_for_key = state->waiting_for_key;
+    machine.key_wait_key = state->key_wait_key;
+    machine.fault = state->fault;
+    machine.halted = state->halted;
+    machine.fault_addr = state->fault_addr;
+
+    uint8_t* p = payload;
+    memcpy(p, &machine, sizeof(machine));
+    p += sizeof(machine);
+    c8_read_memory(state, 0, p, state->config.memory_size);
+    p += state->config.memory_size;
+    memcpy(p, state->display_rows, c8_snapshot_display_size(state));
+
+    const c8_snapshot_header header = {
+        .magic = C8_SNAPSHOT_MAGIC,
+        .version = C8_SNAPSHOT_VERSION,
+        .header_size = sizeof(c8_snapshot_header),
+        .size = (uint32_t)snapshot_size,
+        .checksum = c8_snapshot_checksum(
+            payload,
+            snapshot_size - sizeof(c8_snapshot_header)
+        ),
+        .quirks = state->config.quirks,
+        .memory_size = state->config.memory_size,
+        .screen_width = state->config.screen_width,
+        .screen_height = state->config.screen_height,
+    };
+    memcpy(out, &header, sizeof(header));
+
+    return snapshot_size;
+}
+
+bool c8_snapshot_load(c8_state* state, const void* buffer, size_t size) {
+    if (state == nullptr
+        || buffer == nullptr
+        || size < sizeof(c8_snapshot_header)) {
+        return false;
+    }
+
+    const uint8_t* in = buffer;
+    c8_snapshot_header header;
+    memcpy(&header, in, sizeof(header));
+
+    const size_t snapshot_size = c8_snapshot_size(state);
+    if (header.magic != C8_SNAPSHOT_MAGIC
+        || header.version != C8_SNAPSHOT_VERSION
+        || header.header_size != sizeof(c8_snapshot_header)
+        || header.size != snapshot_size
+        || size < snapshot_size
+        || header.quirks != state->config.quirks
+        || header.memory_size != state->config.memory_size
+        || header.screen_width != state->config.screen_width
+        || header.screen_height != state->config.screen_height) {
+        return false;
+    }
+
+    const uint8_t* payload = in + sizeof(c8_snapshot_header);
+    const uint32_t checksum = c8_snapshot_checksum(
+        payload,
+        snapshot_size - sizeof(c8_snapshot_header)
+    );
+    if (checksum != header.checksum) {
+        return false;
+    }
+
+    c8_snapshot_machine machine;
+    memcpy(&machine, payload, sizeof(machine));
+
+    const uint8_t* p = payload + sizeof(machine);
+    c8_snapshot_load_memory(state, p);
+    p += state->config.memory_size;
+    c8_snapshot_load_display(state, p);
+    ++state->side_effects;
+
+    state->registers = machine.registers;
+    memcpy(state->pressed_keys, machine.pressed_keys, C8_KEY_MAX);
+    state->rng.seed = machine.rng;
+    state->delta_time = machine.delta_time;
+    state->vblank = machine.vblank;
+    state->waiting_for_key = machine.waiting_for_key != 0;
+    state->key_wait_key = machine.key_wait_key;
+    state->fault = machine.fault;
+    state->halted = machine.halted != 0;
+    state->fault_addr = machine.fault_addr;
+
+    return true;
+}
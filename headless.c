@@ -0,0 +1,607 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "c8.h"
+#include "c8_movie.h"
+#include "c8_profile.h"
+#include "c8_runner.h"
+
+/*
+ * Headless runner. Loads a ROM, runs it as fast as possible with a given
+ * quirk set and seed, prints display hashes along the way, the final
+ * registers and the throughput. Timers advance by one vblank per frame, so
+ * runs are reproducible.
+ *
+ * With --batch, runs a list of jobs on all cores instead, one per line:
+ *
+ *     rom [seed [frames [quirks]]]
+ *
+ * Missing fields take the values given on the command line. --skip-loops
+ * stops jobs early once their machine state repeats, see c8_runner.h.
+ *
+ * With --halt-on-fault, runs and jobs stop at the first fault instead of
+ * running on. Faults are printed either way.
+ *
+ * With --replay, replays a movie recorded by the frontend with the ROM
+ * instead, and checks the final state, see c8_movie.h. The movie has its
+ * own machine config and seed.
+ *
+ * With --profile or --folded, and the profiler compiled in, writes a profile
+ * report or the folded call stacks of the run.
+ */
+
+enum c8_headless_params {
+    DEFAULT_FRAMES = 600,
+    DEFAULT_HASH_INTERVAL = 60,
+    MAX_ROM_SIZE = 0x10000,
+    MAX_LINE_SIZE = 1024,
+};
+
+static const struct {
+    const char* name;
+    uint32_t quirk;
+} QUIRK_NAMES[] = {
+    { "shift", C8_QUIRK_SHIFT },
+    { "load_store_inc_i_by_x", C8_QUIRK_LOAD_STORE_INC_I_BY_X },
+    { "load_store_no_inc_i", C8_QUIRK_LOAD_STORE_NO_INC_I },
+    { "wrap_sprites", C8_QUIRK_WRAP_SPRITES },
+    { "bxnn_jump", C8_QUIRK_BXNN_JUMP },
+    { "vblank", C8_QUIRK_VBLANK },
+    { "vf_reset", C8_QUIRK_VF_RESET },
+    { "key_release", C8_QUIRK_KEY_RELEASE },
+};
+
+#define QUIRK_COUNT (sizeof(QUIRK_NAMES) / sizeof(QUIRK_NAMES[0]))
+
+/// Names of the `c8_fault` codes.
+static const char* const FAULT_NAMES[] = {
+    [C8_FAULT_NONE] = "none",
+    [C8_FAULT_STACK_OVERFLOW] = "stack_overflow",
+    [C8_FAULT_STACK_UNDERFLOW] = "stack_underflow",
+    [C8_FAULT_ILLEGAL_OPCODE] = "illegal_opcode",
+    [C8_FAULT_PC_OUT_OF_BOUNDS] = "pc_out_of_bounds",
+    [C8_FAULT_MEMORY_OUT_OF_BOUNDS] = "memory_out_of_bounds",
+    [C8_FAULT_OUT_OF_MEMORY] = "out_of_memory",
+};
+
+static void print_usage(const char* program) {
+    fprintf(
+        stderr,
+        "usage: %s [options] rom\n"
+        "  --frames N          run N frames (default %d)\n"
+        "  --cycles N          run N cycles instead of a number of frames\n"
+        "  --cycles-per-frame N\n"
+        "  --quirks LIST       comma separated quirk names, or a number\n"
+        "  --seed N            RNG seed (default 1)\n"
+        "  --engine NAME       interpreter or jit\n"
+        "  --hash-every N      print a display hash every N frames "
+        "(default %d, 0 to disable)\n"
+        "  --batch FILE        run the jobs listed in FILE in parallel\n"
+        "  --threads N         worker threads for --batch, 0 for all cores\n"
+        "  --skip-loops        skip the frames of --batch jobs that repeat "
+        "earlier ones\n"
+        "  --halt-on-fault     stop at the first fault\n"
+        "  --replay FILE       replay a movie recorded with the ROM and check "
+        "its final state\n"
+        "  --profile FILE      write a profile report to FILE\n"
+        "  --folded FILE       write folded call stacks to FILE, for flame "
+        "graphs\n"
+        "quirks:",
+        program,
+        DEFAULT_FRAMES,
+        DEFAULT_HASH_INTERVAL
+    );
+    for (size_t i = 0; i < QUIRK_COUNT; ++i) {
+        fprintf(stderr, " %s", QUIRK_NAMES[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+/**
+ * Parses a quirk list like "shift,vf_reset", or a plain number.
+ *
+ * @return false if a name is unknown.
+ */
+static bool parse_quirks(const char* text, uint32_t* quirks) {
+    char* end = nullptr;
+    const unsigned long value = strtoul(text, &end, 0);
+    if (*end == '\0') {
+        *quirks = (uint32_t)value;
+        return true;
+    }
+
+    *quirks = C8_QUIRK_NONE;
+    while (*text != '\0') {
+        const char* comma = strchr(text, ',');
+        const size_t length = comma != nullptr ? (size_t)(comma - text)
+                                               : strlen(text);
+        bool found = false;
+        for (size_t i = 0; i < QUIRK_COUNT; ++i) {
+            if (strlen(QUIRK_NAMES[i].name) == length
+                && strncmp(QUIRK_NAMES[i].name, text, length) == 0) {
+                *quirks |= QUIRK_NAMES[i].quirk;
+                found = true;
+            }
+        }
+        if (!found && length > 0) {
+            return false;
+        }
+
+        text += length;
+        if (*text == ',') {
+            ++text;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * FNV-1a hash of the packed display.
+ */
+static uint64_t hash_display(c8_state* state) {
+    uint32_t words_per_row = 0;
+    const uint64_t* rows = c8_get_display_rows(state, &words_per_row);
+    const size_t size = (size_t)words_per_row
+        * c8_get_machine_config(state)->screen_height
+        * sizeof(uint64_t);
+    const uint8_t* bytes = (const uint8_t*)rows;
+
+    uint64_t h = UINT64_C(0xCBF29CE484222325);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= UINT64_C(0x100000001B3);
+    }
+    return h;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint8_t* load_file(const char* path, uint16_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return nullptr;
+    }
+
+    uint8_t* data = malloc(MAX_ROM_SIZE);
+    if (data == nullptr) {
+        fclose(file);
+        return nullptr;
+    }
+    *size = (uint16_t)fread(data, 1, MAX_ROM_SIZE - 1, file);
+    fclose(file);
+    return data;
+}
+
+/**
+ * Writes profiler output to a file.
+ *
+ * @param state CHIP-8 machine state.
+ * @param path File path, NULL to skip.
+ * @param write `c8_profile_dump()` or `c8_profile_dump_folded()`.
+ * @return false if the file can't be written.
+ */
+static bool write_profile(const c8_state* state,
+                          const char* path,
+                          bool (* write)(const c8_state*, FILE*)) {
+    if (path == nullptr) {
+        return true;
+    }
+
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        fprintf(stderr, "Can't write %s\n", path);
+        return false;
+    }
+
+    write(state, file);
+    fclose(file);
+    return true;
+}
+
+/**
+ * Replays a movie and prints the outcome.
+ *
+ * @return Process exit code, 0 if the final state matches.
+ */
+static int run_replay(const char* path, const char* rom_path) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Can't open %s\n", path);
+        return 1;
+    }
+
+    uint16_t rom_size = 0;
+    uint8_t* rom = load_file(rom_path, &rom_size);
+    if (rom == nullptr) {
+        fprintf(stderr, "Can't load %s\n", rom_path);
+        fclose(file);
+        return 1;
+    }
+
+    const double start = now_seconds();
+    const c8_movie_replay_result result =
+        c8_movie_replay(file, rom, rom_size);
+    const double elapsed = now_seconds() - start;
+    fclose(file);
+    free(rom);
+
+    static const char* const STATUS_NAMES[] = {
+        [C8_MOVIE_OK] = "ok",
+        [C8_MOVIE_IO_ERROR] = "read error",
+        [C8_MOVIE_BAD_FORMAT] = "not a movie",
+        [C8_MOVIE_ROM_MISMATCH] = "ROM mismatch",
+        [C8_MOVIE_TRUNCATED] = "truncated",
+        [C8_MOVIE_HASH_MISMATCH] = "final state mismatch",
+    };
+    printf("%s: %u frames, %llu cycles in %.3f s\n",
+           STATUS_NAMES[result.status],
+           result.frames,
+           (unsigned long long)result.cycles,
+           elapsed);
+    if (result.status == C8_MOVIE_HASH_MISMATCH) {
+        printf("final state %016llx, expected %016llx\n",
+               (unsigned long long)result.hash,
+               (unsigned long long)result.expected_hash);
+    }
+
+    return result.status == C8_MOVIE_OK ? 0 : 1;
+}
+
+typedef struct batch_rom {
+    char path[MAX_LINE_SIZE];
+    uint8_t* data;
+    uint16_t size;
+} batch_rom;
+
+/**
+ * Runs the jobs listed in a file on the runner's thread pool.
+ *
+ * @return Process exit code.
+ */
+static int run_batch(const char* path,
+                     c8_machine_config config,
+                     uint32_t seed,
+                     uint32_t frames,
+                     uint32_t threads,
+                     bool skip_loops,
+                     bool halt_on_fault) {
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Can't open %s\n", path);
+        return 1;
+    }
+
+    c8_job* jobs = nullptr;
+    uint32_t job_count = 0;
+    batch_rom* roms = nullptr;
+    uint32_t rom_count = 0;
+    int code = 0;
+
+    char line[MAX_LINE_SIZE];
+    char rom_path[MAX_LINE_SIZE];
+    char quirks[MAX_LINE_SIZE];
+    for (uint32_t line_number = 1; fgets(line, sizeof(line), file) != nullptr;
+         ++line_number) {
+        c8_job job = {
+            .rom = nullptr,
+            .rom_size = 0,
+            .config = config,
+            .seed = seed,
+            .frames = frames,
+            .skip_loops = skip_loops,
+            .halt_on_fault = halt_on_fault,
+        };
+        const int fields = sscanf(line,
+                                  "%1023s %u %u %1023s",
+                                  rom_path,
+                                  &job.seed,
+                                  &job.frames,
+                                  quirks);
+        if (fields <= 0 || rom_path[0] == '#') {
+            continue;
+        }
+        if (fields == 4 && !parse_quirks(quirks, &job.config.quirks)) {
+            fprintf(stderr, "%s:%u: unknown quirk\n", path, line_number);
+            code = 2;
+            break;
+        }
+
+        // Jobs share ROMs loaded once
+        uint32_t rom = 0;
+        while (rom < rom_count && strcmp(roms[rom].path, rom_path) != 0) {
+            ++rom;
+        }
+        if (rom == rom_count) {
+            batch_rom* grown =
+                realloc(roms, (rom_count + 1) * sizeof(batch_rom));
+            if (grown == nullptr) {
+                fprintf(stderr, "Out of memory\n");
+                code = 1;
+                break;
+            }
+            roms = grown;
+            strcpy(roms[rom].path, rom_path);
+            roms[rom].data = load_file(rom_path, &roms[rom].size);
+            ++rom_count;
+            if (roms[rom].data == nullptr) {
+                fprintf(stderr, "Can't load %s\n", rom_path);
+                code = 1;
+                break;
+            }
+        }
+        job.rom = roms[rom].data;
+        job.rom_size = roms[rom].size;
+
+        c8_job* grown = realloc(jobs, (job_count + 1) * sizeof(c8_job));
+        if (grown == nullptr) {
+            fprintf(stderr, "Out of memory\n");
+            code = 1;
+            break;
+        }
+        jobs = grown;
+        jobs[job_count++] = job;
+    }
+    fclose(file);
+
+    c8_job_result* results = nullptr;
+    if (code == 0) {
+        results = calloc(job_count, sizeof(c8_job_result));
+        if (results == nullptr && job_count > 0) {
+            fprintf(stderr, "Out of memory\n");
+            code = 1;
+        }
+    }
+
+    if (code == 0) {
+        const double start = now_seconds();
+        const c8_runner_stats stats =
+            c8_runner_run(jobs, job_count, results, threads);
+        const double elapsed = now_seconds() - start;
+
+        for (uint32_t i = 0; i < job_count; ++i) {
+            printf("job %u %016llx pc=%03X cycles=%llu",
+                   i,
+                   (unsigned long long)results[i].display_hash,
+                   results[i].registers.pc,
+                   (unsigned long long)results[i].cycles);
+            if (results[i].loop_frames > 0) {
+                printf(" loop=%u", results[i].loop_frames);
+            }
+            if (results[i].fault != C8_FAULT_NONE) {
+                printf(" fault=%s@%03X frames=%u",
+                       FAULT_NAMES[results[i].fault],
+                       results[i].fault_addr,
+                       results[i].frames);
+            }
+            printf("\n");
+        }
+        printf("%llu jobs, %llu cycles in %.3f s, %.1f MIPS, "
+               "%u threads, %llu steals, %llu machines\n",
+               (unsigned long long)stats.jobs,
+               (unsigned long long)stats.cycles,
+               elapsed,
+               elapsed > 0. ? (double)stats.cycles / elapsed / 1e6 : 0.,
+               stats.threads,
+               (unsigned long long)stats.steals,
+               (unsigned long long)stats.machines);
+    }
+
+    free(results);
+    for (uint32_t i = 0; i < rom_count; ++i) {
+        free(roms[i].data);
+    }
+    free(roms);
+    free(jobs);
+    return code;
+}
+
+int main(int argc, char** argv) {
+    c8_machine_config config = c8_get_default_machine_config();
+    uint64_t frames = DEFAULT_FRAMES;
+    uint64_t cycles = 0;
+    uint32_t seed = 1;
+    uint32_t hash_interval = DEFAULT_HASH_INTERVAL;
+    const char* rom_path = nullptr;
+    const char* batch_path = nullptr;
+    const char* replay_path = nullptr;
+    uint32_t threads = 0;
+    const char* profile_path = nullptr;
+    const char* folded_path = nullptr;
+    bool skip_loops = false;
+    bool halt_on_fault = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg[0] != '-') {
+            rom_path = arg;
+            continue;
+        }
+        if (strcmp(arg, "--skip-loops") == 0) {
+            skip_loops = true;
+            continue;
+        }
+        if (strcmp(arg, "--halt-on-fault") == 0) {
+            halt_on_fault = true;
+            continue;
+        }
+        if (value == nullptr) {
+            print_usage(argv[0]);
+            return 2;
+        }
+        ++i;
+
+        if (strcmp(arg, "--frames") == 0) {
+            frames = strtoull(value, nullptr, 0);
+        }
+        else if (strcmp(arg, "--cycles") == 0) {
+            cycles = strtoull(value, nullptr, 0);
+        }
+        else if (strcmp(arg, "--cycles-per-frame") == 0) {
+            config.cycles_per_frame = (uint16_t)strtoul(value, nullptr, 0);
+        }
+        else if (strcmp(arg, "--quirks") == 0) {
+            if (!parse_quirks(value, &config.quirks)) {
+                fprintf(stderr, "Unknown quirk in \"%s\"\n", value);
+                return 2;
+            }
+        }
+        else if (strcmp(arg, "--seed") == 0) {
+            seed = (uint32_t)strtoul(value, nullptr, 0);
+        }
+        else if (strcmp(arg, "--engine") == 0) {
+            if (strcmp(value, "interpreter") == 0) {
+                config.engine = C8_ENGINE_INTERPRETER;
+            }
+            else if (strcmp(value, "jit") == 0) {
+                config.engine = C8_ENGINE_JIT;
+            }
+            else {
+                fprintf(stderr, "Unknown engine \"%s\"\n", value);
+                return 2;
+            }
+        }
+        else if (strcmp(arg, "--hash-every") == 0) {
+            hash_interval = (uint32_t)strtoul(value, nullptr, 0);
+        }
+        else if (strcmp(arg, "--batch") == 0) {
+            batch_path = value;
+        }
+        else if (strcmp(arg, "--replay") == 0) {
+            replay_path = value;
+        }
+        else if (strcmp(arg, "--threads") == 0) {
+            threads = (uint32_t)strtoul(value, nullptr, 0);
+        }
+        else if (strcmp(arg, "--profile") == 0) {
+            profile_path = value;
+        }
+        else if (strcmp(arg, "--folded") == 0) {
+            folded_path = value;
+        }
+        else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (batch_path != nullptr && config.cycles_per_frame > 0) {
+        return run_batch(batch_path,
+                         config,
+                         seed,
+                         (uint32_t)frames,
+                         threads,
+                         skip_loops,
+                         halt_on_fault);
+    }
+
+    if (rom_path == nullptr || config.cycles_per_frame == 0) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    if (replay_path != nullptr) {
+        return run_replay(replay_path, rom_path);
+    }
+
+    uint16_t rom_size = 0;
+    uint8_t* rom = load_file(rom_path, &rom_size);
+    if (rom == nullptr) {
+        fprintf(stderr, "Can't load %s\n", rom_path);
+        return 1;
+    }
+
+    if (cycles > 0) {
+        frames = (cycles + config.cycles_per_frame - 1)
+            / config.cycles_per_frame;
+    }
+    else {
+        cycles = frames * config.cycles_per_frame;
+    }
+
+    c8_state* vm = c8_create(config);
+    if (vm == nullptr) {
+        fprintf(stderr, "Out of memory\n");
+        free(rom);
+        return 1;
+    }
+    c8_set_rng_seed(vm, seed);
+    c8_set_halt_on_fault(vm, halt_on_fault);
+    c8_load_rom(vm, rom, rom_size);
+    free(rom);
+
+    const bool profiling = profile_path != nullptr || folded_path != nullptr;
+    if (profiling && !c8_profile_enable(vm, true)) {
+        fprintf(stderr,
+                "The profiler is not compiled in, configure with "
+                "-DC8_ENABLE_PROFILER=ON\n");
+        c8_destroy(vm);
+        return 2;
+    }
+
+    const float MS_PER_FRAME = 1000.f / 60.f;
+    uint64_t executed = 0;
+    uint64_t budget = cycles;
+    uint64_t frames_run = 0;
+    const double start = now_seconds();
+    for (uint64_t frame = 1; frame <= frames; ++frame) {
+        const uint32_t frame_budget =
+            (uint32_t)C8_MIN(budget, config.cycles_per_frame);
+        budget -= frame_budget;
+
+        const c8_run_result run = c8_run(vm, frame_budget, C8_STOP_BUDGET);
+        executed += run.cycles;
+        frames_run = frame;
+        const bool halted = run.reason == C8_STOP_FAULT;
+        if (!halted) {
+            c8_update_timers(vm, MS_PER_FRAME);
+        }
+
+        const bool print_hash = hash_interval > 0
+            && (frame % hash_interval == 0 || frame == frames || halted);
+        if (print_hash) {
+            printf("frame %llu %016llx\n",
+                   (unsigned long long)frame,
+                   (unsigned long long)hash_display(vm));
+        }
+        if (halted) {
+            break;
+        }
+    }
+
+    const double elapsed = now_seconds() - start;
+
+    const c8_registers* regs = c8_get_registers(vm);
+    printf("pc=%03X i=%03X sp=%u dt=%u st=%u\n",
+           regs->pc,
+           regs->i,
+           regs->sp,
+           regs->dt,
+           regs->st);
+    for (int i = 0; i < 16; ++i) {
+        printf("v%X=%02X%c", i, regs->v[i], i % 8 == 7 ? '\n' : ' ');
+    }
+    uint16_t fault_addr = 0;
+    const uint32_t fault = c8_get_fault(vm, &fault_addr);
+    if (fault != C8_FAULT_NONE) {
+        printf("fault=%s@%03X\n", FAULT_NAMES[fault], fault_addr);
+    }
+    printf("%llu frames, %llu cycles in %.3f s, %.1f MIPS\n",
+           (unsigned long long)frames_run,
+           (unsigned long long)executed,
+           elapsed,
+           elapsed > 0. ? (double)executed / elapsed / 1e6 : 0.);
+
+    bool written = write_profile(vm, profile_path, c8_profile_dump);
+    written &= write_profile(vm, folded_path, c8_profile_dump_folded);
+
+    c8_destroy(vm);
+    return written ? 0 : 1;
+}
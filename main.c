@@ -1,3 +1,5 @@
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include "raylib.h"
 
@@ -6,6 +8,9 @@
 #include "raygui.h"
 
 #include "c8.h"
+#include "c8_movie.h"
+#include "c8_profile.h"
+#include "c8_rewind.h"
 
 enum c8_frontend_params {
     MAX_AUDIO_SAMPLE_SIZE = 512,
@@ -13,6 +18,11 @@ enum c8_frontend_params {
     SCREEN_WIDTH = 800,
     SCREEN_HEIGHT = 600,
     PIXEL_SIZE = 8,
+    REWIND_CAPACITY = 2 << 20, ///< About a minute of history.
+    REWIND_KEYFRAME_INTERVAL = 60,
+    REWIND_KEY = KEY_BACKSPACE,
+    PROFILER_LOOPS = 10, ///< Hottest loops in the profiler window.
+    PROFILER_OP_CLASSES = 10, ///< Hottest opcode classes in the window.
 };
 
 const uint8_t TEST_ROM[] = {
@@ -43,7 +53,11 @@ static c8_machine_config vm_config = {};
 
 static c8_state* vm = nullptr;
 
-static const uint8_t* vm_display = nullptr;
+static c8_rewind* vm_rewind = nullptr;
+
+static const uint64_t* vm_display = nullptr;
+
+static uint32_t vm_display_words = 0;
 
 static const c8_registers* vm_regs = nullptr;
 
@@ -57,6 +71,10 @@ static uint8_t* rom = (uint8_t*)TEST_ROM;
 
 static int rom_size = sizeof(TEST_ROM);
 
+static FILE* movie_file = nullptr;
+
+static c8_movie_writer* movie_writer = nullptr;
+
 void beep_callback(void* buffer, unsigned int frames) {
     static float sine_arg = 0.f;
     int16_t* b = (int16_t*)buffer;
@@ -69,33 +87,301 @@ void beep_callback(void* buffer, unsigned int frames) {
     }
 }
 
-void update_keys(c8_state* state) {
+uint16_t update_keys(c8_state* state) {
+    uint16_t keys = 0;
     for (int i = 0; i < 16; ++i) {
         if (IsKeyDown(KEY_BINDS[i])) {
             c8_press_key(state, i);
+            keys |= 1 << i;
         }
         else {
             c8_release_key(state, i);
         }
     }
+    return keys;
 }
 
-void recreate_state() {
-    if (vm != nullptr) {
-        c8_destroy(vm);
+/**
+ * Finishes the movie being recorded, if any. Called before anything a movie
+ * can't replay: loading another ROM, changing the config or rewinding.
+ */
+void stop_recording() {
+    if (movie_writer == nullptr) {
+        return;
+    }
+
+    if (!c8_movie_writer_finish(movie_writer, vm)) {
+        TraceLog(LOG_WARNING, "Failed to write the movie");
+    }
+    movie_writer = nullptr;
+    fclose(movie_file);
+    movie_file = nullptr;
+}
+
+bool colors_equal(Color a, Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+/**
+ * Redraws changed display rows into the screen texture.
+ */
+void update_screen(RenderTexture2D screen,
+                   bool redraw_all,
+                   Color pixel_color,
+                   Color bg_color) {
+    c8_display_dirty dirty;
+    if (!c8_get_display_dirty(vm, &dirty) && !redraw_all) {
+        return;
     }
+
+    BeginTextureMode(screen);
+    for (int y = 0; y < vm_config.screen_height; ++y) {
+        if (!redraw_all && !((dirty.rows[y / 64] >> (y % 64)) & 1)) {
+            continue;
+        }
+
+        DrawRectangle(
+            0,
+            y * PIXEL_SIZE,
+            vm_config.screen_width * PIXEL_SIZE,
+            PIXEL_SIZE,
+            bg_color
+        );
+        const uint64_t* row = &vm_display[y * vm_display_words];
+        for (int x = 0; x < vm_config.screen_width; ++x) {
+            if ((row[x / 64] >> (63 - x % 64)) & 1) {
+                DrawRectangle(
+                    x * PIXEL_SIZE,
+                    y * PIXEL_SIZE,
+                    PIXEL_SIZE,
+                    PIXEL_SIZE,
+                    pixel_color
+                );
+            }
+        }
+    }
+    EndTextureMode();
+
+    c8_clear_display_dirty(vm);
+}
+
+void recreate_state() {
+    stop_recording();
+
+    c8_state* old_vm = vm;
     vm = c8_create(vm_config);
     c8_set_rng_seed(vm, seed != 0 ?: time(nullptr));
+    c8_profile_enable(vm, c8_profile_is_enabled(old_vm));
+
+    // Keep breakpoints and watchpoints
+    if (old_vm != nullptr) {
+        for (uint16_t addr = 0; addr < vm_config.memory_size; ++addr) {
+            c8_set_breakpoint(vm, addr, c8_has_breakpoint(old_vm, addr));
+            c8_set_watchpoint(
+                vm,
+                addr,
+                c8_get_watchpoint(old_vm, addr),
+                true
+            );
+        }
+        c8_destroy(old_vm);
+    }
 
-    uint32_t display_size;
-    vm_display = c8_get_display(vm, &display_size);
+    vm_display = c8_get_display_rows(vm, &vm_display_words);
     vm_regs = c8_get_registers(vm);
     vm_mem = c8_get_memory(vm);
 
+    // Old frames can't be loaded into a machine with another config
+    c8_rewind_destroy(vm_rewind);
+    vm_rewind = c8_rewind_create(
+        vm,
+        REWIND_CAPACITY,
+        REWIND_KEYFRAME_INTERVAL
+    );
+
     c8_load_rom(vm, rom, rom_size);
 }
 
-int main(void) {
+/**
+ * Draws the profiler window contents: counters, hottest loops and opcode
+ * classes.
+ */
+void draw_profile() {
+    c8_profile profile;
+    if (!c8_profile_get(vm, &profile)) {
+        return;
+    }
+
+    // Stalls are shares of all cycles, key waits included
+    const uint64_t cycles = profile.instructions + profile.key_wait_cycles;
+    const char* labels[] = {
+        "Instructions", "Sprite rows", "VBlank stalls", "Key waits",
+    };
+    const uint64_t values[] = {
+        profile.instructions,
+        profile.sprite_rows,
+        profile.vblank_stall_cycles,
+        profile.key_wait_cycles,
+    };
+    for (int i = 0; i < 4; ++i) {
+        const char* text = i < 2
+            ? TextFormat("%s\t%llu", labels[i], (unsigned long long)values[i])
+            : TextFormat(
+                "%s\t%llu (%.1f%%)",
+                labels[i],
+                (unsigned long long)values[i],
+                cycles > 0 ? 100. * (double)values[i] / (double)cycles : 0.
+            );
+        GuiDrawText(
+            text,
+            (Rectangle){ 50, 100 + 20 * i, 300, 20 },
+            TEXT_ALIGN_LEFT,
+            WHITE
+        );
+    }
+
+    GuiDrawText(
+        "Hottest loops",
+        (Rectangle){ 50, 200, 300, 20 },
+        TEXT_ALIGN_LEFT,
+        WHITE
+    );
+    c8_profile_loop loops[PROFILER_LOOPS];
+    const uint32_t loop_count =
+        c8_profile_get_hot_loops(vm, loops, PROFILER_LOOPS);
+    for (uint32_t i = 0; i < loop_count; ++i) {
+        GuiDrawText(
+            TextFormat(
+                "%04X-%04X\t%llu cycles, %llu iterations",
+                loops[i].start,
+                loops[i].end,
+                (unsigned long long)loops[i].cycles,
+                (unsigned long long)loops[i].iterations
+            ),
+            (Rectangle){ 50, 225 + 20 * i, 350, 20 },
+            TEXT_ALIGN_LEFT,
+            WHITE
+        );
+    }
+
+    GuiDrawText(
+        "Opcode classes",
+        (Rectangle){ 450, 70, 300, 20 },
+        TEXT_ALIGN_LEFT,
+        WHITE
+    );
+    bool listed[C8_PROFILE_OP_CLASSES] = { false };
+    for (int i = 0; i < PROFILER_OP_CLASSES; ++i) {
+        int best = -1;
+        for (int k = 0; k < C8_PROFILE_OP_CLASSES; ++k) {
+            if (!listed[k] && profile.op_counts[k] > 0
+                && (best < 0
+                    || profile.op_counts[k] > profile.op_counts[best])) {
+                best = k;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+
+        listed[best] = true;
+        GuiDrawText(
+            TextFormat(
+                "%s\t%llu",
+                c8_profile_op_class_name(best),
+                (unsigned long long)profile.op_counts[best]
+            ),
+            (Rectangle){ 450, 95 + 20 * i, 300, 20 },
+            TEXT_ALIGN_LEFT,
+            WHITE
+        );
+    }
+}
+
+/**
+ * Loads a ROM file given on the command line.
+ */
+bool load_rom_file(const char* path) {
+    rom = LoadFileData(path, &rom_size);
+    if (rom == nullptr) {
+        rom = (uint8_t*)TEST_ROM;
+        rom_size = sizeof(TEST_ROM);
+        return false;
+    }
+
+    file_rom_loaded = true;
+    return true;
+}
+
+/**
+ * Replays a movie without a window and checks the final state.
+ *
+ * @return Process exit code.
+ */
+int replay_movie(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Can't open %s\n", path);
+        return 1;
+    }
+
+    const clock_t start = clock();
+    const c8_movie_replay_result result =
+        c8_movie_replay(file, rom, rom_size);
+    const double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    fclose(file);
+
+    static const char* STATUS_NAMES[] = {
+        "ok",
+        "read error",
+        "not a movie",
+        "ROM mismatch",
+        "truncated",
+        "final state mismatch",
+    };
+    printf("%s: %u frames, %llu cycles in %.3f s\n",
+           STATUS_NAMES[result.status],
+           result.frames,
+           (unsigned long long)result.cycles,
+           elapsed);
+    if (result.status == C8_MOVIE_HASH_MISMATCH) {
+        printf("final state %016llx, expected %016llx\n",
+               (unsigned long long)result.hash,
+               (unsigned long long)result.expected_hash);
+    }
+
+    return result.status == C8_MOVIE_OK ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    const char* record_path = nullptr;
+    const char* replay_path = nullptr;
+    const char* rom_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        }
+        else {
+            rom_path = argv[i];
+        }
+    }
+
+    if (rom_path != nullptr && !load_rom_file(rom_path)) {
+        fprintf(stderr, "Can't load %s\n", rom_path);
+        return 1;
+    }
+
+    if (replay_path != nullptr) {
+        const int code = replay_movie(replay_path);
+        if (file_rom_loaded) {
+            UnloadFileData(rom);
+        }
+        return code;
+    }
+
     SetConfigFlags(FLAG_WINDOW_HIGHDPI);
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "c8");
     SetTargetFPS(60);
@@ -110,13 +396,31 @@ int main(void) {
     vm_config = c8_get_default_machine_config();
     recreate_state();
 
+    if (record_path != nullptr) {
+        movie_file = fopen(record_path, "wb");
+        movie_writer = c8_movie_writer_create(movie_file, vm, rom, rom_size);
+        if (movie_writer == nullptr) {
+            TraceLog(LOG_WARNING, "Can't record to %s", record_path);
+            if (movie_file != nullptr) {
+                fclose(movie_file);
+                movie_file = nullptr;
+            }
+        }
+    }
+
     int16_t mem_view_offset = 0;
-    uint16_t breakpoint_addr = 0xFFFF;
     bool execution_paused = false;
 
     bool options_opened = false;
+    bool profiler_opened = false;
     Color pixel_color = WHITE;
     Color bg_color = BLACK;
+    Color screen_pixel_color = pixel_color;
+    Color screen_bg_color = bg_color;
+    RenderTexture2D screen = LoadRenderTexture(
+        vm_config.screen_width * PIXEL_SIZE,
+        vm_config.screen_height * PIXEL_SIZE
+    );
     bool enable_sound = true;
 
     bool quirk_shift = (vm_config.quirks & C8_QUIRK_SHIFT) != 0;
@@ -128,6 +432,8 @@ int main(void) {
     bool quirk_jump = (vm_config.quirks & C8_QUIRK_BXNN_JUMP) != 0;
     bool quirk_vblank = (vm_config.quirks & C8_QUIRK_VBLANK) != 0;
     bool quirk_vf_reset = (vm_config.quirks & C8_QUIRK_VF_RESET) != 0;
+    bool quirk_key_release =
+        (vm_config.quirks & C8_QUIRK_KEY_RELEASE) != 0;
 
     // Set GUI background color to black for options window
     GuiSetStyle(DEFAULT, BACKGROUND_COLOR, 0x000000FF);
@@ -141,10 +447,12 @@ int main(void) {
                     if (file_rom_loaded) {
                         UnloadFileData(rom);
                     }
+                    stop_recording();
                     file_rom_loaded = true;
                     rom = LoadFileData(path, &rom_size);
                     c8_reset(vm);
                     c8_load_rom(vm, rom, rom_size);
+                    c8_rewind_clear(vm_rewind);
                     SetWindowTitle(
                         TextFormat("c8 - %s", GetFileName(path))
                     );
@@ -166,39 +474,49 @@ int main(void) {
             }
         }
 
-        if (!execution_paused) {
-            for (int i = 0; i < vm_config.cycles_per_frame; ++i) {
-                if (vm_regs->pc == breakpoint_addr) {
-                    execution_paused = true;
-                    break;
-                }
-                c8_step(vm);
+        const bool rewinding = !execution_paused && IsKeyDown(REWIND_KEY);
+        uint32_t frame_cycles = 0;
+        if (rewinding) {
+            stop_recording();
+            c8_rewind_pop(vm_rewind, vm);
+        }
+        else if (!execution_paused) {
+            const c8_run_result run = c8_run(
+                vm,
+                vm_config.cycles_per_frame,
+                C8_STOP_BREAKPOINT | C8_STOP_WATCH_READ | C8_STOP_WATCH_WRITE
+            );
+            frame_cycles = run.cycles;
+            if (run.reason == C8_STOP_BREAKPOINT
+                || run.reason == C8_STOP_WATCH_READ
+                || run.reason == C8_STOP_WATCH_WRITE) {
+                execution_paused = true;
             }
         }
 
+        // Only rows changed by the VM are redrawn, unless colors change
+        const bool colors_changed =
+            !colors_equal(pixel_color, screen_pixel_color)
+                || !colors_equal(bg_color, screen_bg_color);
+        update_screen(screen, colors_changed, pixel_color, bg_color);
+        screen_pixel_color = pixel_color;
+        screen_bg_color = bg_color;
+
         BeginDrawing();
         ClearBackground(BLACK);
 
-        DrawRectangle(
-            0,
-            0,
-            vm_config.screen_width * PIXEL_SIZE,
-            vm_config.screen_height * PIXEL_SIZE,
-            bg_color
+        // Render textures are upside down
+        DrawTextureRec(
+            screen.texture,
+            (Rectangle){
+                0,
+                0,
+                (float)screen.texture.width,
+                (float)-screen.texture.height
+            },
+            (Vector2){ 0, 0 },
+            WHITE
         );
-        for (int y = 0; y < vm_config.screen_height; ++y) {
-            for (int x = 0; x < vm_config.screen_width; ++x) {
-                if (vm_display[y * vm_config.screen_width + x]) {
-                    DrawRectangle(
-                        x * PIXEL_SIZE,
-                        y * PIXEL_SIZE,
-                        PIXEL_SIZE,
-                        PIXEL_SIZE,
-                        pixel_color
-                    );
-                }
-            }
-        }
 
         const float
             uiOffsetY = (float)(vm_config.screen_height * PIXEL_SIZE + 3);
@@ -235,12 +553,13 @@ int main(void) {
             "Step"
         )) {
             execution_paused = true;
-            c8_step(vm);
-            c8_update_timers(
-                vm,
-                1000.f / 60.f / (float)vm_config.cycles_per_frame
-            );
-            update_keys(vm);
+            const float delta_time =
+                1000.f / 60.f / (float)vm_config.cycles_per_frame;
+            // Also steps over a breakpoint
+            const c8_run_result run = c8_run(vm, 1, C8_STOP_BUDGET);
+            c8_update_timers(vm, delta_time);
+            const uint16_t keys = update_keys(vm);
+            c8_movie_write_frame(movie_writer, run.cycles, delta_time, keys);
         }
 
         if (GuiButton(
@@ -253,8 +572,9 @@ int main(void) {
             "Reset"
         )) {
             execution_paused = false;
-            c8_reset(vm);
-            c8_load_rom(vm, rom, rom_size);
+            c8_reset_to_pristine(vm);
+            c8_rewind_clear(vm_rewind);
+            c8_movie_write_reset(movie_writer);
         }
 
         if (GuiButton(
@@ -267,8 +587,24 @@ int main(void) {
             "Options"
         )) {
             options_opened = true;
+            profiler_opened = false;
         }
 
+#ifdef C8_ENABLE_PROFILER
+        if (GuiButton(
+            (Rectangle){
+                uiOffsetX + 70,
+                40,
+                60,
+                20
+            },
+            "Profiler"
+        )) {
+            profiler_opened = true;
+            options_opened = false;
+        }
+#endif
+
         GuiGroupBox(
             (Rectangle){
                 1,
@@ -278,6 +614,7 @@ int main(void) {
             },
             "Registers"
         );
+        vm_mem = c8_get_memory(vm);
         const uint8_t* mem_at_pc = vm_mem + vm_regs->pc;
         GuiDrawText(
             TextFormat(
@@ -417,20 +754,32 @@ int main(void) {
                 20
             };
 
-            Color cell_color = (mem_view_offset + i) == breakpoint_addr
-                ? YELLOW
-                : WHITE;
+            const uint16_t cell_addr = mem_view_offset + i;
+            const bool has_breakpoint = c8_has_breakpoint(vm, cell_addr);
+            const uint32_t watch = c8_get_watchpoint(vm, cell_addr);
+
+            Color cell_color = WHITE;
+            if (has_breakpoint) {
+                cell_color = YELLOW;
+            }
+            else if (watch != 0) {
+                cell_color = ORANGE;
+            }
 
+            // Left click toggles a breakpoint, right click a watchpoint
             // TODO: track mouse press like in GuiButton
             Vector2 mouse_point = GetMousePosition();
             if (CheckCollisionPointRec(mouse_point, cell_rect)) {
                 if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
-                    if (breakpoint_addr != mem_view_offset + i) {
-                        breakpoint_addr = mem_view_offset + i;
-                    }
-                    else {
-                        breakpoint_addr = 0xFFFF;
-                    }
+                    c8_set_breakpoint(vm, cell_addr, !has_breakpoint);
+                }
+                if (IsMouseButtonReleased(MOUSE_BUTTON_RIGHT)) {
+                    c8_set_watchpoint(
+                        vm,
+                        cell_addr,
+                        C8_WATCH_READ | C8_WATCH_WRITE,
+                        watch == 0
+                    );
                 }
             }
 
@@ -663,14 +1012,73 @@ int main(void) {
                 vm_config.quirks ^= C8_QUIRK_VF_RESET;
                 recreate_state();
             }
+
+            if (GuiCheckBox(
+                (Rectangle){
+                    250,
+                    270,
+                    20,
+                    20
+                },
+                "Key release quirk",
+                &quirk_key_release
+            )) {
+                vm_config.quirks ^= C8_QUIRK_KEY_RELEASE;
+                recreate_state();
+            }
+        }
+
+        if (profiler_opened) {
+            if (GuiWindowBox(
+                (Rectangle){
+                    40,
+                    40,
+                    720,
+                    520
+                },
+                "Profiler"
+            )) {
+                profiler_opened = false;
+            }
+
+            bool profiling = c8_profile_is_enabled(vm);
+            if (GuiCheckBox(
+                (Rectangle){
+                    50,
+                    70,
+                    20,
+                    20
+                },
+                "Profile",
+                &profiling
+            )) {
+                c8_profile_enable(vm, profiling);
+            }
+
+            if (GuiButton(
+                (Rectangle){
+                    150,
+                    70,
+                    60,
+                    20
+                },
+                "Clear"
+            )) {
+                c8_profile_reset(vm);
+            }
+
+            draw_profile();
         }
 
         EndDrawing();
 
-        if (!execution_paused) {
-            c8_update_timers(vm, GetFrameTime() * 1000.f);
+        if (!execution_paused && !rewinding) {
+            const float delta_time = GetFrameTime() * 1000.f;
+            c8_update_timers(vm, delta_time);
 
-            update_keys(vm);
+            const uint16_t keys = update_keys(vm);
+            c8_rewind_push(vm_rewind, vm);
+            c8_movie_write_frame(movie_writer, frame_cycles, delta_time, keys);
         }
     }
 
@@ -678,7 +1086,10 @@ int main(void) {
         UnloadFileData(rom);
     }
 
+    stop_recording();
+    c8_rewind_destroy(vm_rewind);
     c8_destroy(vm);
+    UnloadRenderTexture(screen);
     UnloadAudioStream(audio);
     CloseAudioDevice();
     CloseWindow();